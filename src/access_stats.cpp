@@ -0,0 +1,169 @@
+#include "access_stats.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+const char *AccessStats::get_region_name(Region region) {
+    switch (region) {
+        case ROM0:
+            return "rom0";
+        case ROMX:
+            return "romx";
+        case VRAM:
+            return "vram";
+        case CART_RAM:
+            return "cart_ram";
+        case WRAM:
+            return "wram";
+        case ECHO:
+            return "echo";
+        case OAM:
+            return "oam";
+        case UNUSABLE:
+            return "unusable";
+        case IO:
+            return "io";
+        case HRAM:
+            return "hram";
+        default:
+            return "?";
+    }
+}
+
+void AccessStats::Counters::add(const Counters &other) {
+    auto add_array = [](auto &dst, const auto &src) {
+        for (size_t i = 0; i < dst.size(); i++) {
+            dst[i] += src[i];
+        }
+    };
+    this->n_frames += other.n_frames;
+    add_array(this->reads, other.reads);
+    add_array(this->writes, other.writes);
+    add_array(this->page_reads, other.page_reads);
+    add_array(this->page_writes, other.page_writes);
+    add_array(this->rom_bank_reads, other.rom_bank_reads);
+    add_array(this->io_reads, other.io_reads);
+    add_array(this->io_writes, other.io_writes);
+}
+
+// the members of the JSON object, without braces
+static void write_members(std::ostream &os, const AccessStats::Counters &c) {
+    os << "\"regions\": {";
+    for (int r = 0; r < AccessStats::N_REGIONS; r++) {
+        os << fmt::format("{}\"{}\": [{}, {}]",
+                          r > 0 ? ", " : "",
+                          AccessStats::get_region_name(static_cast<AccessStats::Region>(r)),
+                          c.reads[r],
+                          c.writes[r]);
+    }
+    os << "}, \"rom_banks\": {";
+    const char *sep = "";
+    for (size_t bank = 0; bank < c.rom_bank_reads.size(); bank++) {
+        if (c.rom_bank_reads[bank] > 0) {
+            os << fmt::format("{}\"{}\": {}", sep, bank, c.rom_bank_reads[bank]);
+            sep = ", ";
+        }
+    }
+    os << "}, \"pages\": {";
+    sep = "";
+    for (size_t page = 0; page < c.page_reads.size(); page++) {
+        if (c.page_reads[page] > 0 || c.page_writes[page] > 0) {
+            os << fmt::format("{}\"{:02x}\": [{}, {}]", sep, page, c.page_reads[page], c.page_writes[page]);
+            sep = ", ";
+        }
+    }
+    os << "}, \"io\": {";
+    sep = "";
+    for (size_t reg = 0; reg < c.io_reads.size(); reg++) {
+        if (c.io_reads[reg] > 0 || c.io_writes[reg] > 0) {
+            os << fmt::format("{}\"ff{:02x}\": [{}, {}]", sep, reg, c.io_reads[reg], c.io_writes[reg]);
+            sep = ", ";
+        }
+    }
+    os << "}";
+}
+
+void AccessStats::write_json(std::ostream &os, const Counters &counters) {
+    os << fmt::format("{{\"frames\": {}, ", counters.n_frames);
+    write_members(os, counters);
+    os << "}\n";
+}
+
+void AccessStats::end_frame() {
+    this->frame.n_frames = 1;
+    this->total.add(this->frame);
+
+    if (this->frame_output != nullptr) {
+        *this->frame_output << fmt::format("{{\"frame\": {}, ", this->total.n_frames - 1);
+        write_members(*this->frame_output, this->frame);
+        *this->frame_output << "}\n";
+    }
+
+    this->frame = Counters{};
+}
+
+void AccessStats::clear() {
+    this->frame = Counters{};
+    this->total = Counters{};
+}
+
+std::string AccessStats::format_summary(const Counters &c, int top_n) {
+    uint64_t n_accesses = 0;
+    for (int r = 0; r < N_REGIONS; r++) {
+        n_accesses += c.reads[r] + c.writes[r];
+    }
+    const double per_frame = 1.0 / std::max<uint64_t>(1, c.n_frames);
+    const double to_share  = 100.0 / std::max<uint64_t>(1, n_accesses);
+
+    std::string out = fmt::format("{} bus accesses in {} frames, per frame:\n", n_accesses, c.n_frames);
+    for (int r = 0; r < N_REGIONS; r++) {
+        out += fmt::format("  {:<10} reads {:10.1f}  writes {:10.1f}  {:5.1f}%\n",
+                           get_region_name(static_cast<Region>(r)),
+                           c.reads[r] * per_frame,
+                           c.writes[r] * per_frame,
+                           (c.reads[r] + c.writes[r]) * to_share);
+    }
+
+    // the `top_n` largest of `n` counts, as (count, index)
+    auto top = [top_n](size_t n, auto &&count) {
+        std::vector<std::pair<uint64_t, size_t>> entries;
+        for (size_t i = 0; i < n; i++) {
+            if (count(i) > 0) {
+                entries.emplace_back(count(i), i);
+            }
+        }
+        const size_t n_top = std::min(entries.size(), static_cast<size_t>(top_n));
+        std::partial_sort(entries.begin(), entries.begin() + n_top, entries.end(), std::greater<>());
+        entries.resize(n_top);
+        return entries;
+    };
+
+    out += "most accessed IO registers:\n";
+    for (auto [count, reg] : top(0x100, [&c](size_t i) {
+             return AccessStats::get_region(0xff00 + i) == IO ? c.io_reads[i] + c.io_writes[i] : 0;
+         })) {
+        out += fmt::format("  $FF{:02X}      reads {:10.1f}  writes {:10.1f}  {:5.1f}%\n",
+                           reg,
+                           c.io_reads[reg] * per_frame,
+                           c.io_writes[reg] * per_frame,
+                           count * to_share);
+    }
+
+    out += "most read ROM banks:\n";
+    for (auto [count, bank] : top(c.rom_bank_reads.size(), [&c](size_t i) { return c.rom_bank_reads[i]; })) {
+        out += fmt::format("  bank {:<5} reads {:10.1f}  {:5.1f}%\n", bank, count * per_frame, count * to_share);
+    }
+
+    out += "most accessed pages:\n";
+    for (auto [count, page] : top(0x100, [&c](size_t i) { return c.page_reads[i] + c.page_writes[i]; })) {
+        out += fmt::format("  ${:02X}00      reads {:10.1f}  writes {:10.1f}  {:5.1f}%\n",
+                           page,
+                           c.page_reads[page] * per_frame,
+                           c.page_writes[page] * per_frame,
+                           count * to_share);
+    }
+    return out;
+}
@@ -0,0 +1,115 @@
+#ifndef ACCESS_STATS_H
+#define ACCESS_STATS_H
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// Counts the accesses made through the Bus while attached to it (see Gameboy::set_access_stats), by memory
+// region, by 256 byte page, by ROM bank and by address of the IO page. Counts are kept for the current frame
+// and in total. Every finished frame can be written as one line of JSON, e.g. to follow how the access
+// pattern of a game changes over time.
+class AccessStats {
+public:
+    enum Region {
+        ROM0,     // $0000-$3FFF
+        ROMX,     // $4000-$7FFF, see Counters::rom_bank_reads
+        VRAM,     // $8000-$9FFF
+        CART_RAM, // $A000-$BFFF
+        WRAM,     // $C000-$DFFF
+        ECHO,     // $E000-$FDFF
+        OAM,      // $FE00-$FE9F
+        UNUSABLE, // $FEA0-$FEFF
+        IO,       // $FF00-$FF7F and $FFFF
+        HRAM,     // $FF80-$FFFE
+        N_REGIONS,
+    };
+
+    static const char *get_region_name(Region region);
+
+    static Region get_region(uint16_t addr) {
+        if (addr < 0x8000) {
+            return addr < 0x4000 ? ROM0 : ROMX;
+        } else if (addr < 0xa000) {
+            return VRAM;
+        } else if (addr < 0xc000) {
+            return CART_RAM;
+        } else if (addr < 0xe000) {
+            return WRAM;
+        } else if (addr < 0xfe00) {
+            return ECHO;
+        } else if (addr < 0xfea0) {
+            return OAM;
+        } else if (addr < 0xff00) {
+            return UNUSABLE;
+        } else if (addr < 0xff80 || addr == 0xffff) {
+            return IO;
+        }
+        return HRAM;
+    }
+
+    struct Counters {
+        uint64_t                        n_frames{0};
+        std::array<uint64_t, N_REGIONS> reads{};
+        std::array<uint64_t, N_REGIONS> writes{};
+        std::array<uint64_t, 0x100>     page_reads{};  // by addr >> 8
+        std::array<uint64_t, 0x100>     page_writes{}; // writes to ROM pages are MBC register writes
+        std::array<uint64_t, 0x200>     rom_bank_reads{};
+        std::array<uint64_t, 0x100>     io_reads{}; // by addr & 0xff for $FF00-$FFFF
+        std::array<uint64_t, 0x100>     io_writes{};
+
+        void add(const Counters &other);
+    };
+
+    // called by the Bus, `rom_bank` is the bank mapped at `addr` for reads below $8000
+    void count_read(uint16_t addr, uint16_t rom_bank) {
+        this->frame.reads[get_region(addr)]++;
+        this->frame.page_reads[addr >> 8]++;
+        if (addr < 0x8000) {
+            this->frame.rom_bank_reads[rom_bank & 0x1ff]++;
+        } else if (addr >= 0xff00) {
+            this->frame.io_reads[addr & 0xff]++;
+        }
+    }
+
+    void count_write(uint16_t addr) {
+        this->frame.writes[get_region(addr)]++;
+        this->frame.page_writes[addr >> 8]++;
+        if (addr >= 0xff00) {
+            this->frame.io_writes[addr & 0xff]++;
+        }
+    }
+
+    // Adds the current frame to the totals and writes it to the frame output, if any. Called by the Gameboy at
+    // every emulated frame boundary.
+    void end_frame();
+
+    // stream to write every finished frame to as one line of JSON, nullptr to stop
+    void set_frame_output(std::ostream *os) {
+        this->frame_output = os;
+    }
+
+    const Counters &get_frame() const {
+        return this->frame;
+    }
+
+    const Counters &get_total() const {
+        return this->total;
+    }
+
+    void clear();
+
+    // one JSON object on a single line, only the non-zero counts of pages, banks and IO addresses are listed
+    static void write_json(std::ostream &os, const Counters &counters);
+
+    // regions, and the `top_n` most accessed IO registers, ROM banks and pages, for printing
+    static std::string format_summary(const Counters &counters, int top_n = 10);
+
+private:
+    Counters      frame;
+    Counters      total;
+    std::ostream *frame_output{nullptr};
+};
+
+#endif /* ACCESS_STATS_H */
@@ -0,0 +1,65 @@
+#include "batch_env.h"
+
+#include <fmt/core.h>
+#include <stdexcept>
+
+BatchEnv::BatchEnv(RomHandle rom, int n_envs, int n_threads, int downscale, int frame_skip)
+    : batch(std::move(rom), n_envs, n_threads),
+      downscale(downscale),
+      frame_skip(frame_skip) {
+
+    if (downscale < 1 || LCD_WIDTH % downscale != 0 || LCD_HEIGHT % downscale != 0) {
+        throw std::runtime_error(fmt::format("Invalid downscale factor {}", downscale));
+    }
+    if (frame_skip < 1) {
+        throw std::runtime_error(fmt::format("Invalid frame skip {}", frame_skip));
+    }
+}
+
+void BatchEnv::reset(uint8_t *obs) {
+    for (int env = 0; env < this->get_n_envs(); env++) {
+        this->batch.reset_lane(env);
+    }
+    this->write_observations(obs);
+}
+
+void BatchEnv::reset_env(int env) {
+    this->batch.reset_lane(env);
+}
+
+void BatchEnv::step(const uint8_t *actions, uint8_t *obs) {
+    for (int env = 0; env < this->get_n_envs(); env++) {
+        this->batch.set_button_mask(env, actions[env]);
+    }
+    for (int i = 0; i < this->frame_skip; i++) {
+        this->batch.run_frame();
+    }
+    this->write_observations(obs);
+}
+
+void BatchEnv::write_observations(uint8_t *obs) {
+    const size_t obs_size = this->get_obs_size();
+    for (int env = 0; env < this->get_n_envs(); env++) {
+        this->downscale_frame(this->batch.get_pixel_buffer(env), obs + env * obs_size);
+    }
+}
+
+void BatchEnv::downscale_frame(const PixelBuffer &pixels, uint8_t *out) const {
+    // The PPU only produces shades of gray, the top byte of a pixel is its intensity. Every output pixel
+    // is the mean of a downscale x downscale block.
+    const int f = this->downscale;
+    const int w = this->get_obs_width();
+    const int h = this->get_obs_height();
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            unsigned int sum = 0;
+            for (int dy = 0; dy < f; dy++) {
+                const uint32_t *row = &pixels[(y * f + dy) * LCD_WIDTH + x * f];
+                for (int dx = 0; dx < f; dx++) {
+                    sum += row[dx] >> 24;
+                }
+            }
+            out[y * w + x] = sum / (f * f);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef BATCH_ENV_H
+#define BATCH_ENV_H
+
+#include "lockstep_batch.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Vectorized environment for reinforcement learning, meant to be embedded through the gbemu_env library.
+//
+// Steps a LockstepBatch of environments and writes their observations, grayscale frames downscaled by an
+// integer factor, into a caller owned uint8 tensor of shape [n_envs][obs_height][obs_width]. The tensor
+// can live in shared memory, a step writes into it directly and does not allocate.
+class BatchEnv {
+public:
+    // `downscale` must divide both LCD dimensions (1, 2, 4, 8 or 16), every step runs `frame_skip` frames
+    BatchEnv(RomHandle rom, int n_envs, int n_threads = 1, int downscale = 2, int frame_skip = 1);
+
+    int get_n_envs() const {
+        return this->batch.get_n_lanes();
+    }
+
+    int get_obs_width() const {
+        return LCD_WIDTH / this->downscale;
+    }
+
+    int get_obs_height() const {
+        return LCD_HEIGHT / this->downscale;
+    }
+
+    // bytes per environment in the observation tensor
+    size_t get_obs_size() const {
+        return static_cast<size_t>(this->get_obs_width()) * this->get_obs_height();
+    }
+
+    // resets all environments and writes their first observation
+    void reset(uint8_t *obs);
+
+    // resets a single environment, e.g. at the end of an episode, it starts over with the next step
+    void reset_env(int env);
+
+    // `actions` holds one button mask per environment (see Gameboy::set_button_mask)
+    void step(const uint8_t *actions, uint8_t *obs);
+
+    // the machine behind `env`, e.g. to compute rewards from its memory
+    const Gameboy &get_machine(int env) const {
+        return this->batch.get_machine(env);
+    }
+
+private:
+    void write_observations(uint8_t *obs);
+    void downscale_frame(const PixelBuffer &pixels, uint8_t *out) const;
+
+    LockstepBatch batch;
+    int           downscale;
+    int           frame_skip;
+};
+
+#endif /* BATCH_ENV_H */
@@ -8,24 +8,47 @@
 #include "ppu.h"
 #include "sound.h"
 
+#include "access_stats.h"
 #include "logging.h"
+#include "state_stream.h"
 
 #include <fmt/core.h>
 
 Bus::Bus(Cartridge &cart, gb_controller::Controller &cntl, Communication &comm, DivTimer &dt, gb_sound::Sound &snd, Ppu &ppu, InterruptState &is)
-    : vram(8 * 1024, 0xff),
-      wram(8 * 1024, 0xff),
-      hram(127, 0xff),
-      cartridge(cart),
+    : cartridge(cart),
       controller(cntl),
       communication(comm),
       div_timer(dt),
       sound(snd),
       ppu(ppu),
       int_state(is) {
+    this->vram.fill(0xff);
+    this->wram.fill(0xff);
+    this->hram.fill(0xff);
+}
+
+Bus &Bus::operator=(const Bus &other) {
+    this->vram = other.vram;
+    this->wram = other.wram;
+    this->hram = other.hram;
+    return *this;
 }
 
 uint8_t Bus::read(uint16_t addr) const {
+    if (this->access_stats != nullptr) {
+        this->access_stats->count_read(addr, this->get_rom_bank(addr));
+    }
+    return this->read_data(addr);
+}
+
+uint8_t Bus::peek(uint16_t addr) const {
+    if (addr >= 0xfea0 && addr < 0xff00) {
+        return 0xff;
+    }
+    return this->read_data(addr);
+}
+
+uint8_t Bus::read_data(uint16_t addr) const {
     uint8_t data = 0xff;
     if (addr < 0x8000) {
         data = this->cartridge.read_rom(addr);
@@ -75,7 +98,15 @@ uint8_t Bus::read(uint16_t addr) const {
     return data;
 }
 
+uint16_t Bus::get_rom_bank(uint16_t addr) const {
+    return addr < 0x8000 ? this->cartridge.get_rom_bank(addr) : 0;
+}
+
 void Bus::write(uint16_t addr, uint8_t data) {
+    if (this->access_stats != nullptr) {
+        this->access_stats->count_write(addr);
+    }
+
     if (addr < 0x8000) {
         logging::debug("        BUS [${:04X}] <- ${:02X}  (MBC)", addr, data);
         this->cartridge.write_mbc(addr, data);
@@ -127,6 +158,19 @@ void Bus::write(uint16_t addr, uint8_t data) {
     }
 }
 
+template <typename Self, typename Stream>
+void Bus::transfer_state(Self &self, Stream &s) {
+    s(self.vram, self.wram, self.hram);
+}
+
+void Bus::save_state(StateWriter &w) const {
+    transfer_state(*this, w);
+}
+
+void Bus::load_state(StateReader &r) {
+    transfer_state(*this, r);
+}
+
 void Bus::dump(std::ostream &os) const {
 
     os << "\nCartridge RAM:\n";
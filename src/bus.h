@@ -3,9 +3,12 @@
 
 #include "ibus.h"
 
+#include <array>
 #include <cstdint>
 #include <iosfwd>
-#include <vector>
+
+class StateReader;
+class StateWriter;
 
 class InterruptState;
 namespace gb_controller {
@@ -18,6 +21,7 @@ namespace gb_sound {
 }
 class Communication;
 class Cartridge;
+class AccessStats;
 
 class Bus : public IBus {
 public:
@@ -29,14 +33,40 @@ public:
         Ppu                       &ppu,
         InterruptState            &is);
 
+    // copying only copies the memories, the component wiring stays that of this bus
+    Bus(const Bus &)            = delete;
+    Bus &operator=(const Bus &other);
+
     uint8_t read(uint16_t addr) const override;
+    uint8_t peek(uint16_t addr) const override;
     void    write(uint16_t addr, uint8_t data) override;
     void    dump(std::ostream &os) const;
 
+    uint16_t get_rom_bank(uint16_t addr) const override;
+
+    // Counters for every access, nullptr to detach. Kept by assignment, which only copies the memories.
+    // While detached they cost one well predicted branch per access.
+    void set_access_stats(AccessStats *stats) {
+        this->access_stats = stats;
+    }
+
+    AccessStats *get_access_stats() const {
+        return this->access_stats;
+    }
+
+    // binary save state, see state_stream.h
+    void save_state(StateWriter &w) const;
+    void load_state(StateReader &r);
+
 private:
-    std::vector<uint8_t> vram;
-    std::vector<uint8_t> wram;
-    std::vector<uint8_t> hram;
+    uint8_t read_data(uint16_t addr) const;
+
+    template <typename Self, typename Stream>
+    static void transfer_state(Self &self, Stream &s);
+
+    std::array<uint8_t, 0x2000> vram;
+    std::array<uint8_t, 0x2000> wram;
+    std::array<uint8_t, 0x7f>   hram;
 
     Cartridge                 &cartridge;
     gb_controller::Controller &controller;
@@ -45,6 +75,8 @@ private:
     gb_sound::Sound           &sound;
     Ppu                       &ppu;
     InterruptState            &int_state;
+
+    AccessStats *access_stats{nullptr};
 };
 
 #endif /* BUS_H */
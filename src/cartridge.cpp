@@ -1,8 +1,10 @@
 #include "cartridge.h"
 
 #include "logging.h"
+#include "state_stream.h"
 
 #include <fmt/core.h>
+#include <algorithm>
 
 static uint32_t rom_size_from_code(uint8_t code) {
     switch (code) {
@@ -54,233 +56,13 @@ static int compute_n_rom_banks(size_t rom_size) {
     return rom_size / (16 * 1024);
 }
 
-class Mbc {
-public:
-    virtual ~Mbc()                                         = default;
-    virtual void    write_mbc(uint16_t addr, uint8_t data) = 0;
-    virtual uint8_t read_rom(uint16_t addr) const          = 0;
-    virtual uint8_t read_ram(uint16_t addr) const          = 0;
-    virtual void    write_ram(uint16_t addr, uint8_t data) = 0;
-};
-
-class NullMbc : public Mbc {
-public:
-    NullMbc(const std::vector<uint8_t> &rom) : rom(rom) {
-    }
-
-    void write_mbc(uint16_t addr, uint8_t data) override {
-        // throw std::runtime_error(fmt::format("Invalid write to MBC of ${:02X} at ${:04X} for cartridge type ${:02X} ({})", data, addr, this->type, to_string(this->type)));
-        logging::warning("Invalid write to NullMc of ${:02X} at ${:04X}", data, addr);
-    }
-
-    uint8_t read_rom(uint16_t addr) const override {
-        if (addr < 0x8000) {
-            return this->rom[addr];
-        } else {
-            throw std::runtime_error(fmt::format("Invalid address passed to NullMbc::read_rom: ${:04X}", addr));
-        }
-    }
-
-    uint8_t read_ram(uint16_t addr) const override {
-        return 0xff;
-    }
-
-    void write_ram(uint16_t addr, uint8_t data) override {
-    }
-
-private:
-    const std::vector<uint8_t> &rom;
-};
-
-class Mbc1 : public Mbc {
-    enum class BankMode { LARGE_ROM_BANKING = 0, RAM_BANKING = 1 };
-
-public:
-    Mbc1(const std::vector<uint8_t> &rom, std::vector<uint8_t> &ram) : rom(rom), ram(ram) {
-    }
-
-    void write_mbc(uint16_t addr, uint8_t data) override {
-        if (addr < 0x2000) {
-            const bool has_ram = this->ram.size() > 0;
-            this->ram_enabled  = has_ram && (data & 0x0f) == 0x0a;
-        } else if (addr < 0x4000) {
-            const uint8_t val       = data & 0x1f;
-            const uint8_t bank_5lsb = (val == 0) ? 1 : val;
-            this->rom_bank          = ((this->rom_bank & (~0x1f)) | bank_5lsb) % compute_n_rom_banks(this->rom.size());
-        } else if (addr < 0x6000) {
-            if (this->bank_mode == BankMode::RAM_BANKING) {
-                this->ram_bank = 0x3 & data;
-            } else {
-                this->rom_bank =
-                    (((0x3 & data) << 5) | (this->rom_bank & 0x1f)) % compute_n_rom_banks(this->rom.size());
-            }
-        } else if (addr < 0x8000) {
-            this->bank_mode = static_cast<BankMode>(0x01 & data);
-        }
-    }
-
-    uint8_t read_rom(uint16_t addr) const override {
-        if (addr < 0x4000) {
-            return this->rom[addr];
-        } else if (addr < 0x8000) {
-            const uint32_t actual_address = addr + uint32_t(0x4000) * (this->rom_bank - 1);
-            return this->rom[actual_address];
-        } else {
-            throw std::runtime_error(fmt::format("Invalid address passed to Cartridge::read_rom: ${:04X}", addr));
-        }
-    }
-
-    uint8_t read_ram(uint16_t addr) const override {
-        if (!this->ram_enabled) {
-            return 0xff;
-        }
-
-        if (this->bank_mode == BankMode::RAM_BANKING) {
-            return this->ram[(this->ram_bank << 13) | addr];
-        } else {
-            return this->ram[addr]; // TODO: or does this still work as above??
-        }
-    }
-
-    void write_ram(uint16_t addr, uint8_t data) override {
-        if (this->ram_enabled) {
-            if (this->bank_mode == BankMode::RAM_BANKING) {
-                this->ram[(this->ram_bank << 13) | addr] = data;
-            } else {
-                // TODO: or does this still work as above??
-                this->ram[addr] = data;
-            }
-        }
-    }
-
-private:
-    const std::vector<uint8_t> &rom;
-    std::vector<uint8_t>       &ram;
-
-    bool     ram_enabled{false};
-    BankMode bank_mode{BankMode::LARGE_ROM_BANKING};
-    int      rom_bank{1};
-    int      ram_bank{0};
-};
-
-class Mbc3 : public Mbc {
-public:
-    Mbc3(const std::vector<uint8_t> &rom, std::vector<uint8_t> &ram) : rom(rom), ram(ram) {
-    }
-
-    void write_mbc(uint16_t addr, uint8_t data) override {
-        if (addr < 0x2000) {
-            const bool has_ram = this->ram.size() > 0;
-            this->ram_enabled  = has_ram && (data & 0x0f) == 0x0a;
-            // TODO: also enable RTC access
-        } else if (addr < 0x4000) {
-            const uint8_t val = data & 0x7f;
-            this->rom_bank    = (val == 0) ? 1 : val;
-            // TODO: wrap to avoid accessing rom outside of range?
-            // this->rom_bank          = ((this->rom_bank & (~0x1f)) | bank_5lsb) % compute_n_rom_banks(this->rom.size());
-        } else if (addr < 0x6000) {
-            this->ram_bank = 0x3 & data;
-            // TODO: handle 0x8-0xC - accesses to RTC
-        } else if (addr < 0x8000) {
-            // latch RTC
-        }
-    }
-
-    uint8_t read_rom(uint16_t addr) const override {
-        if (addr < 0x4000) {
-            return this->rom[addr];
-        } else if (addr < 0x8000) {
-            const uint32_t actual_address = addr + uint32_t(0x4000) * (this->rom_bank - 1);
-            return this->rom[actual_address];
-        } else {
-            throw std::runtime_error(fmt::format("Invalid address passed to Cartridge::read_rom: ${:04X}", addr));
-        }
-    }
-
-    uint8_t read_ram(uint16_t addr) const override {
-        if (!this->ram_enabled) {
-            return 0xff;
-        }
-
-        return this->ram[(this->ram_bank << 13) | addr];
-    }
-
-    void write_ram(uint16_t addr, uint8_t data) override {
-        if (this->ram_enabled) {
-            this->ram[(this->ram_bank << 13) | addr] = data;
-        }
-    }
-
-private:
-    const std::vector<uint8_t> &rom;
-    std::vector<uint8_t>       &ram;
-
-    bool ram_enabled{false};
-    int  rom_bank{1};
-    int  ram_bank{0};
-};
-
-class Mbc5 : public Mbc {
-public:
-    Mbc5(const std::vector<uint8_t> &rom, std::vector<uint8_t> &ram) : rom(rom), ram(ram) {
-    }
-
-    void write_mbc(uint16_t addr, uint8_t data) override {
-        if (addr < 0x2000) {
-            const bool has_ram = this->ram.size() > 0;
-            this->ram_enabled  = has_ram && (data & 0x0f) == 0x0a;
-            // TODO: also enable RTC access
-        } else if (addr < 0x4000) {
-            const uint8_t val = data & 0x7f;
-            this->rom_bank    = (val == 0) ? 1 : val;
-            // TODO: wrap to avoid accessing rom outside of range?
-            // this->rom_bank          = ((this->rom_bank & (~0x1f)) | bank_5lsb) % compute_n_rom_banks(this->rom.size());
-        } else if (addr < 0x6000) {
-            this->ram_bank = 0x3 & data;
-            // TODO: handle 0x8-0xC - accesses to RTC
-        } else if (addr < 0x8000) {
-            // latch RTC
-        }
-    }
-
-    uint8_t read_rom(uint16_t addr) const override {
-        if (addr < 0x4000) {
-            return this->rom[addr];
-        } else if (addr < 0x8000) {
-            const uint32_t actual_address = addr + uint32_t(0x4000) * (this->rom_bank - 1);
-            return this->rom[actual_address];
-        } else {
-            throw std::runtime_error(fmt::format("Invalid address passed to Cartridge::read_rom: ${:04X}", addr));
-        }
-    }
-
-    uint8_t read_ram(uint16_t addr) const override {
-        if (!this->ram_enabled) {
-            return 0xff;
-        }
-
-        return this->ram[(this->ram_bank << 13) | addr];
-    }
-
-    void write_ram(uint16_t addr, uint8_t data) override {
-        if (this->ram_enabled) {
-            this->ram[(this->ram_bank << 13) | addr] = data;
-        }
-    }
-
-private:
-    const std::vector<uint8_t> &rom;
-    std::vector<uint8_t>       &ram;
-
-    bool ram_enabled{false};
-    int  rom_bank{1};
-    int  ram_bank{0};
-};
-
-Cartridge::Cartridge(const std::vector<uint8_t> &rom_bytes)
-    : rom(rom_bytes),
-      type(static_cast<CartridgeType>(rom_bytes[0x147])),
-      ram(ram_size_from_code(rom_bytes[0x149]), 0xff) {
+Cartridge::Cartridge(RomHandle rom_image, const uint64_t &clock)
+    : clock(clock),
+      rom(std::move(rom_image)),
+      rom_data(this->rom->data()),
+      type(static_cast<CartridgeType>((*this->rom)[0x147])),
+      ram(ram_size_from_code((*this->rom)[0x149]), this->has_rtc() ? Mbc3::RTC_SAVE_SIZE : 0),
+      ram_mask(std::min<size_t>(this->ram.size(), 0x2000) - 1) {
 
     // for (int a = 0x104; a < 0x134; a++) {
     //     int i = a - 0x104;
@@ -293,20 +75,20 @@ Cartridge::Cartridge(const std::vector<uint8_t> &rom_bytes)
     // }
     // fmt::print("\n\n");
 
-    const auto header_rom_size = rom_size_from_code(this->rom[0x148]);
-    if (header_rom_size != this->rom.size()) {
+    const auto header_rom_size = rom_size_from_code((*this->rom)[0x148]);
+    if (header_rom_size != this->rom->size()) {
         throw std::runtime_error(fmt::format("Mismatch in ROM size. Coded size = {} (code ${:02X}), actual size = {}",
                                              header_rom_size,
-                                             this->rom[0x148],
-                                             this->rom.size()));
+                                             (*this->rom)[0x148],
+                                             this->rom->size()));
     }
 
     uint8_t header_checksum_computed = 0;
     for (int i = 0x134; i < 0x14d; i++) {
-        header_checksum_computed -= this->rom[i] + 1;
+        header_checksum_computed -= (*this->rom)[i] + 1;
     }
 
-    const uint8_t header_checksum_expected = this->rom[0x14d];
+    const uint8_t header_checksum_expected = (*this->rom)[0x14d];
     if (header_checksum_computed != header_checksum_expected) {
         throw std::runtime_error(fmt::format("Invalid header checksum. Computed = {}, expected = {}",
                                              header_checksum_computed,
@@ -314,38 +96,46 @@ Cartridge::Cartridge(const std::vector<uint8_t> &rom_bytes)
     }
 
     uint16_t global_checksum_computed = 0;
-    for (size_t i = 0; i < this->rom.size(); ++i) {
+    for (size_t i = 0; i < this->rom->size(); ++i) {
         if (i != 0x14e && i != 0x14f) {
-            global_checksum_computed += this->rom[i];
+            global_checksum_computed += (*this->rom)[i];
         }
     }
     const uint16_t global_checksum_expected =
-        static_cast<uint16_t>(this->rom[0x14e]) << 8 | static_cast<uint16_t>(this->rom[0x14f]);
+        static_cast<uint16_t>((*this->rom)[0x14e]) << 8 | static_cast<uint16_t>((*this->rom)[0x14f]);
 
     if (global_checksum_computed != global_checksum_expected) {
         // throw std::runtime_error(fmt::format("Invalid global checksum. Computed = {}, expected = {}", global_checksum_computed, global_checksum_expected));
-        fmt::print("WARNING: Invalid global checksum. Computed = {}, expected = {}\n",
+        // on stderr, stdout carries the reports of the batch tools
+        fmt::print(stderr,
+                   "WARNING: Invalid global checksum. Computed = {}, expected = {}\n",
                    global_checksum_computed,
                    global_checksum_expected);
     }
 
+    // the computed checksum covers the whole ROM, unlike the header fields it also tells apart unsigned ROMs
+    this->rom_identity = static_cast<uint64_t>(this->rom->size()) << 24 | header_checksum_computed << 16 |
+                         global_checksum_computed;
+
     // initialize mbc
+    const int n_rom_banks = compute_n_rom_banks(this->rom->size());
+    const int n_ram_banks = compute_n_ram_banks(this->ram.size());
     switch (this->type) {
         using enum CartridgeType;
         case ROM_ONLY:
-            this->mbc = std::make_unique<NullMbc>(this->rom);
+            this->mbc.emplace<NullMbc>(n_rom_banks, n_ram_banks);
             break;
         case ROM_MBC1:
         case ROM_MBC1_RAM:
         case ROM_MBC1_RAM_BATT:
-            this->mbc = std::make_unique<Mbc1>(this->rom, this->ram);
+            this->mbc.emplace<Mbc1>(n_rom_banks, n_ram_banks);
             break;
         case ROM_MBC3:
         case ROM_MBC3_TIMER_BATT:
         case ROM_MBC3_TIMER_RAM_BATT:
         case ROM_MBC3_RAM:
         case ROM_MBC3_RAM_BATT:
-            this->mbc = std::make_unique<Mbc3>(this->rom, this->ram);
+            this->mbc.emplace<Mbc3>(n_rom_banks, n_ram_banks, this->has_rtc());
             break;
         case ROM_MBC5:
         case ROM_MBC5_RAM:
@@ -353,7 +143,7 @@ Cartridge::Cartridge(const std::vector<uint8_t> &rom_bytes)
         case ROM_MBC5_RUMBLE:
         case ROM_MBC5_RUMBLE_RAM:
         case ROM_MBC5_RUMBLE_RAM_BATT:
-            this->mbc = std::make_unique<Mbc5>(this->rom, this->ram);
+            this->mbc.emplace<Mbc5>(n_rom_banks, n_ram_banks);
             break;
         default:
             throw std::runtime_error(
@@ -381,7 +171,32 @@ Cartridge::Cartridge(const std::vector<uint8_t> &rom_bytes)
     }
 }
 
+Cartridge::Cartridge(const Cartridge &other, const uint64_t &clock)
+    : clock(clock),
+      rom(other.rom),
+      rom_data(other.rom_data),
+      type(other.type),
+      rom_identity(other.rom_identity),
+      ram(other.ram),
+      ram_mask(other.ram_mask),
+      mbc(other.mbc),
+      banks(other.banks) {
+}
+
+Cartridge &Cartridge::operator=(const Cartridge &other) {
+    if (other.rom != this->rom) {
+        throw std::runtime_error("Cannot assign a cartridge with a different ROM");
+    }
+
+    this->ram   = other.ram;
+    this->mbc   = other.mbc;
+    this->banks = other.banks;
+    return *this;
+}
+
 Cartridge::~Cartridge() {
+    // store the final RTC state before the save file is unmapped
+    this->save_rtc();
 }
 
 int Cartridge::get_ram_size() const {
@@ -389,7 +204,7 @@ int Cartridge::get_ram_size() const {
 }
 
 int Cartridge::get_rom_size() const {
-    return this->rom.size();
+    return this->rom->size();
 }
 
 int Cartridge::get_ram_banks() const {
@@ -397,7 +212,7 @@ int Cartridge::get_ram_banks() const {
 }
 
 int Cartridge::get_rom_banks() const {
-    return compute_n_rom_banks(this->rom.size());
+    return compute_n_rom_banks(this->rom->size());
 }
 
 std::string Cartridge::get_type_str() const {
@@ -405,51 +220,132 @@ std::string Cartridge::get_type_str() const {
 }
 
 std::string Cartridge::get_title() const {
-    return std::string((const char *)&this->rom[0x134], 0x143 - 0x134);
+    return std::string((const char *)this->rom->data() + 0x134, 0x143 - 0x134);
     // for (int i = 0x134; i < 0x143; i++) {
     //     fmt::format("{:c}", this->rom[i]);
     // }
 }
 
 uint8_t Cartridge::get_cgb_flag() const {
-    return this->rom[0x143];
+    return (*this->rom)[0x143];
 }
 
 uint8_t Cartridge::get_sgb_flag() const {
-    return this->rom[0x146];
+    return (*this->rom)[0x146];
 }
 
 uint8_t Cartridge::get_mask_rom_version() const {
-    return this->rom[0x14c];
+    return (*this->rom)[0x14c];
 }
 
 uint8_t Cartridge::get_destination_code() const {
-    return this->rom[0x14a];
+    return (*this->rom)[0x14a];
 }
 
 std::string Cartridge::get_licensee_code() const {
     return fmt::format("old=${:02X}, new=\"{:c}{:c}\"",
-                       this->rom[0x14b],
-                       rom[0x144] == 0 ? ' ' : rom[0x144],
-                       rom[0x145] == 0 ? ' ' : rom[0x145]);
+                       (*this->rom)[0x14b],
+                       (*this->rom)[0x144] == 0 ? ' ' : (*this->rom)[0x144],
+                       (*this->rom)[0x145] == 0 ? ' ' : (*this->rom)[0x145]);
+}
+
+bool Cartridge::has_battery() const {
+    switch (this->type) {
+        using enum CartridgeType;
+        case ROM_MBC1_RAM_BATT:
+        case ROM_MBC2_BATT:
+        case ROM_RAM_BATT:
+        case ROM_MMM01_SRAM_BATT:
+        case ROM_MBC3_TIMER_BATT:
+        case ROM_MBC3_TIMER_RAM_BATT:
+        case ROM_MBC3_RAM_BATT:
+        case ROM_MBC5_RAM_BATT:
+        case ROM_MBC5_RUMBLE_RAM_BATT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Cartridge::has_rtc() const {
+    return this->type == CartridgeType::ROM_MBC3_TIMER_BATT || this->type == CartridgeType::ROM_MBC3_TIMER_RAM_BATT;
 }
 
 // bus operations
 
 void Cartridge::write_mbc(uint16_t addr, uint8_t data) {
-    this->mbc->write_mbc(addr, data);
+    this->banks = std::visit([&](auto &mbc) { return mbc.write_mbc(addr, data, this->clock); }, this->mbc);
 }
 
-uint8_t Cartridge::read_rom(uint16_t addr) const {
-    return this->mbc->read_rom(addr);
+uint8_t Cartridge::read_mbc_register() const {
+    if (this->banks.ram_offset == BankMapping::RTC_MAPPED) {
+        return std::get<Mbc3>(this->mbc).read_rtc();
+    }
+    return 0xff;
 }
 
-uint8_t Cartridge::read_ram(uint16_t addr) const {
-    return this->mbc->read_ram(addr);
+void Cartridge::write_mbc_register(uint8_t data) {
+    if (this->banks.ram_offset == BankMapping::RTC_MAPPED) {
+        std::get<Mbc3>(this->mbc).write_rtc(data, this->clock);
+    }
 }
 
-void Cartridge::write_ram(uint16_t addr, uint8_t data) {
-    this->mbc->write_ram(addr, data);
+void Cartridge::attach_save_file(const std::filesystem::path &path) {
+    if (!this->has_battery()) {
+        return;
+    }
+
+    const SaveRam::Attached attached = this->ram.attach_file(path);
+    if (this->has_rtc()) {
+        if (attached == SaveRam::Attached::LOADED) {
+            std::get<Mbc3>(this->mbc).load_rtc(this->ram.footer(), this->clock);
+        } else {
+            this->save_rtc();
+        }
+    }
+}
+
+void Cartridge::flush_save_file() {
+    this->save_rtc();
+    this->ram.flush();
+}
+
+void Cartridge::save_rtc() {
+    if (this->has_rtc()) {
+        uint8_t footer[Mbc3::RTC_SAVE_SIZE];
+        std::get<Mbc3>(this->mbc).save_rtc(footer, this->clock);
+        this->ram.write_footer(footer);
+    }
+}
+
+void Cartridge::save_state(StateWriter &w) const {
+    const uint32_t ram_size = this->ram.size();
+    w(this->type, this->rom_identity, ram_size);
+    std::visit([&w](const auto &mbc) { mbc.transfer_state(mbc, w); }, this->mbc);
+    w.put_bytes(this->ram.data(), ram_size);
+}
+
+void Cartridge::load_state(StateReader &r) {
+    CartridgeType type;
+    uint64_t      rom_identity;
+    uint32_t      ram_size;
+    r(type, rom_identity, ram_size);
+    if (type != this->type || ram_size != this->ram.size()) {
+        throw std::runtime_error("Save state was made with a different cartridge type");
+    }
+    if (rom_identity != this->rom_identity) {
+        throw std::runtime_error(
+            fmt::format("Save state was made with a different ROM than \"{}\"", this->get_title()));
+    }
+
+    // the mapping is derived rather than stored, a stored one could point outside of this ROM
+    Mbc mbc = this->mbc;
+    std::visit([&r](auto &m) { m.transfer_state(m, r); }, mbc);
+    const uint8_t *ram = r.view_bytes(ram_size);
+
+    this->mbc   = mbc;
+    this->banks = std::visit([](const auto &m) { return m.mapping(); }, this->mbc);
+    this->ram.assign(ram);
 }
 
 void Cartridge::dump_ram(std::ostream &os) {
@@ -1,11 +1,18 @@
 #ifndef CARTRIDGE_H
 #define CARTRIDGE_H
 
+#include "mbc.h"
+#include "rom_image.h"
+#include "save_ram.h"
+
 #include <cstdint>
-#include <memory>
+#include <filesystem>
 #include <string>
 #include <vector>
 
+class StateReader;
+class StateWriter;
+
 enum class CartridgeType : uint8_t {
     ROM_ONLY                 = 0x0,
     ROM_MBC1                 = 0x1,
@@ -37,11 +44,15 @@ enum class CartridgeType : uint8_t {
 
 std::string to_string(CartridgeType t);
 
-class Mbc;
-
 class Cartridge {
 public:
-    Cartridge(const std::vector<uint8_t> &cartridge_rom);
+    // `clock` is the emulated T-cycle counter, it is only read when the MBC3 real-time clock is accessed
+    Cartridge(RomHandle cartridge_rom, const uint64_t &clock);
+
+    // copies share the ROM and hold their RAM in memory, see SaveRam
+    Cartridge(const Cartridge &other, const uint64_t &clock);
+    Cartridge(const Cartridge &) = delete;
+    Cartridge &operator=(const Cartridge &other);
     ~Cartridge();
 
     // getters
@@ -56,20 +67,62 @@ public:
     uint8_t     get_mask_rom_version() const;
     uint8_t     get_destination_code() const;
     std::string get_licensee_code() const;
+    bool        has_battery() const;
+    bool        has_rtc() const;
+
+    // bus operations, the reads are inline so they can be folded into Bus::read
+    uint8_t read_rom(uint16_t addr) const {
+        return this->rom_data[this->banks.rom_offset[addr >> 14] + (addr & 0x3fff)];
+    }
+
+    uint8_t read_ram(uint16_t addr) const {
+        if (this->banks.ram_offset >= 0) {
+            return this->ram[this->banks.ram_offset + (addr & this->ram_mask)];
+        }
+        return this->read_mbc_register();
+    }
 
-    // bus operations
-    uint8_t read_rom(uint16_t addr) const;
-    void    write_mbc(uint16_t addr, uint8_t data);
-    uint8_t read_ram(uint16_t addr) const;
-    void    write_ram(uint16_t addr, uint8_t data);
+    void write_ram(uint16_t addr, uint8_t data) {
+        if (this->banks.ram_offset >= 0) {
+            this->ram.write(this->banks.ram_offset + (addr & this->ram_mask), data);
+        } else {
+            this->write_mbc_register(data);
+        }
+    }
+
+    void write_mbc(uint16_t addr, uint8_t data);
+
+    // ROM bank currently mapped at `addr` (< $8000)
+    uint16_t get_rom_bank(uint16_t addr) const {
+        return this->banks.rom_offset[addr >> 14] / 0x4000;
+    }
 
     void dump_ram(std::ostream &os);
 
+    // binary save state, see state_stream.h
+    void save_state(StateWriter &w) const;
+    void load_state(StateReader &r);
+
+    // battery backed RAM, both are no-ops for cartridges without a battery
+    void attach_save_file(const std::filesystem::path &path);
+    void flush_save_file();
+
 private:
-    std::unique_ptr<Mbc>        mbc;
-    const std::vector<uint8_t> &rom;
-    CartridgeType               type{CartridgeType::ROM_ONLY};
-    std::vector<uint8_t>        ram;
+    // accesses to $A000-$BFFF while no RAM bank is mapped
+    uint8_t read_mbc_register() const;
+    void    write_mbc_register(uint8_t data);
+
+    void save_rtc();
+
+    const uint64_t      &clock;
+    RomHandle            rom;
+    const uint8_t       *rom_data;
+    CartridgeType        type{CartridgeType::ROM_ONLY};
+    uint64_t             rom_identity{0}; // ROM size and checksums, save states are only loaded into the same ROM
+    SaveRam              ram;
+    uint16_t             ram_mask;
+    Mbc                  mbc;
+    BankMapping          banks;
 };
 
 #endif /* CARTRIDGE_H */
@@ -1,10 +1,9 @@
 #include "communication.h"
+#include "state_stream.h"
 
 #include <fmt/core.h>
 
 // TODO: set interrupt (bit 3 in IF) appropriately
-Communication::Communication() : fs("communication_output.bin"){}
-
 uint8_t Communication::read_reg(uint8_t regid) const
 {
     switch(regid) {
@@ -20,7 +19,9 @@ uint8_t Communication::read_reg(uint8_t regid) const
 void Communication::write_reg(uint8_t regid, uint8_t data) {
     switch(regid) {
     case 1:
-        fs << (char)data << std::flush;
+        if (this->sink) {
+            this->sink(data);
+        }
         this->sb = data;
         break;
     case 2:
@@ -31,6 +32,19 @@ void Communication::write_reg(uint8_t regid, uint8_t data) {
     }
 }
 
+template <typename Self, typename Stream>
+void Communication::transfer_state(Self &self, Stream &s) {
+    s(self.sb, self.sc);
+}
+
+void Communication::save_state(StateWriter &w) const {
+    transfer_state(*this, w);
+}
+
+void Communication::load_state(StateReader &r) {
+    transfer_state(*this, r);
+}
+
 void Communication::dump(std::ostream &os) const {
     os << fmt::format("Communication state:\n");
     os << fmt::format("  SB [0xFF01]: {:02X}\n", this->sb);
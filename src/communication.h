@@ -2,17 +2,39 @@
 #define COMMUNICATION_H
 
 #include <cstdint>
+#include <functional>
 #include <iosfwd>
-#include <fstream>
+#include <utility>
+
+class StateReader;
+class StateWriter;
+
+// Receives every byte written to the serial data register.
+using SerialSink = std::function<void(uint8_t)>;
 
 class Communication {
 public:
-    Communication();
+    void set_serial_sink(SerialSink sink) {
+        this->sink = std::move(sink);
+    }
+
+    // detaches the sink and returns it
+    SerialSink take_serial_sink() {
+        return std::exchange(this->sink, nullptr);
+    }
+
     uint8_t read_reg(uint8_t regid) const;
     void write_reg(uint8_t regid, uint8_t data);
     void dump(std::ostream &os) const;
+
+    // binary save state, see state_stream.h
+    void save_state(StateWriter &w) const;
+    void load_state(StateReader &r);
 private:
-    std::ofstream fs;
+    template <typename Self, typename Stream>
+    static void transfer_state(Self &self, Stream &s);
+
+    SerialSink sink;
     uint8_t sb{0};
     uint8_t sc{0};
 };
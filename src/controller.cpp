@@ -1,4 +1,5 @@
 #include "controller.h"
+#include "state_stream.h"
 
 #include <fmt/core.h>
 
@@ -39,6 +40,17 @@ namespace gb_controller {
         }
     }
 
+    uint8_t Controller::get_button_mask() const {
+        // the button state registers are active low
+        const uint8_t released = (this->action_buttons_state & 0x0f) << 4 | (this->direction_buttons_state & 0x0f);
+        return ~released;
+    }
+
+    void Controller::set_button_mask(uint8_t mask) {
+        this->direction_buttons_state = 0xf0 | (~mask & 0x0f);
+        this->action_buttons_state    = 0xf0 | (~mask >> 4 & 0x0f);
+    }
+
     uint8_t Controller::read_reg() const {
         uint8_t res = 0xff;
         if (this->actions_selected) {
@@ -55,6 +67,19 @@ namespace gb_controller {
         this->actions_selected    = (data & 0x20) == 0; // bit 5 is 0
     }
 
+    template <typename Self, typename Stream>
+    void Controller::transfer_state(Self &self, Stream &s) {
+        s(self.directions_selected, self.actions_selected, self.direction_buttons_state, self.action_buttons_state);
+    }
+
+    void Controller::save_state(StateWriter &w) const {
+        transfer_state(*this, w);
+    }
+
+    void Controller::load_state(StateReader &r) {
+        transfer_state(*this, r);
+    }
+
     void Controller::dump(std::ostream &os) const {
         os << fmt::format("Controller state:\n");
         os << fmt::format("  Directions selected:     {}\n", this->directions_selected);
@@ -4,6 +4,9 @@
 #include <cstdint>
 #include <iosfwd>
 
+class StateReader;
+class StateWriter;
+
 namespace gb_controller {
     enum class Button {
         RIGHT  = 0,
@@ -29,7 +32,18 @@ namespace gb_controller {
         void dump(std::ostream &os) const;
         void set_button_state(Button button, State state);
 
+        // all buttons at once, bit n is set if Button n is pressed
+        uint8_t get_button_mask() const;
+        void    set_button_mask(uint8_t mask);
+
+        // binary save state, see state_stream.h
+        void save_state(StateWriter &w) const;
+        void load_state(StateReader &r);
+
     private:
+        template <typename Self, typename Stream>
+        static void transfer_state(Self &self, Stream &s);
+
         bool directions_selected{false};
         bool actions_selected{false};
         uint8_t direction_buttons_state{0xff};
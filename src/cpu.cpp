@@ -2,6 +2,9 @@
 
 #include "interrupt_state.h"
 #include "logging.h"
+#include "profiler.h"
+#include "state_stream.h"
+#include "trace_log.h"
 
 #include <fmt/core.h>
 
@@ -23,6 +26,34 @@ void Cpu::reset() {
     this->ime    = false;
 }
 
+CpuRegisters Cpu::get_registers() const {
+    CpuRegisters regs;
+    regs.a  = this->a;
+    regs.f  = this->f();
+    regs.b  = this->bc.r8.hi;
+    regs.c  = this->bc.r8.lo;
+    regs.d  = this->de.r8.hi;
+    regs.e  = this->de.r8.lo;
+    regs.h  = this->hl.r8.hi;
+    regs.l  = this->hl.r8.lo;
+    regs.sp = this->sp;
+    regs.pc = this->pc;
+    return regs;
+}
+
+void Cpu::set_registers(const CpuRegisters &regs) {
+    this->a = regs.a;
+    this->set_f(regs.f);
+    this->bc.r8.hi = regs.b;
+    this->bc.r8.lo = regs.c;
+    this->de.r8.hi = regs.d;
+    this->de.r8.lo = regs.e;
+    this->hl.r8.hi = regs.h;
+    this->hl.r8.lo = regs.l;
+    this->sp       = regs.sp;
+    this->pc       = regs.pc;
+}
+
 uint8_t &Cpu::decode_reg8(uint8_t bits) {
     switch (bits) {
         case 0:
@@ -273,8 +304,21 @@ void Cpu::do_tick(uint64_t clock, IBus &bus, InterruptState &int_state) {
             this->cycle++;
             logging::debug("\t\t\t\t\t\t\t\t Interrupt detected: {}\n",
                            interrupt_cause_to_string(this->isr_active.value()));
+            if (this->profiler != nullptr) {
+                const uint16_t vector = 0x40 + 8 * static_cast<uint8_t>(this->isr_active.value());
+                this->profiler->on_interrupt(bus.get_rom_bank(this->pc), this->pc, vector, clock);
+            }
         } else {
             this->opcode = bus.read(this->pc);
+            this->n_instructions++;
+            if (this->trace_writer != nullptr) {
+                const uint16_t pc = this->pc;
+                this->trace_writer->write(this->get_registers(),
+                                          {this->opcode, bus.peek(pc + 1), bus.peek(pc + 2), bus.peek(pc + 3)});
+            }
+            if (this->profiler != nullptr) {
+                this->profiler->on_instruction(bus.get_rom_bank(this->pc), this->pc, this->opcode, clock);
+            }
             logging::debug("\t\t\t\t\t\t\t\t read opcode: ${:02X} -> ", this->opcode);
         }
     }
@@ -1464,24 +1508,24 @@ void Cpu::do_tick(uint64_t clock, IBus &bus, InterruptState &int_state) {
                 logging::debug("CALL {}, a16\n", cond_str);
                 this->cycle++;
             } else if (this->cycle == 1) {
+                this->tmp1 = bus.read(this->pc + 1); // addr_l
+                this->cycle++;
+            } else if (this->cycle == 2) {
+                this->tmp2 = bus.read(this->pc + 2); // addr_h
+                this->pc += 3;
+
                 const auto cond_bits = (this->opcode >> 3) & 0x3;
                 const bool cond      = cond_bits == 0   ? !this->flag_z
                                        : cond_bits == 1 ? this->flag_z
                                        : cond_bits == 2 ? !this->flag_c
                                                         : this->flag_c;
                 if (cond) {
-                    this->tmp1 = bus.read(this->pc + 1); // addr_l
                     this->cycle++;
                 } else {
                     logging::debug("\t\t\t\t\t\t\t\t\t conditional call NOT taken\n");
-                    this->pc += 3;
                     this->cycle = 0;
                 }
-            } else if (this->cycle == 2) {
-                this->tmp2 = bus.read(this->pc + 2); // addr_h
-                this->cycle++;
             } else if (this->cycle == 3) {
-                this->pc += 3;
                 this->sp--;
                 bus.write(this->sp, (this->pc >> 8) & 0xff);
                 this->cycle++;
@@ -1791,6 +1835,20 @@ void Cpu::do_tick(uint64_t clock, IBus &bus, InterruptState &int_state) {
     }
 }
 
+template <typename Self, typename Stream>
+void Cpu::transfer_state(Self &self, Stream &s) {
+    s(self.a, self.bc, self.de, self.hl, self.sp, self.pc, self.flag_z, self.flag_n, self.flag_h, self.flag_c, self.ime,
+      self.halted, self.isr_active, self.cycle, self.opcode, self.tmp1, self.tmp2);
+}
+
+void Cpu::save_state(StateWriter &w) const {
+    transfer_state(*this, w);
+}
+
+void Cpu::load_state(StateReader &r) {
+    transfer_state(*this, r);
+}
+
 void Cpu::dump(std::ostream &os) const {
 
     os << fmt::format("  af: ${:02X}{:02X}\n", this->a, this->f());
@@ -7,8 +7,13 @@
 #include <optional>
 #include <string>
 
+class StateReader;
+class StateWriter;
+
 class InterruptState;
 enum class InterruptCause;
+class Profiler;
+class TraceWriter;
 
 union reg {
     uint16_t r16;
@@ -17,12 +22,25 @@ union reg {
     } r8;
 };
 
+// programmer visible registers, for debuggers and tests
+struct CpuRegisters {
+    uint8_t  a{0}, f{0}, b{0}, c{0}, d{0}, e{0}, h{0}, l{0};
+    uint16_t sp{0};
+    uint16_t pc{0};
+
+    bool operator==(const CpuRegisters &) const = default;
+};
+
 class Cpu {
 public:
     void reset();
     void do_tick(uint64_t clock, IBus &bus, InterruptState &int_state);
     void dump(std::ostream &os) const;
 
+    // binary save state, see state_stream.h
+    void save_state(StateWriter &w) const;
+    void load_state(StateReader &r);
+
     bool is_halted() const {
         return this->halted;
     }
@@ -31,7 +49,51 @@ public:
         this->halted = false;
     }
 
+    // true between instructions, when the next M-cycle fetches an opcode or starts an interrupt dispatch
+    bool at_instruction_boundary() const {
+        return this->cycle == 0 && !this->isr_active;
+    }
+
+    // interrupt master enable, a pending interrupt is dispatched at the next instruction boundary while set
+    bool get_ime() const {
+        return this->ime;
+    }
+
+    CpuRegisters get_registers() const;
+    void         set_registers(const CpuRegisters &regs);
+
+    // number of instructions fetched so far, not part of the save state
+    uint64_t get_instruction_count() const {
+        return this->n_instructions;
+    }
+
+    // Profiler fed at every opcode fetch and interrupt dispatch, nullptr to detach. It is not part of the
+    // save state. While detached the profiler costs one well predicted branch per instruction.
+    void set_profiler(Profiler *profiler) {
+        this->profiler = profiler;
+    }
+
+    Profiler *get_profiler() const {
+        return this->profiler;
+    }
+
+    // Trace of the registers at every opcode fetch, nullptr to detach. Like the profiler it is not part of the
+    // save state and costs one branch per instruction while detached.
+    void set_trace_writer(TraceWriter *writer) {
+        this->trace_writer = writer;
+    }
+
+    TraceWriter *get_trace_writer() const {
+        return this->trace_writer;
+    }
+
 private:
+    // moves the registers in and out of its SIMD lanes
+    friend class LockstepBatch;
+
+    template <typename Self, typename Stream>
+    static void transfer_state(Self &self, Stream &s);
+
     void set_flags(bool z, bool n, bool h, bool c) {
         this->flag_z = z;
         this->flag_n = n;
@@ -94,7 +156,11 @@ private:
     std::optional<InterruptCause> isr_active;
     int cycle{0};
     uint8_t opcode{0};
-    uint8_t tmp1, tmp2; // storage between cpu cycles
+    uint8_t tmp1{0}, tmp2{0}; // storage between cpu cycles
+
+    uint64_t n_instructions{0};
+    Profiler *profiler{nullptr};
+    TraceWriter *trace_writer{nullptr};
 };
 
 #endif /* CPU_H */
@@ -0,0 +1,59 @@
+#include "debugger.h"
+
+#include <algorithm>
+
+void Debugger::add_breakpoint(uint16_t addr, int bank) {
+    if (this->breakpoints.emplace(addr, bank).second) {
+        this->break_pages[addr >> 8]++;
+    }
+}
+
+void Debugger::remove_breakpoint(uint16_t addr, int bank) {
+    if (this->breakpoints.erase({addr, bank}) > 0) {
+        this->break_pages[addr >> 8]--;
+    }
+}
+
+bool Debugger::match_breakpoint(uint16_t pc, uint16_t bank) const {
+    return this->breakpoints.count({pc, ANY_BANK}) > 0 || (pc < 0x8000 && this->breakpoints.count({pc, bank}) > 0);
+}
+
+void Debugger::add_watchpoint(uint16_t begin, uint16_t end, bool on_read, bool on_write) {
+    this->watchpoints.push_back({begin, end, on_read, on_write});
+    this->update_watch_pages();
+}
+
+void Debugger::remove_watchpoint(uint16_t begin, uint16_t end, bool on_read, bool on_write) {
+    auto it = std::find(this->watchpoints.begin(), this->watchpoints.end(), Watchpoint{begin, end, on_read, on_write});
+    if (it != this->watchpoints.end()) {
+        this->watchpoints.erase(it);
+        this->update_watch_pages();
+    }
+}
+
+bool Debugger::match_watchpoint(uint16_t addr, bool read) const {
+    for (const Watchpoint &w : this->watchpoints) {
+        if (addr >= w.begin && addr <= w.end && (read ? w.on_read : w.on_write)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Debugger::update_watch_pages() {
+    this->read_pages.fill(0);
+    this->write_pages.fill(0);
+    for (const Watchpoint &w : this->watchpoints) {
+        for (int page = w.begin >> 8; page <= w.end >> 8; page++) {
+            this->read_pages[page] += w.on_read;
+            this->write_pages[page] += w.on_write;
+        }
+    }
+}
+
+void Debugger::clear() {
+    this->breakpoints.clear();
+    this->watchpoints.clear();
+    this->break_pages.fill(0);
+    this->update_watch_pages();
+}
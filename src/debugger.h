@@ -0,0 +1,116 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <utility>
+#include <vector>
+
+// Breakpoints and watchpoints, checked while attached to a Gameboy (see Gameboy::set_debugger).
+//
+// Nothing is checked on the regular path. As long as no breakpoint or watchpoint is set, run_until takes the
+// same loop as without a debugger. Otherwise it switches to a slower loop which looks up the PC in a table of
+// marked 256 byte pages at every instruction, and which hands the CPU a bus that sends accesses to watched
+// pages to a slow path. Only accesses made by the CPU are watched, not those of the PPU or of OAM DMA.
+//
+// When a breakpoint or watchpoint is hit, run_until returns early and the stop is held until it is taken.
+// A breakpoint stops before the instruction executes, a watchpoint right after the clock in which the
+// instruction made the access. Running on after a stop does not hit the same breakpoint again.
+class Debugger {
+public:
+    static constexpr int ANY_BANK = -1;
+
+    enum class StopReason {
+        BREAKPOINT,
+        WATCH_READ,
+        WATCH_WRITE,
+    };
+
+    struct Stop {
+        StopReason reason;
+        uint16_t   addr;    // PC for breakpoints, the accessed address for watchpoints
+        uint8_t    data{0}; // value read or written
+        uint64_t   clock{0};
+    };
+
+    // `bank` restricts breakpoints below $8000 to one ROM bank
+    void add_breakpoint(uint16_t addr, int bank = ANY_BANK);
+    void remove_breakpoint(uint16_t addr, int bank = ANY_BANK);
+
+    // watches [begin, end]
+    void add_watchpoint(uint16_t begin, uint16_t end, bool on_read, bool on_write);
+    void remove_watchpoint(uint16_t begin, uint16_t end, bool on_read, bool on_write);
+
+    void clear();
+
+    // whether run_until has to take the checking loop
+    bool is_active() const {
+        return !this->breakpoints.empty() || !this->watchpoints.empty();
+    }
+
+    bool has_stop() const {
+        return this->stop.has_value();
+    }
+
+    // returns and clears the pending stop, execution resumes with the next run_until
+    std::optional<Stop> take_stop() {
+        auto result = this->stop;
+        this->stop.reset();
+        return result;
+    }
+
+    // called by the Gameboy
+
+    bool is_breakpoint(uint16_t pc, uint16_t bank) const {
+        return this->break_pages[pc >> 8] > 0 && this->match_breakpoint(pc, bank);
+    }
+
+    bool is_read_watched(uint16_t addr) const {
+        return this->read_pages[addr >> 8] > 0 && this->match_watchpoint(addr, true);
+    }
+
+    bool is_write_watched(uint16_t addr) const {
+        return this->write_pages[addr >> 8] > 0 && this->match_watchpoint(addr, false);
+    }
+
+    void set_stop(const Stop &s) {
+        if (!this->stop) {
+            this->stop            = s;
+            this->last_stop_clock = s.clock;
+        }
+    }
+
+    // clock of the last stop, breakpoints at this clock are ignored so execution can continue past them
+    uint64_t get_last_stop_clock() const {
+        return this->last_stop_clock;
+    }
+
+private:
+    struct Watchpoint {
+        uint16_t begin;
+        uint16_t end;
+        bool     on_read;
+        bool     on_write;
+
+        bool operator==(const Watchpoint &) const = default;
+    };
+
+    bool match_breakpoint(uint16_t pc, uint16_t bank) const;
+    bool match_watchpoint(uint16_t addr, bool read) const;
+    void update_watch_pages();
+
+    std::set<std::pair<uint16_t, int>> breakpoints;
+    std::vector<Watchpoint>            watchpoints;
+
+    // number of breakpoints and watchpoints per page
+    std::array<uint16_t, 0x100> break_pages{};
+    std::array<uint16_t, 0x100> read_pages{};
+    std::array<uint16_t, 0x100> write_pages{};
+
+    std::optional<Stop> stop;
+    uint64_t            last_stop_clock{~0ull};
+};
+
+#endif /* DEBUGGER_H */
@@ -0,0 +1,246 @@
+#include "diff_checker.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <stdexcept>
+
+constexpr int MAX_REPORTED_BYTES = 16;
+
+DiffChecker::DiffChecker(RomHandle rom, Candidate candidate, Granularity granularity, size_t batch_size)
+    : rom(rom),
+      candidate_kind(candidate),
+      granularity(granularity),
+      batch_size(std::max<size_t>(1, batch_size)),
+      reference(rom),
+      candidate(std::make_unique<Gameboy>(rom)),
+      reference_checkpoint(rom),
+      candidate_checkpoint(rom) {
+
+    this->reference.reset();
+    this->candidate->reset();
+
+    switch (this->candidate_kind) {
+        case Candidate::INSTRUMENTED:
+            this->candidate->set_perf_stats(&this->perf_stats);
+            this->candidate->set_access_stats(&this->access_stats);
+            break;
+
+        case Candidate::DEBUG:
+            // the interrupt vectors, and the stack and IO accesses of almost every routine
+            for (uint16_t vector = 0x40; vector <= 0x60; vector += 8) {
+                this->debugger.add_breakpoint(vector);
+            }
+            this->debugger.add_watchpoint(0xc000, 0xdfff, false, true);
+            this->debugger.add_watchpoint(0xff00, 0xffff, true, true);
+            this->candidate->set_debugger(&this->debugger);
+            break;
+
+        case Candidate::LOCKSTEP:
+            if (this->granularity != Granularity::FRAME) {
+                throw std::runtime_error("The lockstep candidate can only be compared at every frame");
+            }
+            this->candidate.reset();
+            this->batch      = std::make_unique<LockstepBatch>(rom, LockstepBatch::LANE_WIDTH);
+            this->batch_size = 1;
+            this->set_button_mask(0);
+            break;
+
+        case Candidate::RUN_UNTIL:
+        case Candidate::RELOAD:
+        case Candidate::CLONE:
+            break;
+    }
+
+    this->log.reserve(this->batch_size);
+    this->reference_state.resize(this->reference.get_state_size());
+    this->candidate_state.resize(this->reference_state.size());
+}
+
+std::optional<Divergence> DiffChecker::run_until(uint64_t end_clock) {
+    while (this->reference.get_clock() < end_clock) {
+        this->reference_checkpoint = this->reference;
+        if (this->candidate) {
+            this->candidate_checkpoint = *this->candidate;
+        }
+
+        this->log.clear();
+        while (this->log.size() < this->batch_size && this->reference.get_clock() < end_clock) {
+            this->step_reference(end_clock);
+            this->log.push_back({this->reference.get_clock(), this->reference.get_cpu_registers()});
+        }
+
+        bool match = true;
+        for (const LogEntry &entry : this->log) {
+            this->run_candidate(entry.clock);
+            this->n_compared++;
+            const Gameboy &candidate = this->get_candidate();
+            if (candidate.get_clock() != entry.clock || candidate.get_cpu_registers() != entry.regs) {
+                match = false;
+                break;
+            }
+        }
+        if (this->batch) {
+            // batches are single frames, the candidate is still at the end of the frame that did not match
+            if (auto divergence = this->compare()) {
+                return divergence;
+            }
+        } else if (!match || this->compare()) {
+            return this->locate_divergence();
+        }
+
+        this->next_batch();
+    }
+    return std::nullopt;
+}
+
+void DiffChecker::set_button_mask(uint8_t mask) {
+    this->reference.set_button_mask(mask);
+    if (!this->batch) {
+        this->candidate->set_button_mask(mask);
+        return;
+    }
+
+    // the other lanes play differently, so that lane 0 keeps leaving and rejoining groups of the same PC
+    for (int lane = 0; lane < this->batch->get_n_lanes(); lane++) {
+        this->batch->set_button_mask(lane, mask ^ lane);
+    }
+}
+
+const Gameboy &DiffChecker::get_candidate() const {
+    return this->batch ? this->batch->get_machine(0) : *this->candidate;
+}
+
+void DiffChecker::run_candidate(uint64_t clock) {
+    if (this->batch) {
+        while (this->batch->get_machine(0).get_clock() < clock) {
+            this->batch->run_frame();
+        }
+        return;
+    }
+
+    // the stops of DEBUG are only there to interrupt run_until, each one is taken and run on from right away
+    while (this->candidate->get_clock() < clock) {
+        this->candidate->run_until(clock);
+        this->debugger.take_stop();
+    }
+}
+
+void DiffChecker::step_reference(uint64_t end_clock) {
+    if (this->granularity == Granularity::INSTRUCTION) {
+        this->reference.step_instruction();
+        return;
+    }
+
+    // the lanes of a LockstepBatch only stop at frame ends, so the reference runs past end_clock to one
+    const uint64_t frame_end = (this->reference.get_clock() / CYCLES_PER_FRAME + 1) * CYCLES_PER_FRAME;
+    const uint64_t target    = this->batch ? frame_end : std::min(frame_end, end_clock);
+    while (this->reference.get_clock() < target) {
+        this->reference.do_tick();
+    }
+}
+
+void DiffChecker::next_batch() {
+    switch (this->candidate_kind) {
+        case Candidate::RUN_UNTIL:
+        case Candidate::INSTRUMENTED:
+        case Candidate::DEBUG:
+        case Candidate::LOCKSTEP:
+            break;
+
+        case Candidate::RELOAD: {
+            // into a new machine, so that whatever is missing from the state keeps its power on value
+            auto reloaded = std::make_unique<Gameboy>(this->rom);
+            reloaded->load_state(this->candidate_state.data(), this->candidate_state.size());
+            this->candidate = std::move(reloaded);
+        } break;
+
+        case Candidate::CLONE:
+            this->candidate = this->candidate->clone();
+            break;
+    }
+}
+
+Divergence DiffChecker::locate_divergence() {
+    // the batch did not match, replay it from its start comparing everything after every instruction
+    const uint64_t batch_end = this->log.back().clock;
+    this->reference          = this->reference_checkpoint;
+    *this->candidate         = this->candidate_checkpoint;
+
+    while (this->reference.get_clock() < batch_end) {
+        this->reference.step_instruction();
+        this->run_candidate(this->reference.get_clock());
+        this->n_compared++;
+        if (auto divergence = this->compare()) {
+            return *divergence;
+        }
+    }
+
+    Divergence divergence;
+    divergence.clock          = batch_end;
+    divergence.n_instructions = this->reference.get_instruction_count();
+    divergence.reference      = this->reference.get_cpu_registers();
+    divergence.candidate      = this->candidate->get_cpu_registers();
+    divergence.details        = fmt::format(
+        "the batch ending at clock {} did not match, but its replay one instruction at a time did", batch_end);
+    return divergence;
+}
+
+std::optional<Divergence> DiffChecker::compare() {
+    this->reference.save_state(this->reference_state.data(), this->reference_state.size());
+    this->get_candidate().save_state(this->candidate_state.data(), this->candidate_state.size());
+
+    const CpuRegisters ref  = this->reference.get_cpu_registers();
+    const CpuRegisters cand = this->get_candidate().get_cpu_registers();
+    if (ref == cand && this->reference_state == this->candidate_state) {
+        return std::nullopt;
+    }
+
+    Divergence divergence;
+    divergence.clock          = this->reference.get_clock();
+    divergence.n_instructions = this->reference.get_instruction_count();
+    divergence.reference      = ref;
+    divergence.candidate      = cand;
+
+    const std::pair<const char *, bool> regs[] = {
+        {"A", ref.a != cand.a},
+        {"F", ref.f != cand.f},
+        {"B", ref.b != cand.b},
+        {"C", ref.c != cand.c},
+        {"D", ref.d != cand.d},
+        {"E", ref.e != cand.e},
+        {"H", ref.h != cand.h},
+        {"L", ref.l != cand.l},
+        {"SP", ref.sp != cand.sp},
+        {"PC", ref.pc != cand.pc},
+    };
+    for (const auto &[name, differs] : regs) {
+        if (differs) {
+            divergence.details += fmt::format("register {} differs\n", name);
+        }
+    }
+
+    // name the differing state bytes by the section they are in
+    size_t n_differing  = 0;
+    size_t section_base = 0;
+    for (const auto &[name, size] : this->reference.get_state_layout()) {
+        for (size_t i = section_base; i < section_base + size; i++) {
+            if (this->reference_state[i] == this->candidate_state[i]) {
+                continue;
+            }
+            if (n_differing < MAX_REPORTED_BYTES) {
+                divergence.details += fmt::format("{}+0x{:x}: {:02x} != {:02x}\n",
+                                                  name,
+                                                  i - section_base,
+                                                  this->reference_state[i],
+                                                  this->candidate_state[i]);
+            }
+            n_differing++;
+        }
+        section_base += size;
+    }
+    if (n_differing > MAX_REPORTED_BYTES) {
+        divergence.details += fmt::format("... {} differing state bytes in total\n", n_differing);
+    }
+
+    return divergence;
+}
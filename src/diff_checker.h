@@ -0,0 +1,106 @@
+#ifndef DIFF_CHECKER_H
+#define DIFF_CHECKER_H
+
+#include "access_stats.h"
+#include "debugger.h"
+#include "gameboy.h"
+#include "lockstep_batch.h"
+#include "perf_stats.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// First point at which the candidate machine no longer matched the reference.
+struct Divergence {
+    uint64_t     clock{0};
+    uint64_t     n_instructions{0}; // instructions the reference has executed up to this point
+    CpuRegisters reference;
+    CpuRegisters candidate;
+    std::string  details; // the differing registers and state bytes
+};
+
+// Runs a reference machine, stepped one clock at a time through Gameboy::do_tick, and a candidate machine
+// that takes a different execution path side by side, and reports where they first diverge.
+//
+// To keep the check cheap, the machines are compared in batches. The reference logs its registers at every
+// instruction boundary (or frame), the candidate is run to the same clocks, and the two logs and the full
+// save states are compared once per batch. Only when a batch does not match, both machines are restored to
+// the start of the batch and stepped one instruction at a time with a full comparison after each, to find
+// the exact instruction at which they diverge.
+//
+// The LOCKSTEP candidate is one lane of a LockstepBatch. Its lanes only stop at frame ends and can not be
+// rewound, so it is compared in full at every frame and a divergence is only located to the frame.
+class DiffChecker {
+public:
+    enum class Candidate {
+        RUN_UNTIL,    // Gameboy::run_until, the path the frontends take
+        RELOAD,       // run_until, the candidate is saved and loaded again after every batch
+        CLONE,        // run_until, the candidate is replaced by a copy of itself after every batch
+        INSTRUMENTED, // run_until with PerfStats and AccessStats attached
+        DEBUG,        // run_until with breakpoints and watchpoints that stop it many times per frame
+        LOCKSTEP,     // lane 0 of a LockstepBatch whose other lanes get other inputs, FRAME granularity only
+    };
+
+    enum class Granularity {
+        INSTRUCTION,
+        FRAME,
+    };
+
+    DiffChecker(RomHandle rom, Candidate candidate, Granularity granularity, size_t batch_size);
+
+    // runs both machines until `end_clock` or the first divergence
+    std::optional<Divergence> run_until(uint64_t end_clock);
+
+    void set_button_mask(uint8_t mask);
+
+    uint64_t get_clock() const {
+        return this->reference.get_clock();
+    }
+
+    // number of register comparisons done so far
+    uint64_t get_n_compared() const {
+        return this->n_compared;
+    }
+
+private:
+    struct LogEntry {
+        uint64_t     clock;
+        CpuRegisters regs;
+    };
+
+    const Gameboy            &get_candidate() const;
+    void                      run_candidate(uint64_t clock);
+    void                      step_reference(uint64_t end_clock);
+    void                      next_batch();
+    Divergence                locate_divergence();
+    std::optional<Divergence> compare();
+
+    RomHandle   rom;
+    Candidate   candidate_kind;
+    Granularity granularity;
+    size_t      batch_size;
+
+    Gameboy                        reference;
+    std::unique_ptr<Gameboy>       candidate; // nullptr for LOCKSTEP, whose candidate is a lane of `batch`
+    std::unique_ptr<LockstepBatch> batch;
+
+    // attached to the candidate for INSTRUMENTED and DEBUG
+    PerfStats   perf_stats;
+    AccessStats access_stats;
+    Debugger    debugger;
+
+    // both machines at the start of the current batch
+    Gameboy reference_checkpoint;
+    Gameboy candidate_checkpoint;
+
+    std::vector<LogEntry> log;
+    std::vector<uint8_t>  reference_state;
+    std::vector<uint8_t>  candidate_state;
+    uint64_t              n_compared{0};
+};
+
+#endif /* DIFF_CHECKER_H */
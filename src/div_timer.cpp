@@ -1,11 +1,10 @@
 #include "div_timer.h"
 #include "interrupt_state.h"
+#include "state_stream.h"
 
 #include <array>
 #include <fmt/core.h>
 
-const static std::array<uint16_t,4> divisors = { 1024, 16, 64, 256 };
-
 void DivTimer::reset() {
     this->write_reg(0x05, 0x00); //   ; TIMA
     this->write_reg(0x06, 0x00); //   ; TMA
@@ -18,7 +17,7 @@ void DivTimer::do_tick(uint64_t clock, InterruptState &int_state) {
     }
 
     if(this->timer_enable &&
-       (clock%divisors[this->clock_select] == 0)) {
+       (clock%DIVISORS[this->clock_select] == 0)) {
         this->timer++;
         if(this->timer == 0) {
             this->timer = this->timer_modulo;
@@ -63,6 +62,19 @@ void DivTimer::write_reg(uint8_t regid, uint8_t data) {
     }
 }
 
+template <typename Self, typename Stream>
+void DivTimer::transfer_state(Self &self, Stream &s) {
+    s(self.div, self.timer, self.timer_modulo, self.timer_enable, self.clock_select);
+}
+
+void DivTimer::save_state(StateWriter &w) const {
+    transfer_state(*this, w);
+}
+
+void DivTimer::load_state(StateReader &r) {
+    transfer_state(*this, r);
+}
+
 void DivTimer::dump(std::ostream &os) const {
     os << fmt::format("DivTimer state:\n");
     os << fmt::format("  DIV  [0xFF04]: {:02X}\n", this->div);
@@ -1,13 +1,20 @@
 #ifndef DIV_TIMER_H
 #define DIV_TIMER_H
 
+#include <array>
 #include <cstdint>
 #include <iosfwd>
 
+class StateReader;
+class StateWriter;
+
 class InterruptState;
 
 class DivTimer {
 public:
+    // clocks per TIMA increment, by clock select
+    static constexpr std::array<uint16_t, 4> DIVISORS = {1024, 16, 64, 256};
+
     void reset();
 
     void do_tick(uint64_t clock, InterruptState &int_state);
@@ -15,7 +22,17 @@ public:
     void write_reg(uint8_t regid, uint8_t data);
     void dump(std::ostream &os) const;
 
+    // binary save state, see state_stream.h
+    void save_state(StateWriter &w) const;
+    void load_state(StateReader &r);
+
 private:
+    // counts DIV and TIMA in SIMD lanes
+    friend class LockstepBatch;
+
+    template <typename Self, typename Stream>
+    static void transfer_state(Self &self, Stream &s);
+
     uint8_t div{0};
     uint8_t timer{0};
     uint8_t timer_modulo{0};
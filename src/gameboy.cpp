@@ -1,11 +1,56 @@
 #include "gameboy.h"
+#include "access_stats.h"
+#include "state_stream.h"
 
 #include <fmt/core.h>
+#include <algorithm>
 
-Gameboy::Gameboy(const std::vector<uint8_t> &rom_contents)
-    : cartridge(rom_contents),
+Gameboy::Gameboy(RomHandle rom)
+    : cartridge(std::move(rom), this->clock),
+      bus(cartridge, controller, communication, div_timer, sound, ppu, interrupt_state) {
+}
+
+Gameboy::Gameboy(const Gameboy &other)
+    : clock(other.clock),
+      next_frame_sequencer_clock(other.next_frame_sequencer_clock),
+      cartridge(other.cartridge, this->clock),
+      cpu(other.cpu),
+      sound(other.sound),
+      controller(other.controller),
+      communication(other.communication),
+      div_timer(other.div_timer),
+      interrupt_state(other.interrupt_state),
+      ppu(other.ppu),
       bus(cartridge, controller, communication, div_timer, sound, ppu, interrupt_state),
-      pixel_buffer(LCD_WIDTH * LCD_HEIGHT) {
+      pixel_buffer(other.pixel_buffer) {
+    this->bus = other.bus;
+    this->cpu.set_profiler(nullptr);
+    this->cpu.set_trace_writer(nullptr);
+}
+
+Gameboy &Gameboy::operator=(const Gameboy &other) {
+    // the profiler, the trace and the serial sink stay attached to this machine
+    Profiler    *profiler     = this->cpu.get_profiler();
+    TraceWriter *trace_writer = this->cpu.get_trace_writer();
+    SerialSink   serial_sink  = this->communication.take_serial_sink();
+
+    this->clock                      = other.clock;
+    this->next_frame_sequencer_clock = other.next_frame_sequencer_clock;
+    this->cartridge                  = other.cartridge;
+    this->cpu                        = other.cpu;
+    this->sound                      = other.sound;
+    this->controller                 = other.controller;
+    this->communication              = other.communication;
+    this->div_timer                  = other.div_timer;
+    this->interrupt_state            = other.interrupt_state;
+    this->ppu                        = other.ppu;
+    this->bus                        = other.bus;
+    this->pixel_buffer               = other.pixel_buffer;
+
+    this->cpu.set_profiler(profiler);
+    this->cpu.set_trace_writer(trace_writer);
+    this->communication.set_serial_sink(std::move(serial_sink));
+    return *this;
 }
 
 void Gameboy::print_cartridge_info() const {
@@ -45,26 +90,303 @@ void Gameboy::reset() {
     this->controller.reset();
 }
 
-void Gameboy::do_tick() {
+template <typename CpuBus, typename MemBus, typename Hooks>
+void Gameboy::tick(CpuBus &cpu_bus, MemBus &bus, Hooks &&after_section) {
     if (this->interrupt_state.get_interrupts()) {
         this->cpu.unhalt();
     }
 
     this->ppu.tick_dma(this->clock, bus);
+    after_section(PerfStats::DMA);
 
     if (!this->cpu.is_halted()) {
-        this->cpu.do_tick(this->clock, this->bus, this->interrupt_state);
+        this->cpu.do_tick(this->clock, cpu_bus, this->interrupt_state);
+        after_section(PerfStats::CPU);
     }
 
-    this->ppu.do_tick(this->pixel_buffer, this->bus, this->interrupt_state);
+    this->ppu.do_tick(this->pixel_buffer, bus, this->interrupt_state);
+    after_section(PerfStats::PPU);
 
     this->div_timer.do_tick(this->clock, this->interrupt_state);
+    after_section(PerfStats::TIMER);
 
-    this->sound.do_tick(this->clock);
+    if (this->clock == this->next_frame_sequencer_clock) {
+        this->sound.step_frame_sequencer();
+        this->next_frame_sequencer_clock += gb_sound::FRAME_SEQUENCER_PERIOD;
+        after_section(PerfStats::SOUND);
+    }
 
     this->clock++;
 }
 
+void Gameboy::do_tick() {
+    this->tick(this->bus, this->bus, [](PerfStats::Section) {});
+}
+
+// Forwards to the bus and times every access, for the sampled ticks of run_until.
+class TimedBus : public IBus {
+public:
+    explicit TimedBus(Bus &bus) : bus(bus) {
+    }
+
+    uint8_t read(uint16_t addr) const override {
+        const uint64_t t0   = host_ticks();
+        const uint8_t  data = this->bus.read(addr);
+        this->read_ticks += host_ticks() - t0;
+        this->n_reads++;
+        return data;
+    }
+
+    void write(uint16_t addr, uint8_t data) override {
+        const uint64_t t0 = host_ticks();
+        this->bus.write(addr, data);
+        this->write_ticks += host_ticks() - t0;
+        this->n_writes++;
+    }
+
+    uint8_t peek(uint16_t addr) const override {
+        return this->bus.peek(addr);
+    }
+
+    uint16_t get_rom_bank(uint16_t addr) const override {
+        return this->bus.get_rom_bank(addr);
+    }
+
+    uint64_t get_ticks() const {
+        return this->read_ticks + this->write_ticks;
+    }
+
+    Bus             &bus;
+    mutable uint64_t read_ticks{0};
+    mutable uint64_t n_reads{0};
+    uint64_t         write_ticks{0};
+    uint64_t         n_writes{0};
+};
+
+void Gameboy::run_until_instrumented(uint64_t target_clock) {
+    PerfStats *perf_stats = this->perf_stats;
+    if (this->next_sample_clock < this->clock) {
+        // the clock was moved backwards by loading a state
+        this->next_sample_clock = this->clock;
+    }
+
+    // runs untimed up to the next sample or frame boundary, whichever is first
+    while (this->clock < target_clock) {
+        if (perf_stats != nullptr && this->clock == this->next_sample_clock) {
+            this->do_tick_sampled();
+            this->next_sample_clock += PerfStats::SAMPLE_PERIOD;
+        } else {
+            const uint64_t frame_end = (this->clock / CYCLES_PER_FRAME + 1) * CYCLES_PER_FRAME;
+            uint64_t       stop      = std::min(target_clock, frame_end);
+            if (perf_stats != nullptr) {
+                stop = std::min(stop, this->next_sample_clock);
+            }
+
+            const uint64_t start = this->clock;
+            const uint64_t t0    = host_ticks();
+            while (this->clock < stop) {
+                this->do_tick();
+            }
+            if (perf_stats != nullptr) {
+                perf_stats->add_untimed(host_ticks() - t0, stop - start);
+            }
+        }
+
+        if (this->clock % CYCLES_PER_FRAME == 0) {
+            this->end_frame_stats();
+        }
+    }
+}
+
+void Gameboy::poke(uint16_t addr, uint8_t data) {
+    AccessStats *stats = this->bus.get_access_stats();
+    this->bus.set_access_stats(nullptr);
+    this->bus.write(addr, data);
+    this->bus.set_access_stats(stats);
+}
+
+void Gameboy::end_frame_stats() {
+    if (this->perf_stats != nullptr) {
+        this->perf_stats->end_frame();
+    }
+    if (this->bus.get_access_stats() != nullptr) {
+        this->bus.get_access_stats()->end_frame();
+    }
+}
+
+void Gameboy::do_tick_sampled() {
+    PerfStats    &stats    = *this->perf_stats;
+    const int64_t overhead = stats.get_tick_overhead();
+    TimedBus      timed_bus(this->bus);
+
+    // Charges the time since the previous lap to `section`, less the bus accesses made in between. Every
+    // interval includes one read of the tick counter, and one more per bus access.
+    uint64_t t0         = host_ticks();
+    uint64_t bus_ticks  = 0;
+    uint64_t n_accesses = 0;
+    auto     lap        = [&](PerfStats::Section section) {
+        const uint64_t t1 = host_ticks();
+        const int64_t  n  = 1 + timed_bus.n_reads + timed_bus.n_writes - n_accesses;
+        stats.add_sampled(section, static_cast<int64_t>(t1 - t0 - (timed_bus.get_ticks() - bus_ticks)) - n * overhead);
+        t0         = t1;
+        bus_ticks  = timed_bus.get_ticks();
+        n_accesses = timed_bus.n_reads + timed_bus.n_writes;
+    };
+
+    this->tick(timed_bus, timed_bus, lap);
+
+    stats.add_sampled(PerfStats::BUS_READ, static_cast<int64_t>(timed_bus.read_ticks - timed_bus.n_reads * overhead));
+    stats.add_sampled(PerfStats::BUS_WRITE,
+                      static_cast<int64_t>(timed_bus.write_ticks - timed_bus.n_writes * overhead));
+    stats.end_sample();
+}
+
+// Forwards to the bus and stops the debugger on accesses to watched addresses. Unwatched pages only cost the
+// page table lookup.
+class WatchBus : public IBus {
+public:
+    WatchBus(Bus &bus, Debugger &debugger, const uint64_t &clock) : bus(bus), debugger(debugger), clock(clock) {
+    }
+
+    uint8_t read(uint16_t addr) const override {
+        const uint8_t data = this->bus.read(addr);
+        if (this->debugger.is_read_watched(addr)) {
+            this->debugger.set_stop({Debugger::StopReason::WATCH_READ, addr, data, this->clock});
+        }
+        return data;
+    }
+
+    void write(uint16_t addr, uint8_t data) override {
+        this->bus.write(addr, data);
+        if (this->debugger.is_write_watched(addr)) {
+            this->debugger.set_stop({Debugger::StopReason::WATCH_WRITE, addr, data, this->clock});
+        }
+    }
+
+    uint8_t peek(uint16_t addr) const override {
+        return this->bus.peek(addr);
+    }
+
+    uint16_t get_rom_bank(uint16_t addr) const override {
+        return this->bus.get_rom_bank(addr);
+    }
+
+private:
+    Bus            &bus;
+    Debugger       &debugger;
+    const uint64_t &clock;
+};
+
+void Gameboy::run_until_debug(uint64_t target_clock) {
+    Debugger &debugger = *this->debugger;
+    WatchBus  watch_bus(this->bus, debugger, this->clock);
+
+    while (this->clock < target_clock && !debugger.has_stop()) {
+        // The CPU fetches the next opcode in this clock if it runs and does not dispatch an interrupt instead.
+        // The breakpoint is checked again once the handler returns.
+        const uint8_t interrupts = this->interrupt_state.get_interrupts();
+        if (this->clock % 4 == 0 && (!this->cpu.is_halted() || interrupts) && this->cpu.at_instruction_boundary() &&
+            !(this->cpu.get_ime() && interrupts) && this->clock != debugger.get_last_stop_clock()) {
+            const uint16_t pc = this->cpu.get_registers().pc;
+            if (debugger.is_breakpoint(pc, this->bus.get_rom_bank(pc))) {
+                debugger.set_stop({Debugger::StopReason::BREAKPOINT, pc, 0, this->clock});
+                break;
+            }
+        }
+
+        // the CPU accesses memory through the watchpoints
+        this->tick(watch_bus, this->bus, [](PerfStats::Section) {});
+
+        if (this->clock % CYCLES_PER_FRAME == 0) {
+            this->end_frame_stats();
+        }
+    }
+}
+
+constexpr uint32_t STATE_MAGIC   = 0x54534247; // "GBST"
+constexpr uint32_t STATE_VERSION = 3;
+
+size_t Gameboy::get_state_size() const {
+    StateWriter counter;
+    this->save_state(counter);
+    return counter.size();
+}
+
+size_t Gameboy::save_state(uint8_t *buffer, size_t size) const {
+    StateWriter w(buffer, size);
+    this->save_state(w);
+    return w.size();
+}
+
+void Gameboy::save_state(StateWriter &w) const {
+    w(STATE_MAGIC, STATE_VERSION, this->clock, this->next_frame_sequencer_clock);
+    this->cartridge.save_state(w);
+    this->cpu.save_state(w);
+    this->sound.save_state(w);
+    this->controller.save_state(w);
+    this->communication.save_state(w);
+    this->div_timer.save_state(w);
+    this->interrupt_state.save_state(w);
+    this->ppu.save_state(w);
+    this->bus.save_state(w);
+}
+
+std::vector<std::pair<const char *, size_t>> Gameboy::get_state_layout() const {
+    std::vector<std::pair<const char *, size_t>> layout;
+
+    // must follow the order of save_state
+    auto add = [&layout](const char *name, const auto &component) {
+        StateWriter counter;
+        component.save_state(counter);
+        layout.emplace_back(name, counter.size());
+    };
+
+    StateWriter header;
+    header(STATE_MAGIC, STATE_VERSION, this->clock, this->next_frame_sequencer_clock);
+    layout.emplace_back("gameboy", header.size());
+    add("cartridge", this->cartridge);
+    add("cpu", this->cpu);
+    add("sound", this->sound);
+    add("controller", this->controller);
+    add("communication", this->communication);
+    add("div_timer", this->div_timer);
+    add("interrupt_state", this->interrupt_state);
+    add("ppu", this->ppu);
+    add("bus", this->bus);
+    return layout;
+}
+
+void Gameboy::load_state(const uint8_t *buffer, size_t size) {
+    StateReader r(buffer, size);
+
+    uint32_t magic, version;
+    r(magic, version);
+    if (magic != STATE_MAGIC || version != STATE_VERSION) {
+        throw std::runtime_error(fmt::format("Unsupported save state (magic ${:08X}, version {})", magic, version));
+    }
+
+    // the layout has a fixed size for a given cartridge, so once the size and the cartridge check out no
+    // component can fail half way through and leave the machine partially overwritten
+    if (size != this->get_state_size()) {
+        throw std::runtime_error(fmt::format("Save state has {} bytes, expected {}", size, this->get_state_size()));
+    }
+
+    uint64_t clock, next_frame_sequencer_clock;
+    r(clock, next_frame_sequencer_clock);
+    this->cartridge.load_state(r);
+    this->cpu.load_state(r);
+    this->sound.load_state(r);
+    this->controller.load_state(r);
+    this->communication.load_state(r);
+    this->div_timer.load_state(r);
+    this->interrupt_state.load_state(r);
+    this->ppu.load_state(r);
+    this->bus.load_state(r);
+
+    this->clock                      = clock;
+    this->next_frame_sequencer_clock = next_frame_sequencer_clock;
+}
+
 void Gameboy::dump(std::ostream &os) const {
     os << "Registers:\n";
     cpu.dump(os);
@@ -6,16 +6,36 @@
 #include "communication.h"
 #include "controller.h"
 #include "cpu.h"
+#include "debugger.h"
 #include "div_timer.h"
 #include "interrupt_state.h"
+#include "perf_stats.h"
 #include "ppu.h"
 #include "sound.h"
 
 #include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <utility>
+#include <vector>
+
+constexpr uint64_t CLOCK_RATE       = 1 << 22;  // T-cycles per second
+constexpr uint64_t CYCLES_PER_FRAME = 154 * 456; // T-cycles per LCD frame
 
 class Gameboy {
 public:
-    Gameboy(const std::vector<uint8_t> &rom_contents);
+    Gameboy(RomHandle rom);
+
+    // Copies share the ROM and the serial sink. Apart from the handful of references wired into the bus
+    // all state is held by value, so a copy amounts to copying the components. A copy is not attached to
+    // the save file, the profiler, the trace, the debugger or the stats. Assignment requires both machines to
+    // run the same ROM and keeps the target's serial sink.
+    Gameboy(const Gameboy &other);
+    Gameboy &operator=(const Gameboy &other);
+
+    std::unique_ptr<Gameboy> clone() const {
+        return std::make_unique<Gameboy>(*this);
+    }
 
     void print_cartridge_info() const;
 
@@ -25,20 +45,154 @@ public:
         return pixel_buffer.data();
     }
 
+    const PixelBuffer &get_pixel_buffer() const {
+        return this->pixel_buffer;
+    }
+
     void do_tick();
 
+    // runs until the emulated clock reaches `target_clock`, or until the debugger stops
+    void run_until(uint64_t target_clock) {
+        if (this->debugger != nullptr && this->debugger->is_active()) {
+            this->run_until_debug(target_clock);
+            return;
+        }
+        if (this->perf_stats != nullptr || this->bus.get_access_stats() != nullptr) {
+            this->run_until_instrumented(target_clock);
+            return;
+        }
+        while (this->clock < target_clock) {
+            this->do_tick();
+        }
+    }
+
+    // runs until the CPU has finished the current instruction, or for one M-cycle while it is halted
+    void step_instruction() {
+        // the CPU is ticked on every fourth clock
+        do {
+            this->do_tick();
+        } while (this->clock % 4 != 1 || !(this->cpu.is_halted() || this->cpu.at_instruction_boundary()));
+    }
+
+    uint64_t get_clock() const {
+        return this->clock;
+    }
+
+    uint64_t get_instruction_count() const {
+        return this->cpu.get_instruction_count();
+    }
+
+    CpuRegisters get_cpu_registers() const {
+        return this->cpu.get_registers();
+    }
+
+    void set_cpu_registers(const CpuRegisters &regs) {
+        this->cpu.set_registers(regs);
+    }
+
+    // Memory as seen by the CPU, for debuggers. The accesses are not counted in the access stats, reading the
+    // prohibited area $FEA0-$FEFF returns $FF. Writes below $8000 go to the MBC.
+    uint8_t peek(uint16_t addr) const {
+        return this->bus.peek(addr);
+    }
+
+    void poke(uint16_t addr, uint8_t data);
+
+    // Attaches host time instrumentation (nullptr detaches it), it has to outlive the attachment. Only
+    // run_until and render_audio are instrumented, stepping with do_tick is not.
+    void set_perf_stats(PerfStats *stats) {
+        this->perf_stats        = stats;
+        this->next_sample_clock = this->clock;
+    }
+
+    // Attaches bus access counters (nullptr detaches them), they have to outlive the attachment. Frames are
+    // only ended by run_until.
+    void set_access_stats(AccessStats *stats) {
+        this->bus.set_access_stats(stats);
+    }
+
+    // attaches breakpoints and watchpoints (nullptr detaches them), they have to outlive the attachment
+    void set_debugger(Debugger *debugger) {
+        this->debugger = debugger;
+    }
+
+    // attaches a profiler to the CPU (nullptr detaches it), it has to outlive the attachment
+    void set_profiler(Profiler *profiler) {
+        this->cpu.set_profiler(profiler);
+    }
+
+    // attaches an instruction trace to the CPU (nullptr detaches it), it has to outlive the attachment
+    void set_trace_writer(TraceWriter *writer) {
+        this->cpu.set_trace_writer(writer);
+    }
+
     void set_button_state(gb_controller::Button button, gb_controller::State state) {
         this->controller.set_button_state(button, state);
     }
 
+    uint8_t get_button_mask() const {
+        return this->controller.get_button_mask();
+    }
+
+    void set_button_mask(uint8_t mask) {
+        this->controller.set_button_mask(mask);
+    }
+
+    void set_serial_sink(SerialSink sink) {
+        this->communication.set_serial_sink(std::move(sink));
+    }
+
     void render_audio(int16_t *buffer, int n_frames) {
+        ScopedTimer timer(this->perf_stats, PerfStats::SOUND);
         this->sound.render(buffer, n_frames);
     }
 
+    void set_audio_quality(gb_sound::ResamplerQuality quality) {
+        this->sound.set_resampler_quality(quality);
+    }
+
+    void attach_save_file(const std::filesystem::path &path) {
+        this->cartridge.attach_save_file(path);
+    }
+
+    void flush_save_file() {
+        this->cartridge.flush_save_file();
+    }
+
+    // Binary snapshot of the emulation state, written to a caller provided buffer without allocating.
+    // The frame buffer and the audio output stage are not included. save_state returns the number of
+    // bytes written and throws if the buffer is smaller than get_state_size().
+    size_t get_state_size() const;
+    size_t save_state(uint8_t *buffer, size_t size) const;
+    void   load_state(const uint8_t *buffer, size_t size);
+
+    // names and sizes of the consecutive sections of a save state, e.g. to locate a byte offset
+    std::vector<std::pair<const char *, size_t>> get_state_layout() const;
+
     void dump(std::ostream &os) const;
 
 private:
+    // loads the components of its lanes into SIMD registers and stores them back
+    friend class LockstepBatch;
+
+    void save_state(StateWriter &w) const;
+
+    // One clock of the machine, the body of every run loop. The CPU accesses memory through `cpu_bus`, OAM
+    // DMA and the PPU through `bus`. `after_section(section)` is called after each component that ran.
+    template <typename CpuBus, typename MemBus, typename Hooks>
+    void tick(CpuBus &cpu_bus, MemBus &bus, Hooks &&after_section);
+
+    // run_until stopping at frame boundaries for the stats, and with every SAMPLE_PERIODth tick timed while
+    // perf stats are attached
+    void run_until_instrumented(uint64_t target_clock);
+    void do_tick_sampled();
+
+    // run_until checking breakpoints at every instruction and routing CPU accesses through the watchpoints
+    void run_until_debug(uint64_t target_clock);
+    void end_frame_stats();
+
     uint64_t clock{0};
+    uint64_t next_frame_sequencer_clock{gb_sound::FRAME_SEQUENCER_PERIOD};
     Cartridge cartridge;
     Cpu cpu;
     gb_sound::Sound sound;
@@ -48,7 +202,12 @@ private:
     InterruptState interrupt_state;
     Ppu ppu;
     Bus bus;
-    std::vector<uint32_t> pixel_buffer;
+    PixelBuffer pixel_buffer{};
+
+    // not copied, see set_perf_stats and set_debugger
+    PerfStats *perf_stats{nullptr};
+    uint64_t   next_sample_clock{0};
+    Debugger  *debugger{nullptr};
 };
 
 #endif /* GAMEBOY_H */
@@ -1,5 +1,13 @@
+#include "access_stats.h"
 #include "gameboy.h"
+#include "gdb_stub.h"
 #include "logging.h"
+#include "movie.h"
+#include "perf_stats.h"
+#include "profiler.h"
+#include "rewind_buffer.h"
+#include "trace_log.h"
+#include "wav_writer.h"
 
 #include <fmt/core.h>
 #include <chrono>
@@ -7,7 +15,8 @@
 #include <cstdint>
 #include <filesystem>
 #include <fstream>
-#include <iterator>
+#include <map>
+#include <memory>
 #include <vector>
 
 #include <CLI/CLI.hpp>
@@ -27,32 +36,131 @@ int main(int argc, char **argv) {
     CLI::App app{"Gameboy Emulator"};
 
     std::filesystem::path rom_path;
-    bool                  verbose = false;
-    bool                  no_sdl  = false;
+    std::filesystem::path audio_out_path;
+    std::filesystem::path save_path;
+    std::filesystem::path record_path;
+    std::filesystem::path replay_path;
+    std::filesystem::path profile_path;
+    std::filesystem::path symbols_path;
+    std::filesystem::path access_stats_path;
+    std::filesystem::path trace_path;
+    std::string           gdb_address;
+    bool                  verbose        = false;
+    bool                  no_sdl         = false;
+    auto                  audio_quality  = gb_sound::ResamplerQuality::HIGH;
+    int                   rewind_mib     = 64;
+    bool                  profile_folded = false;
+    int                   perf_interval  = 600;
     app.add_option("cartridge_rom", rom_path, "Path to cartridge rom file")->required()->check(CLI::ExistingFile);
     app.add_flag("-v,--verbose", verbose, "Enable verbose log output");
     app.add_flag("-n,--nosdl", no_sdl, "Disable SDL2 video and sound rendering");
 
-    const bool with_sdl = !no_sdl;
+    const std::map<std::string, gb_sound::ResamplerQuality> audio_quality_map{
+        {"fast", gb_sound::ResamplerQuality::FAST},
+        {"high", gb_sound::ResamplerQuality::HIGH},
+    };
+    app.add_option("--audio-quality", audio_quality, "Audio resampling quality (fast or high)")
+        ->transform(CLI::CheckedTransformer(audio_quality_map, CLI::ignore_case));
+    app.add_option("--audio-out", audio_out_path, "Capture audio to a WAV file instead of playing it");
+    app.add_option("--save-file", save_path, "Battery RAM save file (default: ROM path with .sav extension)");
+    auto record_opt = app.add_option("--record", record_path, "Record the button inputs to a movie file");
+    app.add_option("--replay", replay_path, "Replay the button inputs from a movie file")
+        ->check(CLI::ExistingFile)
+        ->excludes(record_opt);
+    app.add_option("--rewind", rewind_mib, "Memory for rewind history in MiB, hold R to rewind (0 disables)")
+        ->check(CLI::NonNegativeNumber);
+    app.add_option("--perf-summary", perf_interval, "Print a breakdown of host time every N frames (0 disables)")
+        ->check(CLI::NonNegativeNumber);
+    app.add_option("--access-stats",
+                   access_stats_path,
+                   "Count bus accesses, write them per frame as JSON lines to this file and a summary on exit");
+    app.add_option("--trace", trace_path, "Write the registers at every instruction to a trace file, see gbemu_trace");
+    app.add_option("--gdb", gdb_address, "Wait for gdb to connect on this TCP port or Unix socket path");
+    auto profile_opt = app.add_option("--profile", profile_path, "Profile the game and write a callgrind file on exit");
+    app.add_flag("--profile-folded", profile_folded, "Write the profile as folded stacks for flame graphs instead")
+        ->needs(profile_opt);
+    app.add_option("--symbols", symbols_path, "Symbol file (RGBDS/BGB .sym) to name functions in the profile")
+        ->check(CLI::ExistingFile)
+        ->needs(profile_opt);
 
     CLI11_PARSE(app, argc, argv);
 
+    const bool with_sdl       = !no_sdl;
+    const bool with_audio_out = !audio_out_path.empty();
+    const bool with_record    = !record_path.empty();
+    const bool with_replay    = !replay_path.empty();
+    const bool with_profile   = !profile_path.empty();
+    const bool with_access    = !access_stats_path.empty();
+
     if (!std::filesystem::exists(rom_path)) {
         fmt::print("No Cartridge ROM found at \"{}\"\n", rom_path.string());
         return 1;
     }
 
-    std::ifstream infile(rom_path, std::ios_base::binary);
-
-    std::vector<uint8_t> cartridge_rom_contents(std::istreambuf_iterator<char>(infile), {});
+    const RomHandle rom = RomImage::load(rom_path);
 
     logging::set_level(verbose ? logging::LogLevel::DEBUG : logging::LogLevel::WARNING);
 
-    Gameboy gb{cartridge_rom_contents};
+    Gameboy gb{rom};
     gb.reset();
+    gb.set_audio_quality(audio_quality);
 
     gb.print_cartridge_info();
 
+    std::unique_ptr<PerfStats> perf_stats;
+    if (perf_interval > 0) {
+        perf_stats = std::make_unique<PerfStats>();
+        gb.set_perf_stats(perf_stats.get());
+    }
+
+    std::unique_ptr<AccessStats>   access_stats;
+    std::unique_ptr<std::ofstream> access_stats_fs;
+    if (with_access) {
+        access_stats_fs = std::make_unique<std::ofstream>(access_stats_path);
+        access_stats    = std::make_unique<AccessStats>();
+        access_stats->set_frame_output(access_stats_fs.get());
+        gb.set_access_stats(access_stats.get());
+    }
+
+    std::unique_ptr<Profiler> profiler;
+    if (with_profile) {
+        profiler = std::make_unique<Profiler>();
+        if (!symbols_path.empty()) {
+            profiler->load_symbols(symbols_path);
+        }
+        gb.set_profiler(profiler.get());
+    }
+
+    std::unique_ptr<TraceWriter> trace_writer;
+    if (!trace_path.empty()) {
+        trace_writer = std::make_unique<TraceWriter>(trace_path);
+        gb.set_trace_writer(trace_writer.get());
+    }
+
+    // starts out stopped until gdb connects and continues
+    std::unique_ptr<GdbStub> gdb_stub;
+    if (!gdb_address.empty()) {
+        gdb_stub = std::make_unique<GdbStub>(gb, gdb_address);
+        fmt::print("Waiting for gdb on {}\n", gdb_address);
+    }
+
+    std::ofstream serial_out("communication_output.bin", std::ios_base::binary);
+    gb.set_serial_sink([&serial_out](uint8_t data) { serial_out << static_cast<char>(data) << std::flush; });
+
+    // movies start from a freshly reset machine, so battery RAM is not loaded when recording or replaying
+    std::unique_ptr<MovieWriter> movie_writer;
+    std::unique_ptr<MovieReader> movie_reader;
+    if (with_record) {
+        movie_writer = std::make_unique<MovieWriter>(record_path, *rom);
+    } else if (with_replay) {
+        movie_reader = std::make_unique<MovieReader>(replay_path, *rom);
+    } else {
+        if (save_path.empty()) {
+            save_path = std::filesystem::path(rom_path).replace_extension(".sav");
+        }
+        gb.attach_save_file(save_path);
+    }
+
     SDL_Window   *window         = NULL;
     SDL_Renderer *renderer       = NULL;
     SDL_Texture  *screen_texture = NULL;
@@ -80,7 +188,15 @@ int main(int argc, char **argv) {
 
         screen_texture =
             SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, LCD_WIDTH, LCD_HEIGHT);
+    }
 
+    // audio is either captured on the emulation thread or played back through SDL
+    std::unique_ptr<WavWriter> wav_writer;
+    std::vector<int16_t>       audio_buffer;
+    uint64_t                   audio_clock_acc = 0;
+    if (with_audio_out) {
+        wav_writer = std::make_unique<WavWriter>(audio_out_path, gb_sound::SAMPLE_RATE, gb_sound::N_CHANNELS);
+    } else if (with_sdl) {
         SDL_AudioSpec desired;
         desired.freq     = gb_sound::SAMPLE_RATE; // number of samples per second
         desired.format   = AUDIO_S16SYS;          // sample type (here: signed short i.e. 16 bit)
@@ -99,6 +215,14 @@ int main(int argc, char **argv) {
         SDL_PauseAudio(0);
     }
 
+    // snapshots are taken every few frames while running, and restored one per frame while R is held
+    constexpr int                 REWIND_INTERVAL = 2;
+    std::unique_ptr<RewindBuffer> rewind_buffer;
+    bool                          rewinding = false;
+    if (with_sdl && rewind_mib > 0 && !with_record && !with_replay) {
+        rewind_buffer = std::make_unique<RewindBuffer>(gb.get_state_size(), size_t(rewind_mib) << 20);
+    }
+
     fmt::print("------------------------------------------------------\n");
     fmt::print("Starting execution\n\n");
 
@@ -110,13 +234,18 @@ int main(int argc, char **argv) {
         while (running) {
 
             if (with_sdl) {
-                SDL_Event event;
+                ScopedTimer frontend_timer(perf_stats.get(), PerfStats::FRONTEND);
+                SDL_Event   event;
                 while (SDL_PollEvent(&event)) {
                     if (event.type == SDL_QUIT) {
                         running = false;
                     } else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE) {
                         running = false;
-                    } else if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+                    } else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_r) {
+                        rewinding = true;
+                    } else if (event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_r) {
+                        rewinding = false;
+                    } else if (!with_replay && (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP)) {
                         const gb_controller::State new_state =
                             event.type == SDL_KEYDOWN ? gb_controller::State::DOWN : gb_controller::State::UP;
 
@@ -141,10 +270,56 @@ int main(int argc, char **argv) {
                 }
             }
 
+            if (gdb_stub && !gdb_stub->is_running()) {
+                // stopped in the debugger, only the window events and the client are served
+                gdb_stub->poll(16);
+                continue;
+            }
+
+            if (rewind_buffer) {
+                ScopedTimer frontend_timer(perf_stats.get(), PerfStats::FRONTEND);
+                // the frame buffer is not part of the state, so a restored state is shown by running it for a frame
+                if (rewinding) {
+                    rewind_buffer->rewind(gb);
+                } else if (i % REWIND_INTERVAL == 0) {
+                    rewind_buffer->push(gb);
+                }
+            }
+
+            if (movie_writer) {
+                movie_writer->record(gb.get_clock(), gb.get_button_mask());
+            }
+
             // const auto cycles_to_execute = 154 * 456 * 4;
-            const auto cycles_to_execute = 154 * 110 * 4;
-            for (int j = 0; j < cycles_to_execute; j++) {
-                gb.do_tick();
+            const auto     cycles_to_execute = 154 * 110 * 4;
+            const uint64_t start_clock       = gb.get_clock();
+            if (movie_reader) {
+                movie_reader->replay_until(gb, gb.get_clock() + cycles_to_execute);
+                if (!with_sdl && movie_reader->at_end()) {
+                    fmt::print("Replay finished at clock {}\n", gb.get_clock());
+                    running = false;
+                }
+            } else {
+                gb.run_until(gb.get_clock() + cycles_to_execute);
+            }
+
+            if (gdb_stub) {
+                // reports a breakpoint hit during this step, or handles a ^C
+                gdb_stub->poll(0);
+            }
+
+            if (with_audio_out) {
+                // pull exactly the number of output frames corresponding to the emulated time, which is less than
+                // cycles_to_execute when a breakpoint stopped the step
+                audio_clock_acc += (gb.get_clock() - start_clock) * gb_sound::SAMPLE_RATE;
+                const int n_audio_frames = audio_clock_acc / CLOCK_RATE;
+                audio_clock_acc %= CLOCK_RATE;
+
+                audio_buffer.resize(n_audio_frames * gb_sound::N_CHANNELS);
+                gb.render_audio(audio_buffer.data(), n_audio_frames);
+
+                ScopedTimer frontend_timer(perf_stats.get(), PerfStats::FRONTEND);
+                wav_writer->write(audio_buffer.data(), n_audio_frames);
             }
 
             const auto nprint = 10;
@@ -154,15 +329,26 @@ int main(int argc, char **argv) {
                 fmt::print("Emulation frequency (M-cycles): {} MHz\n",
                            float(cycles_to_execute * nprint / 4) / duration.count());
                 tic = toc;
+
+                gb.flush_save_file();
+            }
+
+            if (perf_stats && perf_stats->get_n_frames() >= static_cast<uint64_t>(perf_interval)) {
+                fmt::print("{}", perf_stats->format_summary());
+                perf_stats->clear();
             }
 
             if (with_sdl) {
-                // It's a good idea to clear the screen every frame,
-                // as artifacts may occur if the window overlaps with
-                // other windows or transparent overlays.
-                SDL_RenderClear(renderer);
-                SDL_UpdateTexture(screen_texture, NULL, gb.get_pixel_buffer_data(), LCD_WIDTH * sizeof(uint32_t));
-                SDL_RenderCopy(renderer, screen_texture, NULL, NULL);
+                {
+                    ScopedTimer frontend_timer(perf_stats.get(), PerfStats::FRONTEND);
+                    // It's a good idea to clear the screen every frame,
+                    // as artifacts may occur if the window overlaps with
+                    // other windows or transparent overlays.
+                    SDL_RenderClear(renderer);
+                    SDL_UpdateTexture(screen_texture, NULL, gb.get_pixel_buffer_data(), LCD_WIDTH * sizeof(uint32_t));
+                    SDL_RenderCopy(renderer, screen_texture, NULL, NULL);
+                }
+                // presenting waits for vsync, which is idle time rather than frontend work
                 SDL_RenderPresent(renderer);
             }
         }
@@ -176,6 +362,42 @@ int main(int argc, char **argv) {
         SDL_Quit();
     }
 
+    if (wav_writer) {
+        wav_writer->close();
+    }
+
+    if (movie_writer) {
+        movie_writer->close();
+    }
+
+    if (trace_writer) {
+        fmt::print("Writing trace of {} instructions to \"{}\"...\n",
+                   trace_writer->get_n_records(),
+                   trace_path.string());
+        try {
+            trace_writer->close();
+        } catch (std::exception &e) {
+            fmt::print("EXCEPTION CAUGHT: {}\n", e.what());
+            res = 1;
+        }
+    }
+
+    if (access_stats) {
+        fmt::print("{}", AccessStats::format_summary(access_stats->get_total()));
+    }
+
+    if (profiler) {
+        fmt::print("Writing profile of {} instructions to \"{}\"...\n",
+                   profiler->get_total_instructions(),
+                   profile_path.string());
+        std::ofstream profile_fs(profile_path);
+        if (profile_folded) {
+            profiler->write_folded(profile_fs);
+        } else {
+            profiler->write_callgrind(profile_fs);
+        }
+    }
+
     auto state_file = "state.txt";
     fmt::print("Saving state to \"{}\"...\n", state_file);
     std::ofstream fs(state_file);
@@ -0,0 +1,208 @@
+#include "gameboy.h"
+#include "json.h"
+#include "logging.h"
+#include "movie.h"
+#include "work_pool.h"
+
+#include <fmt/core.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <CLI/CLI.hpp>
+
+// One line of the manifest: <rom> <frames> [<movie> [<serial output file>]], "-" skips an optional column.
+struct Job {
+    std::filesystem::path rom_path;
+    uint64_t              n_frames{0};
+    std::filesystem::path movie_path;
+    std::filesystem::path serial_path;
+};
+
+struct JobResult {
+    bool        ok{false};
+    std::string error;
+    uint32_t    frame_hash{0};
+    std::string serial;
+    double      runtime_s{0.0};
+};
+
+static std::vector<Job> read_manifest(const std::filesystem::path &path) {
+    std::ifstream fs(path);
+    if (!fs) {
+        throw std::runtime_error(fmt::format("Failed to open manifest \"{}\"", path.string()));
+    }
+
+    std::vector<Job> jobs;
+    std::string      line;
+    int              line_no = 0;
+    while (std::getline(fs, line)) {
+        line_no++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream       ss(line);
+        std::vector<std::string> columns;
+        for (std::string c; ss >> c;) {
+            columns.push_back(c);
+        }
+        if (columns.empty()) {
+            continue;
+        }
+        if (columns.size() < 2 || columns.size() > 4) {
+            throw std::runtime_error(
+                fmt::format("{}:{}: expected <rom> <frames> [<movie> [<serial>]]", path.string(), line_no));
+        }
+
+        Job job;
+        job.rom_path = columns[0];
+        try {
+            job.n_frames = std::stoull(columns[1]);
+        } catch (std::logic_error &) {
+            throw std::runtime_error(
+                fmt::format("{}:{}: invalid number of frames \"{}\"", path.string(), line_no, columns[1]));
+        }
+        if (columns.size() > 2 && columns[2] != "-") {
+            job.movie_path = columns[2];
+        }
+        if (columns.size() > 3 && columns[3] != "-") {
+            job.serial_path = columns[3];
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+static uint32_t hash_frame(const PixelBuffer &pixels) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (uint32_t p : pixels) {
+        h = (h ^ p) * 16777619u;
+    }
+    return h;
+}
+
+static JobResult run_job(const Job &job) {
+    JobResult  result;
+    const auto tic = std::chrono::steady_clock::now();
+
+    try {
+        const RomHandle rom = RomImage::load(job.rom_path);
+
+        Gameboy gb{rom};
+        gb.reset();
+        gb.set_serial_sink([&result](uint8_t data) { result.serial.push_back(static_cast<char>(data)); });
+
+        const uint64_t end_clock = job.n_frames * CYCLES_PER_FRAME;
+        if (!job.movie_path.empty()) {
+            MovieReader movie(job.movie_path, *rom);
+            movie.replay_until(gb, end_clock);
+        } else {
+            gb.run_until(end_clock);
+        }
+
+        result.frame_hash = hash_frame(gb.get_pixel_buffer());
+        result.ok         = true;
+
+        if (!job.serial_path.empty()) {
+            std::ofstream(job.serial_path, std::ios_base::binary) << result.serial;
+        }
+    } catch (std::exception &e) {
+        result.error = e.what();
+    }
+
+    result.runtime_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - tic).count();
+    return result;
+}
+
+static void write_report(std::ostream                &os,
+                         const std::vector<Job>       &jobs,
+                         const std::vector<JobResult> &results,
+                         int                           n_threads,
+                         double                        wall_s,
+                         size_t                        serial_limit) {
+    uint64_t total_frames = 0;
+    int      n_failed     = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        total_frames += results[i].ok ? jobs[i].n_frames : 0;
+        n_failed += results[i].ok ? 0 : 1;
+    }
+
+    os << "{\n";
+    os << fmt::format("  \"threads\": {},\n", n_threads);
+    os << fmt::format("  \"wall_time_s\": {:.3f},\n", wall_s);
+    os << fmt::format("  \"frames_per_s\": {:.1f},\n", total_frames / wall_s);
+    os << fmt::format("  \"failed\": {},\n", n_failed);
+    os << "  \"jobs\": [\n";
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const Job       &job = jobs[i];
+        const JobResult &res = results[i];
+        os << fmt::format("    {{\"rom\": \"{}\", \"frames\": {}, \"movie\": \"{}\", ",
+                          json_escape(job.rom_path.string()),
+                          job.n_frames,
+                          json_escape(job.movie_path.string()));
+        if (res.ok) {
+            os << fmt::format("\"frame_hash\": \"{:08x}\", \"serial_bytes\": {}, \"serial\": \"{}\", ",
+                              res.frame_hash,
+                              res.serial.size(),
+                              json_escape(res.serial.substr(0, serial_limit)));
+        } else {
+            os << fmt::format("\"error\": \"{}\", ", json_escape(res.error));
+        }
+        os << fmt::format("\"runtime_s\": {:.3f}}}{}\n", res.runtime_s, i + 1 < jobs.size() ? "," : "");
+    }
+    os << "  ]\n";
+    os << "}\n";
+}
+
+int main(int argc, char **argv) {
+
+    CLI::App app{"Gameboy Emulator batch runner"};
+
+    std::filesystem::path manifest_path;
+    std::filesystem::path report_path;
+    int                   n_threads    = std::thread::hardware_concurrency();
+    size_t                serial_limit = 4096;
+    app.add_option("manifest", manifest_path, "Manifest with one job per line: <rom> <frames> [<movie> [<serial>]]")
+        ->required()
+        ->check(CLI::ExistingFile);
+    app.add_option("-o,--report", report_path, "Write the JSON report to this file instead of stdout");
+    app.add_option("-j,--threads", n_threads, "Number of worker threads (default: all cores)")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--serial-limit", serial_limit, "Maximum number of serial output bytes per job in the report");
+
+    CLI11_PARSE(app, argc, argv);
+
+    logging::set_level(logging::LogLevel::WARNING);
+
+    try {
+        const std::vector<Job> jobs = read_manifest(manifest_path);
+        std::vector<JobResult> results(jobs.size());
+
+        WorkPool   pool(n_threads);
+        const auto tic = std::chrono::steady_clock::now();
+        pool.run(jobs.size(), [&](size_t i, int) { results[i] = run_job(jobs[i]); });
+        const double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - tic).count();
+
+        if (report_path.empty()) {
+            write_report(std::cout, jobs, results, pool.get_n_threads(), wall_s, serial_limit);
+        } else {
+            std::ofstream fs(report_path);
+            write_report(fs, jobs, results, pool.get_n_threads(), wall_s, serial_limit);
+        }
+
+        for (const JobResult &res : results) {
+            if (!res.ok) {
+                return 1;
+            }
+        }
+        return 0;
+    } catch (std::exception &e) {
+        fmt::print(stderr, "{}\n", e.what());
+        return 2;
+    }
+}
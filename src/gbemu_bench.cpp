@@ -0,0 +1,268 @@
+#include "gameboy.h"
+#include "json.h"
+#include "logging.h"
+#include "perf_stats.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <CLI/CLI.hpp>
+
+struct BenchRom {
+    std::string name;
+    RomHandle   rom;
+};
+
+struct Stats {
+    double min{0.0};
+    double median{0.0};
+    double mean{0.0};
+    double max{0.0};
+    double stddev{0.0};
+};
+
+struct BenchResult {
+    Stats                                                 frames_per_s;
+    Stats                                                 emulated_mhz;
+    Stats                                                 ns_per_instruction;
+    double                                                instructions_per_frame{0.0};
+    std::array<PerfStats::Summary, PerfStats::N_SECTIONS> sections;
+};
+
+// Builds a 32 KiB ROM only cartridge running `program` from $0150, with RETI at every interrupt vector.
+static RomHandle make_synthetic_rom(const std::string &title, const std::vector<uint8_t> &program) {
+    std::vector<uint8_t> rom(0x8000, 0x00);
+    for (uint16_t vector = 0x40; vector <= 0x60; vector += 8) {
+        rom[vector] = 0xd9; // RETI
+    }
+
+    const uint8_t entry[] = {0x00, 0xc3, 0x50, 0x01}; // NOP; JP $0150
+    std::copy(std::begin(entry), std::end(entry), rom.begin() + 0x100);
+    std::copy(title.begin(), title.begin() + std::min<size_t>(title.size(), 15), rom.begin() + 0x134);
+    std::copy(program.begin(), program.end(), rom.begin() + 0x150);
+
+    uint8_t header_checksum = 0;
+    for (int i = 0x134; i < 0x14d; i++) {
+        header_checksum -= rom[i] + 1;
+    }
+    rom[0x14d] = header_checksum;
+
+    uint16_t global_checksum = 0;
+    for (size_t i = 0; i < rom.size(); i++) {
+        global_checksum += (i != 0x14e && i != 0x14f) ? rom[i] : 0;
+    }
+    rom[0x14e] = global_checksum >> 8;
+    rom[0x14f] = global_checksum & 0xff;
+
+    return RomImage::from_bytes(std::move(rom));
+}
+
+// Small programs that each stress one part of the machine, with the LCD on as left by the boot ROM.
+static std::vector<BenchRom> make_synthetic_roms() {
+    std::vector<BenchRom> roms;
+
+    // register ALU operations in a tight loop
+    roms.push_back({"synthetic:alu",
+                    make_synthetic_rom("ALU",
+                                       {
+                                           0x80,       // ADD A,B
+                                           0x04,       // INC B
+                                           0xa9,       // XOR C
+                                           0x0d,       // DEC C
+                                           0x07,       // RLCA
+                                           0x8a,       // ADC A,D
+                                           0x18, 0xf8, // JR -8
+                                       })});
+
+    // copies 2 KiB of work RAM over and over, mostly bus reads and writes
+    roms.push_back({"synthetic:memcpy",
+                    make_synthetic_rom("MEMCPY",
+                                       {
+                                           0x21, 0x00, 0xc0, // LD HL,$C000
+                                           0x11, 0x00, 0xd0, // LD DE,$D000
+                                           0x01, 0x00, 0x08, // LD BC,$0800
+                                           0x2a,             // LD A,(HL+)
+                                           0x12,             // LD (DE),A
+                                           0x13,             // INC DE
+                                           0x0b,             // DEC BC
+                                           0x78,             // LD A,B
+                                           0xb1,             // OR C
+                                           0x20, 0xf8,       // JR NZ,-8
+                                           0x18, 0xed,       // JR -19
+                                       })});
+
+    // sleeps in HALT until the next VBLANK interrupt, like an idle game
+    roms.push_back({"synthetic:halt",
+                    make_synthetic_rom("HALT",
+                                       {
+                                           0x3e, 0x01, // LD A,$01
+                                           0xe0, 0xff, // LDH ($FF),A
+                                           0xfb,       // EI
+                                           0x76,       // HALT
+                                           0x18, 0xfd, // JR -3
+                                       })});
+
+    return roms;
+}
+
+static Stats compute_stats(std::vector<double> values) {
+    Stats stats;
+    std::sort(values.begin(), values.end());
+    const size_t n = values.size();
+    stats.min      = values.front();
+    stats.max      = values.back();
+    stats.median   = n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+    for (double v : values) {
+        stats.mean += v / n;
+    }
+    for (double v : values) {
+        stats.stddev += (v - stats.mean) * (v - stats.mean) / n;
+    }
+    stats.stddev = std::sqrt(stats.stddev);
+    return stats;
+}
+
+static BenchResult run_bench(const RomHandle &rom, uint64_t n_frames, int n_repeats) {
+    const uint64_t end_clock = n_frames * CYCLES_PER_FRAME;
+
+    std::vector<double> frames_per_s, emulated_mhz, ns_per_instruction;
+    uint64_t            n_instructions = 0;
+    for (int i = 0; i < n_repeats; i++) {
+        Gameboy gb{rom};
+        gb.reset();
+
+        const auto tic = std::chrono::steady_clock::now();
+        gb.run_until(end_clock);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tic).count();
+
+        n_instructions = gb.get_instruction_count();
+        frames_per_s.push_back(n_frames / seconds);
+        emulated_mhz.push_back(gb.get_clock() / seconds / 1e6);
+        ns_per_instruction.push_back(n_instructions > 0 ? seconds * 1e9 / n_instructions : 0.0);
+    }
+
+    BenchResult result;
+    result.frames_per_s           = compute_stats(frames_per_s);
+    result.emulated_mhz           = compute_stats(emulated_mhz);
+    result.ns_per_instruction     = compute_stats(ns_per_instruction);
+    result.instructions_per_frame = static_cast<double>(n_instructions) / n_frames;
+
+    // separate run, the sampling overhead would distort the numbers above
+    PerfStats perf_stats;
+    Gameboy   gb{rom};
+    gb.reset();
+    gb.set_perf_stats(&perf_stats);
+    gb.run_until(end_clock);
+    for (int s = 0; s < PerfStats::N_SECTIONS; s++) {
+        result.sections[s] = perf_stats.get_summary(static_cast<PerfStats::Section>(s));
+    }
+
+    return result;
+}
+
+static std::string format_stats(const Stats &s) {
+    return fmt::format("{{\"min\": {:.3f}, \"median\": {:.3f}, \"mean\": {:.3f}, \"max\": {:.3f}, \"stddev\": {:.3f}}}",
+                       s.min,
+                       s.median,
+                       s.mean,
+                       s.max,
+                       s.stddev);
+}
+
+static void write_report(std::ostream                   &os,
+                         const std::vector<BenchRom>    &roms,
+                         const std::vector<BenchResult> &results,
+                         uint64_t                        n_frames,
+                         int                             n_repeats) {
+    os << "{\n";
+    os << fmt::format("  \"frames\": {},\n", n_frames);
+    os << fmt::format("  \"repeats\": {},\n", n_repeats);
+    os << "  \"roms\": [\n";
+    for (size_t i = 0; i < roms.size(); i++) {
+        const BenchResult &res = results[i];
+
+        // the shares of the total compare across hosts, the per-frame times in microseconds do not
+        std::string shares, times;
+        for (int s = 0; s < PerfStats::FRONTEND; s++) {
+            const char               *name    = PerfStats::get_section_name(static_cast<PerfStats::Section>(s));
+            const PerfStats::Summary &summary = res.sections[s];
+            shares += fmt::format("{}\"{}\": {:.3f}", s > 0 ? ", " : "", name, summary.share);
+            times += fmt::format("{}\"{}\": {{\"mean_us\": {:.2f}, \"p50_us\": {:.2f}, \"p99_us\": {:.2f}}}",
+                                 s > 0 ? ", " : "",
+                                 name,
+                                 summary.mean_us,
+                                 summary.p50_us,
+                                 summary.p99_us);
+        }
+
+        os << "    {\n";
+        os << fmt::format("      \"name\": \"{}\",\n", json_escape(roms[i].name));
+        os << fmt::format("      \"frames_per_s\": {},\n", format_stats(res.frames_per_s));
+        os << fmt::format("      \"emulated_mhz\": {},\n", format_stats(res.emulated_mhz));
+        os << fmt::format("      \"ns_per_instruction\": {},\n", format_stats(res.ns_per_instruction));
+        os << fmt::format("      \"instructions_per_frame\": {:.1f},\n", res.instructions_per_frame);
+        os << fmt::format("      \"component_share\": {{{}}},\n", shares);
+        os << fmt::format("      \"component_us\": {{{}}}\n", times);
+        os << fmt::format("    }}{}\n", i + 1 < roms.size() ? "," : "");
+    }
+    os << "  ]\n";
+    os << "}\n";
+}
+
+int main(int argc, char **argv) {
+
+    CLI::App app{"Gameboy Emulator benchmark"};
+
+    std::vector<std::filesystem::path> rom_paths;
+    std::filesystem::path              report_path;
+    uint64_t                           n_frames  = 600;
+    int                                n_repeats = 5;
+    bool                               synthetic = false;
+    app.add_option("roms", rom_paths, "ROM files to benchmark (default: the built-in synthetic ROMs)")
+        ->check(CLI::ExistingFile);
+    app.add_option("-f,--frames", n_frames, "Number of frames to emulate per run")->check(CLI::PositiveNumber);
+    app.add_option("-r,--repeats", n_repeats, "Number of timed runs per ROM")->check(CLI::PositiveNumber);
+    app.add_flag("-s,--synthetic", synthetic, "Also run the built-in synthetic ROMs when ROM files are given");
+    app.add_option("-o,--report", report_path, "Write the JSON report to this file instead of stdout");
+
+    CLI11_PARSE(app, argc, argv);
+
+    logging::set_level(logging::LogLevel::WARNING);
+
+    try {
+        std::vector<BenchRom> roms;
+        for (const auto &path : rom_paths) {
+            roms.push_back({path.string(), RomImage::load(path)});
+        }
+        if (roms.empty() || synthetic) {
+            for (auto &rom : make_synthetic_roms()) {
+                roms.push_back(std::move(rom));
+            }
+        }
+
+        std::vector<BenchResult> results;
+        for (const BenchRom &rom : roms) {
+            results.push_back(run_bench(rom.rom, n_frames, n_repeats));
+        }
+
+        if (report_path.empty()) {
+            write_report(std::cout, roms, results, n_frames, n_repeats);
+        } else {
+            std::ofstream fs(report_path);
+            write_report(fs, roms, results, n_frames, n_repeats);
+        }
+
+        return 0;
+    } catch (std::exception &e) {
+        fmt::print(stderr, "{}\n", e.what());
+        return 2;
+    }
+}
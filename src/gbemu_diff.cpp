@@ -0,0 +1,113 @@
+#include "diff_checker.h"
+#include "logging.h"
+#include "movie.h"
+
+#include <fmt/core.h>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <string>
+
+#include <CLI/CLI.hpp>
+
+static std::string format_registers(const CpuRegisters &r) {
+    return fmt::format("A={:02X} F={:02X} B={:02X} C={:02X} D={:02X} E={:02X} H={:02X} L={:02X} SP={:04X} PC={:04X}",
+                       r.a,
+                       r.f,
+                       r.b,
+                       r.c,
+                       r.d,
+                       r.e,
+                       r.h,
+                       r.l,
+                       r.sp,
+                       r.pc);
+}
+
+int main(int argc, char **argv) {
+
+    CLI::App app{"Gameboy Emulator differential checker"};
+
+    std::filesystem::path rom_path;
+    std::filesystem::path movie_path;
+    uint64_t              n_frames   = 600;
+    std::string           mode       = "run_until";
+    std::string           every      = "instruction";
+    size_t                batch_size = 4096;
+    app.add_option("rom", rom_path, "ROM file")->required()->check(CLI::ExistingFile);
+    app.add_option("-f,--frames", n_frames, "Number of frames to run");
+    app.add_option("--movie", movie_path, "Replay the inputs of this movie")->check(CLI::ExistingFile);
+    app.add_option("-m,--mode",
+                   mode,
+                   "Candidate execution path: run_until, reload, clone, instrumented, debug or lockstep");
+    app.add_option("-e,--every", every, "Compare at every instruction or frame");
+    app.add_option("-b,--batch", batch_size, "Number of comparisons batched before the machine states are compared")
+        ->check(CLI::PositiveNumber);
+
+    CLI11_PARSE(app, argc, argv);
+
+    logging::set_level(logging::LogLevel::WARNING);
+
+    const std::map<std::string, DiffChecker::Candidate> modes = {
+        {"run_until", DiffChecker::Candidate::RUN_UNTIL},
+        {"reload", DiffChecker::Candidate::RELOAD},
+        {"clone", DiffChecker::Candidate::CLONE},
+        {"instrumented", DiffChecker::Candidate::INSTRUMENTED},
+        {"debug", DiffChecker::Candidate::DEBUG},
+        {"lockstep", DiffChecker::Candidate::LOCKSTEP},
+    };
+    const std::map<std::string, DiffChecker::Granularity> granularities = {
+        {"instruction", DiffChecker::Granularity::INSTRUCTION},
+        {"frame", DiffChecker::Granularity::FRAME},
+    };
+    if (!modes.count(mode) || !granularities.count(every)) {
+        fmt::print(stderr, "Unknown mode \"{}\" or comparison granularity \"{}\"\n", mode, every);
+        return 2;
+    }
+
+    try {
+        const RomHandle rom = RomImage::load(rom_path);
+        DiffChecker     checker(rom, modes.at(mode), granularities.at(every), batch_size);
+
+        std::unique_ptr<MovieReader> movie;
+        if (!movie_path.empty()) {
+            movie = std::make_unique<MovieReader>(movie_path, *rom);
+        }
+
+        const auto     tic       = std::chrono::steady_clock::now();
+        const uint64_t end_clock = n_frames * CYCLES_PER_FRAME;
+
+        std::optional<Divergence> divergence;
+        while (!divergence && checker.get_clock() < end_clock) {
+            // inputs take effect at the first comparison point at or after their recorded clock, in both machines
+            const MovieRecord *record = movie ? movie->peek() : nullptr;
+            divergence                = checker.run_until(record ? std::min(record->clock, end_clock) : end_clock);
+            if (record && checker.get_clock() >= record->clock) {
+                checker.set_button_mask(record->buttons);
+                movie->pop();
+            }
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tic).count();
+
+        if (!divergence) {
+            fmt::print("No divergence in {} frames, {} comparisons, {:.1f} s\n",
+                       n_frames,
+                       checker.get_n_compared(),
+                       seconds);
+            return 0;
+        }
+
+        fmt::print("Divergence at clock {} (frame {}), after {} instructions\n",
+                   divergence->clock,
+                   divergence->clock / CYCLES_PER_FRAME,
+                   divergence->n_instructions);
+        fmt::print("  reference {}\n", format_registers(divergence->reference));
+        fmt::print("  candidate {}\n", format_registers(divergence->candidate));
+        fmt::print("{}", divergence->details);
+        return 1;
+    } catch (std::exception &e) {
+        fmt::print(stderr, "{}\n", e.what());
+        return 2;
+    }
+}
@@ -0,0 +1,144 @@
+#include "gameboy.h"
+#include "logging.h"
+#include "trace_log.h"
+
+#include <fmt/core.h>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+
+#include <CLI/CLI.hpp>
+
+// an instruction takes at least one M-cycle
+constexpr uint64_t MAX_INSTRUCTIONS_PER_FRAME = CYCLES_PER_FRAME / 4;
+
+static int record(const std::filesystem::path &rom_path,
+                  const std::filesystem::path &trace_path,
+                  uint64_t                     n_frames,
+                  uint64_t                     n_instructions) {
+    const RomHandle rom = RomImage::load(rom_path);
+    Gameboy         gb{rom};
+    gb.reset();
+
+    TraceWriter writer(trace_path);
+    gb.set_trace_writer(&writer);
+
+    const auto     tic       = std::chrono::steady_clock::now();
+    const uint64_t end_clock = n_frames * CYCLES_PER_FRAME;
+    while (gb.get_clock() < end_clock && gb.get_instruction_count() + MAX_INSTRUCTIONS_PER_FRAME < n_instructions) {
+        gb.run_until(std::min(end_clock, gb.get_clock() + CYCLES_PER_FRAME));
+    }
+    // the last few instructions one by one, so the trace ends exactly at the limit
+    while (gb.get_clock() < end_clock && gb.get_instruction_count() < n_instructions) {
+        gb.step_instruction();
+    }
+    gb.set_trace_writer(nullptr);
+    writer.close();
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tic).count();
+    fmt::print("Traced {} instructions in {} frames to \"{}\", {:.1f} s\n",
+               writer.get_n_records(),
+               gb.get_clock() / CYCLES_PER_FRAME,
+               trace_path.string(),
+               seconds);
+    return 0;
+}
+
+static int print(const std::filesystem::path &trace_path, uint64_t n_instructions) {
+    TraceReader reader(trace_path);
+    for (uint64_t i = 0; i < n_instructions; i++) {
+        const auto record = reader.read();
+        if (!record) {
+            break;
+        }
+        fmt::print("{}\n", record->format());
+    }
+    return 0;
+}
+
+static int diff(const std::filesystem::path &trace_path, const std::filesystem::path &reference_path, int n_context) {
+    TraceReader trace(trace_path);
+    TraceReader reference(reference_path);
+
+    // the last records before the mismatch, which are the same in both
+    std::deque<TraceRecord> context;
+
+    uint64_t n_compared = 0;
+    while (true) {
+        const auto a = trace.read();
+        const auto b = reference.read();
+        if (!a || !b) {
+            if (a || b) {
+                fmt::print("{} ends after {} instructions, no mismatch before\n",
+                           a ? "The reference" : "The trace",
+                           n_compared);
+            } else {
+                fmt::print("No mismatch in {} instructions\n", n_compared);
+            }
+            return 0;
+        }
+
+        if (*a != *b) {
+            fmt::print("Mismatch at instruction {} in {}\n", n_compared, a->diff_fields(*b));
+            for (size_t i = 0; i < context.size(); i++) {
+                fmt::print("  {:>10} {}\n", n_compared - context.size() + i, context[i].format());
+            }
+            fmt::print("  trace      {}\n", a->format());
+            fmt::print("  reference  {}\n", b->format());
+            return 1;
+        }
+
+        context.push_back(*a);
+        if (context.size() > static_cast<size_t>(n_context)) {
+            context.pop_front();
+        }
+        n_compared++;
+    }
+}
+
+int main(int argc, char **argv) {
+
+    CLI::App app{"Gameboy Emulator instruction trace in gameboy-doctor format"};
+    app.require_subcommand(1);
+
+    std::filesystem::path rom_path;
+    std::filesystem::path trace_path;
+    std::filesystem::path reference_path;
+    uint64_t              n_frames       = 600;
+    uint64_t              n_instructions = ~0ull;
+    int                   n_context      = 5;
+
+    auto record_cmd = app.add_subcommand("record", "Run a ROM and write the trace of every instruction");
+    record_cmd->add_option("rom", rom_path, "ROM file")->required()->check(CLI::ExistingFile);
+    record_cmd->add_option("trace", trace_path, "Trace file to write")->required();
+    record_cmd->add_option("-f,--frames", n_frames, "Number of frames to run");
+    record_cmd->add_option("-n,--instructions", n_instructions, "Stop after this many instructions");
+
+    auto print_cmd = app.add_subcommand("print", "Print a trace as a gameboy-doctor log");
+    print_cmd->add_option("trace", trace_path, "Trace file")->required()->check(CLI::ExistingFile);
+    print_cmd->add_option("-n,--instructions", n_instructions, "Print only the first instructions");
+
+    auto diff_cmd = app.add_subcommand("diff", "Compare a trace with a reference and report the first mismatch");
+    diff_cmd->add_option("trace", trace_path, "Trace file")->required()->check(CLI::ExistingFile);
+    diff_cmd->add_option("reference", reference_path, "Trace or gameboy-doctor log, plain or gzipped")
+        ->required()
+        ->check(CLI::ExistingFile);
+    diff_cmd->add_option("-c,--context", n_context, "Number of matching instructions shown before the mismatch")
+        ->check(CLI::NonNegativeNumber);
+
+    CLI11_PARSE(app, argc, argv);
+
+    logging::set_level(logging::LogLevel::WARNING);
+
+    try {
+        if (record_cmd->parsed()) {
+            return record(rom_path, trace_path, n_frames, n_instructions);
+        } else if (print_cmd->parsed()) {
+            return print(trace_path, n_instructions);
+        }
+        return diff(trace_path, reference_path, n_context);
+    } catch (std::exception &e) {
+        fmt::print(stderr, "{}\n", e.what());
+        return 2;
+    }
+}
@@ -0,0 +1,425 @@
+#include "gdb_stub.h"
+
+#include "gameboy.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+constexpr int N_REGISTERS = 13; // see the register layout in gdb_stub.h
+constexpr int SIGINT_NR   = 2;
+constexpr int SIGTRAP_NR  = 5;
+
+// memory bytes per 'm' reply or 'M' packet, two hex digits each fill the advertised PacketSize of $1000
+constexpr uint32_t MAX_MEMORY_BYTES = 0x800;
+
+static uint32_t parse_hex(const std::string &s, size_t begin = 0, size_t end = std::string::npos) {
+    uint32_t value = 0;
+    for (size_t i = begin; i < std::min(end, s.size()); i++) {
+        const char c = s[i];
+        if (c >= '0' && c <= '9') {
+            value = value << 4 | (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            value = value << 4 | (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            value = value << 4 | (c - 'A' + 10);
+        } else {
+            break;
+        }
+    }
+    return value;
+}
+
+// little endian, as gdb expects for the z80
+static std::string hex_u16(uint16_t v) {
+    return fmt::format("{:02x}{:02x}", v & 0xff, v >> 8);
+}
+
+static uint16_t parse_hex_u16(const std::string &s, size_t pos) {
+    return parse_hex(s, pos, pos + 2) | parse_hex(s, pos + 2, pos + 4) << 8;
+}
+
+static bool is_port(const std::string &address) {
+    auto is_digit = [](unsigned char c) { return std::isdigit(c) != 0; };
+    return !address.empty() && std::all_of(address.begin(), address.end(), is_digit);
+}
+
+GdbStub::GdbStub(Gameboy &gb, const std::string &address) : gb(gb) {
+    if (is_port(address)) {
+        this->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (this->listen_fd < 0) {
+            throw std::runtime_error(fmt::format("Failed to create socket: {}", strerror(errno)));
+        }
+        const int yes = 1;
+        setsockopt(this->listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        sockaddr_in addr{};
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons(std::stoi(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(this->listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            const int error = errno;
+            close(this->listen_fd);
+            throw std::runtime_error(fmt::format("Failed to bind to port {}: {}", address, strerror(error)));
+        }
+    } else {
+        sockaddr_un addr{};
+        if (address.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error(fmt::format("Socket path \"{}\" is too long", address));
+        }
+        this->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (this->listen_fd < 0) {
+            throw std::runtime_error(fmt::format("Failed to create socket: {}", strerror(errno)));
+        }
+
+        // a socket left behind by an earlier run
+        unlink(address.c_str());
+
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+        if (bind(this->listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            const int error = errno;
+            close(this->listen_fd);
+            throw std::runtime_error(fmt::format("Failed to bind to \"{}\": {}", address, strerror(error)));
+        }
+        this->socket_path = address;
+    }
+
+    if (listen(this->listen_fd, 1) < 0) {
+        const int error = errno;
+        close(this->listen_fd);
+        throw std::runtime_error(fmt::format("Failed to listen on \"{}\": {}", address, strerror(error)));
+    }
+
+    this->gb.set_debugger(&this->debugger);
+}
+
+GdbStub::~GdbStub() {
+    this->gb.set_debugger(nullptr);
+    this->close_client();
+    close(this->listen_fd);
+    if (!this->socket_path.empty()) {
+        unlink(this->socket_path.c_str());
+    }
+}
+
+void GdbStub::poll(int timeout_ms) {
+    if (this->running && this->debugger.has_stop()) {
+        this->last_stop = this->debugger.take_stop();
+        this->stop(SIGTRAP_NR);
+    }
+
+    pollfd pfd{};
+    pfd.fd     = this->client_fd >= 0 ? this->client_fd : this->listen_fd;
+    pfd.events = POLLIN;
+    if (::poll(&pfd, 1, timeout_ms) <= 0) {
+        return;
+    }
+
+    if (this->client_fd < 0) {
+        this->accept_client();
+    } else {
+        this->receive();
+    }
+}
+
+void GdbStub::accept_client() {
+    this->client_fd = accept(this->listen_fd, nullptr, nullptr);
+    if (this->client_fd < 0) {
+        return;
+    }
+    this->input.clear();
+    this->ack = true;
+
+    // gdb expects the target to be stopped when it attaches
+    this->running     = false;
+    this->last_signal = SIGTRAP_NR;
+    this->last_stop.reset();
+}
+
+void GdbStub::close_client() {
+    if (this->client_fd >= 0) {
+        close(this->client_fd);
+        this->client_fd = -1;
+    }
+
+    // without a debugger the game runs on freely
+    this->debugger.clear();
+    this->debugger.take_stop();
+    this->running = true;
+}
+
+void GdbStub::receive() {
+    char      buffer[4096];
+    const int n = recv(this->client_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            this->close_client();
+        }
+        return;
+    }
+    this->input.append(buffer, n);
+
+    size_t pos = 0;
+    while (pos < this->input.size() && this->client_fd >= 0) {
+        const char c = this->input[pos];
+        if (c == '\x03') {
+            // ^C, finish the current instruction so the registers are consistent
+            pos++;
+            if (this->running) {
+                this->gb.step_instruction();
+                this->last_stop.reset();
+                this->stop(SIGINT_NR);
+            }
+        } else if (c == '-') {
+            pos++;
+            this->send_raw(this->last_sent);
+        } else if (c == '$') {
+            const size_t hash = this->input.find('#', pos);
+            if (hash == std::string::npos || hash + 2 >= this->input.size()) {
+                break; // incomplete
+            }
+            const std::string packet = this->input.substr(pos + 1, hash - pos - 1);
+            const uint8_t     sum    = parse_hex(this->input, hash + 1, hash + 3);
+            pos                      = hash + 3;
+
+            uint8_t expected = 0;
+            for (char p : packet) {
+                expected += static_cast<uint8_t>(p);
+            }
+            if (this->ack) {
+                this->send_raw(sum == expected ? "+" : "-");
+            }
+            if (sum == expected || !this->ack) {
+                this->handle_packet(packet);
+            }
+        } else {
+            pos++; // acks and noise
+        }
+    }
+    this->input.erase(0, pos);
+}
+
+void GdbStub::handle_packet(const std::string &packet) {
+    const char cmd = packet.empty() ? 0 : packet[0];
+
+    // the arguments of "Xaddr,length..." style packets
+    const size_t   comma  = packet.find(',');
+    const uint32_t addr   = parse_hex(packet, 1, comma);
+    const uint32_t length = comma != std::string::npos ? parse_hex(packet, comma + 1) : 0;
+
+    switch (cmd) {
+        case '?':
+            this->send_packet(this->stop_reply());
+            return;
+        case 'g':
+            this->send_packet(this->read_registers());
+            return;
+        case 'G':
+            this->write_registers(packet.substr(1));
+            this->send_packet("OK");
+            return;
+        case 'p': {
+            const std::string regs = this->read_registers();
+            const uint32_t    n    = parse_hex(packet, 1);
+            this->send_packet(n < N_REGISTERS ? regs.substr(n * 4, 4) : "E01");
+            return;
+        }
+        case 'P': {
+            const size_t   eq = packet.find('=');
+            const uint32_t n  = parse_hex(packet, 1, eq);
+            if (eq == std::string::npos || n >= N_REGISTERS) {
+                this->send_packet("E01");
+                return;
+            }
+            std::string regs = this->read_registers();
+            regs.replace(n * 4, 4, packet.substr(eq + 1, 4));
+            this->write_registers(regs);
+            this->send_packet("OK");
+            return;
+        }
+        case 'm': {
+            std::string data;
+            for (uint32_t i = 0; i < std::min(length, MAX_MEMORY_BYTES); i++) {
+                data += fmt::format("{:02x}", this->gb.peek((addr + i) & 0xffff));
+            }
+            this->send_packet(data);
+            return;
+        }
+        case 'M': {
+            const size_t colon = packet.find(':');
+            if (colon == std::string::npos || length > MAX_MEMORY_BYTES ||
+                packet.size() - colon - 1 < 2 * static_cast<size_t>(length)) {
+                this->send_packet("E01");
+                return;
+            }
+            for (uint32_t i = 0; i < length; i++) {
+                this->gb.poke((addr + i) & 0xffff, parse_hex(packet, colon + 1 + i * 2, colon + 3 + i * 2));
+            }
+            this->send_packet("OK");
+            return;
+        }
+        case 'c':
+        case 's':
+            if (packet.size() > 1) {
+                CpuRegisters regs = this->gb.get_cpu_registers();
+                regs.pc           = parse_hex(packet, 1);
+                this->gb.set_cpu_registers(regs);
+            }
+            if (cmd == 's') {
+                this->gb.step_instruction();
+                this->last_stop.reset();
+                this->last_signal = SIGTRAP_NR;
+                this->send_packet(this->stop_reply());
+            } else {
+                // the stop is reported by poll once run_until returns on a breakpoint
+                this->running = true;
+            }
+            return;
+        case 'Z':
+        case 'z': {
+            // Ztype,addr,kind
+            const size_t   second = packet.find(',', comma + 1);
+            const uint32_t type   = parse_hex(packet, 1, comma);
+            const uint16_t begin  = parse_hex(packet, comma + 1, second);
+            const uint32_t kind   = second != std::string::npos ? parse_hex(packet, second + 1) : 1;
+            const uint16_t end    = begin + std::max<uint32_t>(kind, 1) - 1;
+            const bool     insert = cmd == 'Z';
+            if (type <= 1) {
+                insert ? this->debugger.add_breakpoint(begin) : this->debugger.remove_breakpoint(begin);
+            } else if (type <= 4) {
+                const bool on_read  = type != 2;
+                const bool on_write = type != 3;
+                insert ? this->debugger.add_watchpoint(begin, end, on_read, on_write)
+                       : this->debugger.remove_watchpoint(begin, end, on_read, on_write);
+            } else {
+                this->send_packet("");
+                return;
+            }
+            this->send_packet("OK");
+            return;
+        }
+        case 'D':
+            this->send_packet("OK");
+            this->close_client();
+            return;
+        case 'k':
+            this->close_client();
+            return;
+        case 'H':
+        case 'T':
+            this->send_packet("OK");
+            return;
+        default:
+            break;
+    }
+
+    if (packet.starts_with("qSupported")) {
+        this->send_packet("PacketSize=1000;QStartNoAckMode+");
+    } else if (packet == "QStartNoAckMode") {
+        this->send_packet("OK");
+        this->ack = false;
+    } else if (packet == "qAttached") {
+        this->send_packet("1");
+    } else if (packet == "qfThreadInfo") {
+        this->send_packet("m1");
+    } else if (packet == "qsThreadInfo") {
+        this->send_packet("l");
+    } else if (packet == "qC") {
+        this->send_packet("QC1");
+    } else if (packet.starts_with("vKill")) {
+        this->send_packet("OK");
+        this->close_client();
+    } else {
+        // unsupported, e.g. vCont, after which gdb falls back to c and s
+        this->send_packet("");
+    }
+}
+
+void GdbStub::send_packet(const std::string &payload) {
+    uint8_t sum = 0;
+    for (char c : payload) {
+        sum += static_cast<uint8_t>(c);
+    }
+    this->last_sent = fmt::format("${}#{:02x}", payload, sum);
+    this->send_raw(this->last_sent);
+}
+
+void GdbStub::send_raw(const std::string &data) {
+    size_t pos = 0;
+    while (pos < data.size() && this->client_fd >= 0) {
+        const ssize_t n = send(this->client_fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            this->close_client();
+            return;
+        }
+        pos += n;
+    }
+}
+
+void GdbStub::stop(int signal) {
+    this->running     = false;
+    this->last_signal = signal;
+    this->send_packet(this->stop_reply());
+}
+
+std::string GdbStub::stop_reply() const {
+    std::string reply = fmt::format("T{:02x}", this->last_signal);
+    if (this->last_stop && this->last_stop->reason != Debugger::StopReason::BREAKPOINT) {
+        const bool read = this->last_stop->reason == Debugger::StopReason::WATCH_READ;
+        reply += fmt::format("{}:{:04x};", read ? "rwatch" : "watch", this->last_stop->addr);
+    }
+    return reply;
+}
+
+std::string GdbStub::read_registers() const {
+    const CpuRegisters r = this->gb.get_cpu_registers();
+
+    std::string out;
+    out += hex_u16(r.a << 8 | r.f);
+    out += hex_u16(r.b << 8 | r.c);
+    out += hex_u16(r.d << 8 | r.e);
+    out += hex_u16(r.h << 8 | r.l);
+    out += hex_u16(r.sp);
+    out += hex_u16(r.pc);
+    for (int i = 6; i < N_REGISTERS; i++) {
+        out += hex_u16(0);
+    }
+    return out;
+}
+
+void GdbStub::write_registers(const std::string &hex) {
+    if (hex.size() < 6 * 4) {
+        return;
+    }
+    CpuRegisters r;
+    const uint16_t af = parse_hex_u16(hex, 0);
+    const uint16_t bc = parse_hex_u16(hex, 4);
+    const uint16_t de = parse_hex_u16(hex, 8);
+    const uint16_t hl = parse_hex_u16(hex, 12);
+    r.a               = af >> 8;
+    r.f               = af & 0xff;
+    r.b               = bc >> 8;
+    r.c               = bc & 0xff;
+    r.d               = de >> 8;
+    r.e               = de & 0xff;
+    r.h               = hl >> 8;
+    r.l               = hl & 0xff;
+    r.sp              = parse_hex_u16(hex, 16);
+    r.pc              = parse_hex_u16(hex, 20);
+    this->gb.set_cpu_registers(r);
+}
@@ -0,0 +1,66 @@
+#ifndef GDB_STUB_H
+#define GDB_STUB_H
+
+#include "debugger.h"
+
+#include <cstdint>
+#include <string>
+
+class Gameboy;
+
+// Serves the GDB remote serial protocol for a Gameboy on a local socket, for a single client at a time.
+//
+// The stub never runs on its own. The frontend calls poll() between frames, which is when commands are read
+// and when a breakpoint stop, which makes run_until return early, is reported. While the client has the
+// machine stopped, is_running() is false and the frontend has to stop emulating. Once the client detaches
+// all breakpoints are removed and the game runs on.
+//
+// The registers are exchanged in the layout of GDB's z80 target (AF BC DE HL SP PC IX IY AF' BC' DE' HL'
+// IR, 16 bits each, little endian), the registers the Game Boy CPU does not have read as zero. Memory goes
+// through Gameboy::peek and poke. Software and hardware breakpoints are the same, watchpoints only see the
+// accesses made by the CPU, see Debugger.
+class GdbStub {
+public:
+    // `address` is a TCP port on 127.0.0.1, or the path of a Unix socket. The machine starts out stopped,
+    // so it waits for a client to connect and continue.
+    GdbStub(Gameboy &gb, const std::string &address);
+    ~GdbStub();
+
+    GdbStub(const GdbStub &)            = delete;
+    GdbStub &operator=(const GdbStub &) = delete;
+
+    // accepts a client, reports stops and handles the pending commands, waiting for up to `timeout_ms` for
+    // something to happen
+    void poll(int timeout_ms);
+
+    bool is_running() const {
+        return this->running;
+    }
+
+private:
+    void        accept_client();
+    void        close_client();
+    void        receive();
+    void        handle_packet(const std::string &packet);
+    void        send_packet(const std::string &payload);
+    void        send_raw(const std::string &data);
+    void        stop(int signal);
+    std::string stop_reply() const;
+    std::string read_registers() const;
+    void        write_registers(const std::string &hex);
+
+    Gameboy    &gb;
+    Debugger    debugger;
+    std::string socket_path; // removed again on destruction, empty for TCP
+    int         listen_fd{-1};
+    int         client_fd{-1};
+    std::string input;
+    std::string last_sent; // resent when the client asks for it
+    bool        ack{true};
+    bool        running{false};
+    int         last_signal{5}; // SIGTRAP
+
+    std::optional<Debugger::Stop> last_stop; // the breakpoint or watchpoint of the last stop, if any
+};
+
+#endif /* GDB_STUB_H */
@@ -3,7 +3,18 @@
 #include "interrupt_state.h"
 #include "bus.h"
 
+#include <fmt/color.h>
 #include <fmt/core.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
 
 class MockBus : public IBus {
 public:
@@ -72,6 +83,695 @@ void print_matrix(const std::vector<bool> &results) {
     fmt::print("\n");
 }
 
+//-------------------------------------------------------
+// Conformance and timing
+//-------------------------------------------------------
+
+// M-cycles per opcode, conditional branches when not taken. 0 for STOP, HALT, the CB prefix and illegal opcodes.
+// clang-format off
+constexpr uint8_t OPCODE_CYCLES[256] = {
+    1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
+    0, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
+    2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1,
+    2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    2, 2, 2, 2, 2, 2, 0, 2, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 3, 4, 3, 4, 2, 4, 2, 4, 3, 0, 3, 6, 2, 4,
+    2, 3, 3, 0, 3, 4, 2, 4, 2, 4, 3, 0, 3, 0, 2, 4,
+    3, 3, 2, 0, 0, 4, 2, 4, 4, 1, 4, 0, 0, 0, 2, 4,
+    3, 3, 2, 1, 0, 4, 2, 4, 3, 2, 4, 1, 0, 0, 2, 4,
+};
+// clang-format on
+
+// extra M-cycles of a conditional branch when it is taken
+static int taken_extra_cycles(uint8_t op) {
+    switch (op & 0xe7) {
+        case 0x20: // JR cc
+        case 0xc2: // JP cc
+            return 1;
+        case 0xc0: // RET cc
+        case 0xc4: // CALL cc
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+static int expected_cycles(bool cb, uint8_t op, bool taken) {
+    if (cb) {
+        // the prefix is part of the instruction
+        return (op & 0x07) != 6 ? 2 : (op >> 6) == 1 ? 3 : 4;
+    }
+    return OPCODE_CYCLES[op] + (taken ? taken_extra_cycles(op) : 0);
+}
+
+using MemoryWrites = std::vector<std::pair<uint16_t, uint8_t>>;
+
+// flat 64 KiB of memory that logs all writes
+class TestBus : public IBus {
+public:
+    uint8_t read(uint16_t addr) const override {
+        return this->memory[addr];
+    }
+
+    void write(uint16_t addr, uint8_t data) override {
+        this->memory[addr] = data;
+        this->writes.emplace_back(addr, data);
+    }
+
+    std::array<uint8_t, 0x10000> memory{};
+    MemoryWrites                 writes;
+};
+
+constexpr uint8_t FLAG_Z = 0x80;
+constexpr uint8_t FLAG_N = 0x40;
+constexpr uint8_t FLAG_H = 0x20;
+constexpr uint8_t FLAG_C = 0x10;
+
+// Independent model of the documented instruction semantics, applied to the registers and memory before
+// the instruction. Returns false for instructions it does not cover (STOP, HALT, illegal opcodes).
+class ReferenceCpu {
+public:
+    ReferenceCpu(const TestBus &bus, CpuRegisters &r, MemoryWrites &writes)
+        : bus(bus),
+          r(r),
+          writes(writes) {
+    }
+
+    bool taken{false}; // whether a conditional branch was taken
+
+    bool step() {
+        const uint8_t op = this->imm8();
+        if (op == 0xcb) {
+            this->step_cb(this->imm8());
+            return true;
+        }
+
+        if (op >= 0x40 && op < 0x80 && op != 0x76) {
+            this->set_r8(op >> 3 & 7, this->get_r8(op & 7));
+            return true;
+        }
+        if (op >= 0x80 && op < 0xc0) {
+            this->alu(op >> 3 & 7, this->get_r8(op & 7));
+            return true;
+        }
+        if ((op & 0xc7) == 0xc6) {
+            this->alu(op >> 3 & 7, this->imm8());
+            return true;
+        }
+        if ((op & 0xc7) == 0x04 || (op & 0xc7) == 0x05) {
+            const int     i   = op >> 3 & 7;
+            const uint8_t v   = this->get_r8(i);
+            const bool    dec = op & 1;
+            const uint8_t res = dec ? v - 1 : v + 1;
+            this->set_r8(i, res);
+            this->set_flags(res == 0, dec, dec ? (v & 0xf) == 0 : (v & 0xf) == 0xf, this->r.f & FLAG_C);
+            return true;
+        }
+        if ((op & 0xc7) == 0x06) {
+            this->set_r8(op >> 3 & 7, this->imm8());
+            return true;
+        }
+        if ((op & 0xcf) == 0x01) {
+            this->set_r16(op >> 4, this->imm16());
+            return true;
+        }
+        if ((op & 0xcf) == 0x03 || (op & 0xcf) == 0x0b) {
+            this->set_r16(op >> 4, this->get_r16(op >> 4) + ((op & 0x08) ? -1 : 1));
+            return true;
+        }
+        if ((op & 0xcf) == 0x09) {
+            const uint16_t hl = this->get_r16(2);
+            const uint16_t v  = this->get_r16(op >> 4);
+            this->set_r16(2, hl + v);
+            this->set_flags(this->r.f & FLAG_Z, false, (hl & 0xfff) + (v & 0xfff) > 0xfff, hl + v > 0xffff);
+            return true;
+        }
+        if ((op & 0xcf) == 0xc5) {
+            this->push(op == 0xf5 ? (this->r.a << 8 | this->r.f) : this->get_r16(op >> 4 & 3));
+            return true;
+        }
+        if ((op & 0xcf) == 0xc1) {
+            const uint16_t v = this->pop();
+            if (op == 0xf1) {
+                this->r.a = v >> 8;
+                this->r.f = v & 0xf0;
+            } else {
+                this->set_r16(op >> 4 & 3, v);
+            }
+            return true;
+        }
+        if ((op & 0xc7) == 0xc7) {
+            this->push(this->r.pc);
+            this->r.pc = op & 0x38;
+            return true;
+        }
+        if ((op & 0xe7) == 0x20) {
+            const auto e = static_cast<int8_t>(this->imm8());
+            this->taken  = this->condition(op >> 3 & 3);
+            this->r.pc += this->taken ? e : 0;
+            return true;
+        }
+        if ((op & 0xe7) == 0xc2) {
+            const uint16_t addr = this->imm16();
+            this->taken         = this->condition(op >> 3 & 3);
+            this->r.pc          = this->taken ? addr : this->r.pc;
+            return true;
+        }
+        if ((op & 0xe7) == 0xc4) {
+            const uint16_t addr = this->imm16();
+            this->taken         = this->condition(op >> 3 & 3);
+            if (this->taken) {
+                this->push(this->r.pc);
+                this->r.pc = addr;
+            }
+            return true;
+        }
+        if ((op & 0xe7) == 0xc0) {
+            this->taken = this->condition(op >> 3 & 3);
+            if (this->taken) {
+                this->r.pc = this->pop();
+            }
+            return true;
+        }
+
+        switch (op) {
+            case 0x00: // NOP
+            case 0xf3: // DI
+            case 0xfb: // EI
+                return true;
+            case 0x02:
+                this->write(this->get_r16(0), this->r.a);
+                return true;
+            case 0x12:
+                this->write(this->get_r16(1), this->r.a);
+                return true;
+            case 0x0a:
+                this->r.a = this->read(this->get_r16(0));
+                return true;
+            case 0x1a:
+                this->r.a = this->read(this->get_r16(1));
+                return true;
+            case 0x22:
+            case 0x32: {
+                const uint16_t hl = this->get_r16(2);
+                this->write(hl, this->r.a);
+                this->set_r16(2, op == 0x22 ? hl + 1 : hl - 1);
+                return true;
+            }
+            case 0x2a:
+            case 0x3a: {
+                const uint16_t hl = this->get_r16(2);
+                this->r.a         = this->read(hl);
+                this->set_r16(2, op == 0x2a ? hl + 1 : hl - 1);
+                return true;
+            }
+            case 0x07:
+            case 0x0f:
+            case 0x17:
+            case 0x1f:
+                // same as the CB rotates of A, but Z is always cleared
+                this->r.a = this->shift(op >> 3, this->r.a);
+                this->r.f &= ~FLAG_Z;
+                return true;
+            case 0x08: {
+                const uint16_t addr = this->imm16();
+                this->write(addr, this->r.sp & 0xff);
+                this->write(addr + 1, this->r.sp >> 8);
+                return true;
+            }
+            case 0x18:
+                this->r.pc += static_cast<int8_t>(this->imm8());
+                return true;
+            case 0x27: {
+                const bool n = this->r.f & FLAG_N;
+                bool       c = this->r.f & FLAG_C;
+                if (!n) {
+                    if (c || this->r.a > 0x99) {
+                        this->r.a += 0x60;
+                        c = true;
+                    }
+                    if ((this->r.f & FLAG_H) || (this->r.a & 0x0f) > 0x09) {
+                        this->r.a += 0x06;
+                    }
+                } else {
+                    this->r.a -= c ? 0x60 : 0;
+                    this->r.a -= (this->r.f & FLAG_H) ? 0x06 : 0;
+                }
+                this->set_flags(this->r.a == 0, n, false, c);
+                return true;
+            }
+            case 0x2f:
+                this->r.a = ~this->r.a;
+                this->r.f |= FLAG_N | FLAG_H;
+                return true;
+            case 0x37:
+                this->set_flags(this->r.f & FLAG_Z, false, false, true);
+                return true;
+            case 0x3f:
+                this->set_flags(this->r.f & FLAG_Z, false, false, !(this->r.f & FLAG_C));
+                return true;
+            case 0xc3:
+                this->r.pc = this->imm16();
+                return true;
+            case 0xcd: {
+                const uint16_t addr = this->imm16();
+                this->push(this->r.pc);
+                this->r.pc = addr;
+                return true;
+            }
+            case 0xc9:
+            case 0xd9: // RETI, IME is not checked
+                this->r.pc = this->pop();
+                return true;
+            case 0xe0:
+                this->write(0xff00 | this->imm8(), this->r.a);
+                return true;
+            case 0xf0:
+                this->r.a = this->read(0xff00 | this->imm8());
+                return true;
+            case 0xe2:
+                this->write(0xff00 | this->r.c, this->r.a);
+                return true;
+            case 0xf2:
+                this->r.a = this->read(0xff00 | this->r.c);
+                return true;
+            case 0xea:
+                this->write(this->imm16(), this->r.a);
+                return true;
+            case 0xfa:
+                this->r.a = this->read(this->imm16());
+                return true;
+            case 0xe8:
+                this->r.sp = this->add_sp(this->imm8());
+                return true;
+            case 0xf8:
+                this->set_r16(2, this->add_sp(this->imm8()));
+                return true;
+            case 0xf9:
+                this->r.sp = this->get_r16(2);
+                return true;
+            case 0xe9:
+                this->r.pc = this->get_r16(2);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+private:
+    void step_cb(uint8_t op) {
+        const int     i = op & 7;
+        const uint8_t v = this->get_r8(i);
+        const int     b = op >> 3 & 7;
+        switch (op >> 6) {
+            case 0:
+                this->set_r8(i, this->shift(b, v));
+                break;
+            case 1: // BIT
+                this->set_flags(!(v >> b & 1), false, true, this->r.f & FLAG_C);
+                break;
+            case 2: // RES
+                this->set_r8(i, v & ~(1 << b));
+                break;
+            case 3: // SET
+                this->set_r8(i, v | (1 << b));
+                break;
+        }
+    }
+
+    // RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL
+    uint8_t shift(int kind, uint8_t v) {
+        const int old_c = (this->r.f & FLAG_C) ? 1 : 0;
+        uint8_t   res   = 0;
+        bool      c     = false;
+        switch (kind) {
+            case 0:
+                res = v << 1 | v >> 7, c = v & 0x80;
+                break;
+            case 1:
+                res = v >> 1 | v << 7, c = v & 1;
+                break;
+            case 2:
+                res = v << 1 | old_c, c = v & 0x80;
+                break;
+            case 3:
+                res = v >> 1 | old_c << 7, c = v & 1;
+                break;
+            case 4:
+                res = v << 1, c = v & 0x80;
+                break;
+            case 5:
+                res = v >> 1 | (v & 0x80), c = v & 1;
+                break;
+            case 6:
+                res = v << 4 | v >> 4, c = false;
+                break;
+            case 7:
+                res = v >> 1, c = v & 1;
+                break;
+        }
+        this->set_flags(res == 0, false, false, c);
+        return res;
+    }
+
+    // ADD, ADC, SUB, SBC, AND, XOR, OR, CP
+    void alu(int kind, uint8_t v) {
+        const int carry = (kind == 1 || kind == 3) && (this->r.f & FLAG_C) ? 1 : 0;
+        const int a     = this->r.a;
+        int       res   = 0;
+        switch (kind) {
+            case 0:
+            case 1:
+                res = a + v + carry;
+                this->set_flags((res & 0xff) == 0, false, (a & 0xf) + (v & 0xf) + carry > 0xf, res > 0xff);
+                break;
+            case 2:
+            case 3:
+            case 7:
+                res = a - v - carry;
+                this->set_flags((res & 0xff) == 0, true, (a & 0xf) < (v & 0xf) + carry, a < v + carry);
+                break;
+            case 4:
+                res = a & v;
+                this->set_flags(res == 0, false, true, false);
+                break;
+            case 5:
+                res = a ^ v;
+                this->set_flags(res == 0, false, false, false);
+                break;
+            case 6:
+                res = a | v;
+                this->set_flags(res == 0, false, false, false);
+                break;
+        }
+        if (kind != 7) {
+            this->r.a = res & 0xff;
+        }
+    }
+
+    uint16_t add_sp(uint8_t imm) {
+        const uint16_t res = this->r.sp + static_cast<int8_t>(imm);
+        this->set_flags(false, false, (this->r.sp & 0xf) + (imm & 0xf) > 0xf, (this->r.sp & 0xff) + imm > 0xff);
+        return res;
+    }
+
+    bool condition(int cc) const {
+        switch (cc) {
+            case 0:
+                return !(this->r.f & FLAG_Z);
+            case 1:
+                return this->r.f & FLAG_Z;
+            case 2:
+                return !(this->r.f & FLAG_C);
+            default:
+                return this->r.f & FLAG_C;
+        }
+    }
+
+    void set_flags(bool z, bool n, bool h, bool c) {
+        this->r.f = (z ? FLAG_Z : 0) | (n ? FLAG_N : 0) | (h ? FLAG_H : 0) | (c ? FLAG_C : 0);
+    }
+
+    uint8_t read(uint16_t addr) const {
+        return this->bus.read(addr);
+    }
+
+    void write(uint16_t addr, uint8_t data) {
+        this->writes.emplace_back(addr, data);
+    }
+
+    uint8_t imm8() {
+        return this->read(this->r.pc++);
+    }
+
+    uint16_t imm16() {
+        const uint8_t lo = this->imm8();
+        return this->imm8() << 8 | lo;
+    }
+
+    void push(uint16_t v) {
+        this->r.sp -= 2;
+        this->write(this->r.sp + 1, v >> 8);
+        this->write(this->r.sp, v & 0xff);
+    }
+
+    uint16_t pop() {
+        const uint16_t v = this->read(this->r.sp) | this->read(this->r.sp + 1) << 8;
+        this->r.sp += 2;
+        return v;
+    }
+
+    // B, C, D, E, H, L, (HL), A
+    uint8_t get_r8(int i) const {
+        uint8_t *regs[] = {&this->r.b, &this->r.c, &this->r.d, &this->r.e, &this->r.h, &this->r.l, nullptr, &this->r.a};
+        return i == 6 ? this->read(this->get_r16(2)) : *regs[i];
+    }
+
+    void set_r8(int i, uint8_t v) {
+        uint8_t *regs[] = {&this->r.b, &this->r.c, &this->r.d, &this->r.e, &this->r.h, &this->r.l, nullptr, &this->r.a};
+        if (i == 6) {
+            this->write(this->get_r16(2), v);
+        } else {
+            *regs[i] = v;
+        }
+    }
+
+    // BC, DE, HL, SP
+    uint16_t get_r16(int i) const {
+        switch (i) {
+            case 0:
+                return this->r.b << 8 | this->r.c;
+            case 1:
+                return this->r.d << 8 | this->r.e;
+            case 2:
+                return this->r.h << 8 | this->r.l;
+            default:
+                return this->r.sp;
+        }
+    }
+
+    void set_r16(int i, uint16_t v) {
+        switch (i) {
+            case 0:
+                this->r.b = v >> 8, this->r.c = v & 0xff;
+                break;
+            case 1:
+                this->r.d = v >> 8, this->r.e = v & 0xff;
+                break;
+            case 2:
+                this->r.h = v >> 8, this->r.l = v & 0xff;
+                break;
+            default:
+                this->r.sp = v;
+                break;
+        }
+    }
+
+    const TestBus &bus;
+    CpuRegisters  &r;
+    MemoryWrites  &writes;
+};
+
+struct OpcodeResult {
+    bool        implemented{false};
+    bool        modeled{false};
+    bool        results_ok{true};
+    bool        timing_ok{true};
+    std::string failure;
+    double      ns_per_op{0.0};
+};
+
+constexpr uint16_t TEST_PC      = 0xc000;
+constexpr int      N_TRIALS     = 64;
+constexpr int      N_TIMED_RUNS = 2000;
+constexpr int      MAX_CYCLES   = 16;
+
+// Runs the instruction at the PC until the CPU is at the next instruction boundary, returns the M-cycles
+static int run_instruction(Cpu &cpu, TestBus &bus, InterruptState &int_state) {
+    int n_cycles = 0;
+    do {
+        cpu.do_tick(4 * n_cycles, bus, int_state);
+        n_cycles++;
+    } while (!cpu.at_instruction_boundary() && n_cycles < MAX_CYCLES);
+    return n_cycles;
+}
+
+static std::string format_registers(const CpuRegisters &r) {
+    return fmt::format("A={:02X} F={:02X} B={:02X} C={:02X} D={:02X} E={:02X} H={:02X} L={:02X} SP={:04X} PC={:04X}",
+                       r.a, r.f, r.b, r.c, r.d, r.e, r.h, r.l, r.sp, r.pc);
+}
+
+static OpcodeResult test_opcode(bool cb, uint8_t op) {
+    OpcodeResult result;
+    result.implemented = cb ? have_16bit_opcode(op) : have_opcode(op);
+    if (!result.implemented || (!cb && (op == 0x76 || op == 0xcb))) {
+        return result;
+    }
+
+    std::mt19937   rng(cb << 8 | op);
+    TestBus        bus;
+    InterruptState int_state;
+    CpuRegisters   initial;
+
+    // the operands come from all over memory as the registers vary between trials
+    for (auto &byte : bus.memory) {
+        byte = rng();
+    }
+
+    for (int trial = 0; trial < N_TRIALS; trial++) {
+        bus.memory[TEST_PC] = cb ? 0xcb : op;
+        if (cb) {
+            bus.memory[TEST_PC + 1] = op;
+        }
+
+        // keep HL and SP away from the instruction, so that memory writes cannot modify it
+        CpuRegisters before;
+        before.a  = rng();
+        before.f  = rng() & 0xf0;
+        before.b  = rng();
+        before.c  = rng();
+        before.d  = rng();
+        before.e  = rng();
+        before.h  = 0x80 + rng() % 0x40;
+        before.l  = rng();
+        before.sp = 0xd000 + rng() % 0x1000;
+        before.pc = TEST_PC;
+        if (trial == 0) {
+            initial = before;
+        }
+
+        CpuRegisters expected = before;
+        MemoryWrites expected_writes;
+        ReferenceCpu reference(bus, expected, expected_writes);
+        result.modeled = reference.step();
+
+        Cpu cpu;
+        cpu.set_registers(before);
+        bus.writes.clear();
+        int n_cycles = 0;
+        try {
+            n_cycles = run_instruction(cpu, bus, int_state);
+        } catch (std::exception &e) {
+            result.results_ok = false;
+            result.failure    = e.what();
+            return result;
+        }
+
+        const CpuRegisters actual = cpu.get_registers();
+        std::sort(expected_writes.begin(), expected_writes.end());
+        std::sort(bus.writes.begin(), bus.writes.end());
+        if (result.modeled && result.results_ok && (actual != expected || bus.writes != expected_writes)) {
+            result.results_ok = false;
+            result.failure    = fmt::format("before   {}\n"
+                                            "        expected {}, {} writes\n"
+                                            "        actual   {}, {} writes",
+                                            format_registers(before),
+                                            format_registers(expected),
+                                            expected_writes.size(),
+                                            format_registers(actual),
+                                            bus.writes.size());
+        }
+
+        const int expected_n_cycles = expected_cycles(cb, op, reference.taken);
+        if (expected_n_cycles > 0 && n_cycles != expected_n_cycles && result.timing_ok) {
+            result.timing_ok = false;
+            result.failure += fmt::format("{}{} M-cycles, expected {}{}",
+                                          result.failure.empty() ? "" : "\n        ",
+                                          n_cycles,
+                                          expected_n_cycles,
+                                          reference.taken ? " (branch taken)" : "");
+        }
+    }
+
+    // execution cost, for the registers and memory of the first trial
+    Cpu cpu;
+    const auto tic = std::chrono::steady_clock::now();
+    for (int i = 0; i < N_TIMED_RUNS; i++) {
+        cpu.set_registers(initial);
+        bus.writes.clear();
+        run_instruction(cpu, bus, int_state);
+    }
+    const auto toc   = std::chrono::steady_clock::now();
+    result.ns_per_op = std::chrono::duration<double, std::nano>(toc - tic).count() / N_TIMED_RUNS;
+
+    return result;
+}
+
+// same layout as print_matrix, every cell holds a value, colored from green (cheapest) to red (most expensive)
+void print_heat_map(const std::vector<double> &values) {
+    const bool color = isatty(fileno(stdout));
+
+    double max_value = 0.0;
+    for (double v : values) {
+        max_value = std::max(max_value, v);
+    }
+
+    fmt::print("    ");
+    for (int i = 0; i < 16; i++) {
+        fmt::print("   x{:X}", i);
+    }
+    fmt::print("\n    {:-<97}", "");
+    for (int i = 0; i < 256; i++) {
+        if (i % 16 == 0) {
+            fmt::print("\n {0:X}x|", i / 16);
+        }
+
+        if (values[i] <= 0.0) {
+            fmt::print("      ");
+        } else if (color) {
+            const double  heat = values[i] / max_value;
+            const uint8_t red  = static_cast<uint8_t>(255 * std::min(1.0, 2 * heat));
+            const uint8_t grn  = static_cast<uint8_t>(255 * std::min(1.0, 2 - 2 * heat));
+            fmt::print(fmt::fg(fmt::rgb(red, grn, 0)), " {:5.0f}", values[i]);
+        } else {
+            fmt::print(" {:5.0f}", values[i]);
+        }
+    }
+    fmt::print("\n");
+}
+
+static bool print_conformance(bool cb, const std::vector<OpcodeResult> &results) {
+    const char *prefix = cb ? "CB " : "";
+    const char *kind   = cb ? "16-bit instruction" : "8-bit instruction";
+
+    std::vector<bool> ok(256);
+    for (int i = 0; i < 256; i++) {
+        ok[i] = results[i].results_ok;
+    }
+    fmt::print("\n{} results and flags (blank: pass or not modeled)\n\n", kind);
+    print_matrix(ok);
+
+    for (int i = 0; i < 256; i++) {
+        ok[i] = results[i].timing_ok;
+    }
+    fmt::print("\n{} M-cycles\n\n", kind);
+    print_matrix(ok);
+
+    bool all_ok = true;
+    for (int i = 0; i < 256; i++) {
+        if (!results[i].failure.empty()) {
+            fmt::print("{}{:02X}: {}\n", prefix, i, results[i].failure);
+            all_ok = false;
+        }
+    }
+
+    std::vector<double> ns(256);
+    for (int i = 0; i < 256; i++) {
+        ns[i] = results[i].ns_per_op;
+    }
+    fmt::print("\n{} execution cost in ns\n\n", kind);
+    print_heat_map(ns);
+
+    return all_ok;
+}
+
 int main() {
     logging::set_level(logging::LogLevel::QUIET);
 
@@ -88,5 +788,14 @@ int main() {
     fmt::print("\n16-bit instructions\n\n");
     print_matrix(results);
 
-    return 0;
+    bool all_ok = true;
+    for (bool cb : {false, true}) {
+        std::vector<OpcodeResult> opcode_results;
+        for (int i = 0; i < 256; i++) {
+            opcode_results.push_back(test_opcode(cb, i));
+        }
+        all_ok &= print_conformance(cb, opcode_results);
+    }
+
+    return all_ok ? 0 : 1;
 }
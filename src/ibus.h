@@ -7,6 +7,17 @@ class IBus {
 public:
     virtual uint8_t read(uint16_t addr) const       = 0;
     virtual void write(uint16_t addr, uint8_t data) = 0;
+
+    // Reads like the CPU, but without counting the access or hitting watchpoints, for debugging tools and for
+    // the PPU's own VRAM and DMA fetches. Reads of the prohibited area $FEA0-$FEFF return $FF.
+    virtual uint8_t peek(uint16_t addr) const {
+        return this->read(addr);
+    }
+
+    // ROM bank mapped at `addr`, 0 outside of the cartridge ROM; only used by debugging tools
+    virtual uint16_t get_rom_bank(uint16_t) const {
+        return 0;
+    }
 };
 
 #endif /* IBUS_H */
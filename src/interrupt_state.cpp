@@ -1,4 +1,5 @@
 #include "interrupt_state.h"
+#include "state_stream.h"
 
 #include <fmt/core.h>
 
@@ -55,6 +56,19 @@ void InterruptState::write_reg(uint8_t regid, uint8_t data) {
     }
 }
 
+template <typename Self, typename Stream>
+void InterruptState::transfer_state(Self &self, Stream &s) {
+    s(self.if_reg, self.ie_reg);
+}
+
+void InterruptState::save_state(StateWriter &w) const {
+    transfer_state(*this, w);
+}
+
+void InterruptState::load_state(StateReader &r) {
+    transfer_state(*this, r);
+}
+
 void InterruptState::dump(std::ostream &os) const {
     os << fmt::format("IF [0xff0f]: {:02X}\n", this->if_reg);
     os << fmt::format("IE [0xffff]: {:02X}\n", this->ie_reg);
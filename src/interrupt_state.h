@@ -4,6 +4,9 @@
 #include <cstdint>
 #include <iosfwd>
 
+class StateReader;
+class StateWriter;
+
 enum class InterruptCause {
     VBLANK   = 0,
     LCD_STAT = 1,
@@ -28,7 +31,17 @@ public:
     uint8_t read_reg(uint8_t regid) const;
     void write_reg(uint8_t regid, uint8_t data);
     void dump(std::ostream &os) const;
+
+    // binary save state, see state_stream.h
+    void save_state(StateWriter &w) const;
+    void load_state(StateReader &r);
 private:
+    // keeps IF and IE in SIMD lanes
+    friend class LockstepBatch;
+
+    template <typename Self, typename Stream>
+    static void transfer_state(Self &self, Stream &s);
+
     uint8_t if_reg{0};
     uint8_t ie_reg{0};
 };
@@ -0,0 +1,18 @@
+#include "json.h"
+
+#include <fmt/core.h>
+
+std::string json_escape(const std::string &s) {
+    std::string out;
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            out += fmt::format("\\u{:04x}", c);
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,9 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+
+// `s` escaped for use inside a JSON string literal; control characters and bytes outside ASCII become \u00XX
+std::string json_escape(const std::string &s);
+
+#endif /* JSON_H */
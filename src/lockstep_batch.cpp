@@ -0,0 +1,1169 @@
+#include "lockstep_batch.h"
+
+#include <algorithm>
+#include <bit>
+
+constexpr uint32_t M_CYCLES_PER_FRAME = CYCLES_PER_FRAME / 4;
+
+// Lane masks hold 0xffff or 0 in every element. The comparisons are unsigned.
+
+template <typename V>
+static V eq(V a, V b) {
+    return __builtin_convertvector(a == b, V);
+}
+
+template <typename V>
+static V ne(V a, V b) {
+    return __builtin_convertvector(a != b, V);
+}
+
+template <typename V>
+static V lt(V a, V b) {
+    return __builtin_convertvector(a < b, V);
+}
+
+template <typename V>
+static V splat(uint16_t x) {
+    return V{} + x;
+}
+
+template <typename V>
+static V select(V mask, V a, V b) {
+    return (a & mask) | (b & ~mask);
+}
+
+template <typename V>
+static uint32_t to_bits(V mask) {
+    uint32_t bits = 0;
+    for (int i = 0; i < LockstepBatch::LANE_WIDTH; i++) {
+        bits |= (mask[i] & 1u) << i;
+    }
+    return bits;
+}
+
+// IO registers an LDH may read in a SIMD lane, the others are read by the lane's Cpu
+static bool is_simd_readable_io(uint8_t regid) {
+    return regid == 0x00 || (regid >= 0x04 && regid <= 0x07) || regid == 0x0f || (regid >= 0x40 && regid <= 0x45) ||
+           (regid >= 0x47 && regid <= 0x4b) || regid == 0xff;
+}
+
+// The lanes of a block that execute an instruction together, in the M-cycle of its fetch. Every instruction
+// first drops the lanes it cannot run (see keep), then applies its effects to the remaining lanes `m`.
+struct LockstepBatch::Group {
+    Block   &b;
+    Lanes    m;         // lanes executing the instruction
+    uint32_t m_left;    // M-cycles left in the frame, including this one
+    uint32_t kicked{0}; // lanes handed to their Gameboy instead
+
+    uint32_t bits() const {
+        return to_bits(this->m);
+    }
+
+    // keeps the lanes in `ok` and hands the others to their Gameboy, false if none is left
+    bool keep(Lanes ok) {
+        this->kicked |= to_bits(this->m & ~ok);
+        this->m &= ok;
+        return this->bits() != 0;
+    }
+
+    // keeps the lanes for which an instruction of `n` M-cycles ends within the frame
+    bool fits(Lanes n) {
+        return this->keep(~lt(splat<Lanes>(this->m_left), n));
+    }
+
+    bool fits(uint16_t n) {
+        return this->fits(splat<Lanes>(n));
+    }
+
+    void set(Lanes &dst, Lanes v) const {
+        dst = select(this->m, v, dst);
+    }
+
+    // ROM, VRAM, WRAM and its echo, OAM and HRAM, which hold the same data whenever they are read
+    static Lanes readable(Lanes addr) {
+        return lt(addr, splat<Lanes>(0xa000)) |
+               (~lt(addr, splat<Lanes>(0xc000)) & lt(addr, splat<Lanes>(0xfea0))) |
+               (~lt(addr, splat<Lanes>(0xff80)) & ne(addr, splat<Lanes>(0xffff)));
+    }
+
+    // WRAM and HRAM, and VRAM and OAM unless a line is drawn in the `n` M-cycles the write could be in
+    Lanes writable(Lanes addr, uint16_t n) const {
+        const Lanes ram   = (~lt(addr, splat<Lanes>(0xc000)) & lt(addr, splat<Lanes>(0xfe00))) |
+                            (~lt(addr, splat<Lanes>(0xff80)) & ne(addr, splat<Lanes>(0xffff)));
+        const Lanes video = (~lt(addr, splat<Lanes>(0x8000)) & lt(addr, splat<Lanes>(0xa000))) |
+                            (~lt(addr, splat<Lanes>(0xfe00)) & lt(addr, splat<Lanes>(0xfea0)));
+        // the line is drawn at dot 90, the M-cycles take the dots lx+1 to lx+4n
+        const Lanes lcd_off = eq(this->b.lcdc & 0x80, Lanes{});
+        const Lanes no_line = lcd_off | ~lt(splat<Lanes>(89) - this->b.lx, splat<Lanes>(4 * n));
+        return ram | (video & no_line);
+    }
+
+    Lanes load(Lanes addr) const {
+        Lanes v{};
+        for (uint32_t bits = this->bits(); bits != 0; bits &= bits - 1) {
+            const int i = std::countr_zero(bits);
+            v[i]        = this->b.lanes[i]->bus.read(addr[i]);
+        }
+        return v;
+    }
+
+    void store(Lanes addr, Lanes v, Lanes mask) const {
+        for (uint32_t bits = to_bits(this->m & mask); bits != 0; bits &= bits - 1) {
+            const int i = std::countr_zero(bits);
+            this->b.lanes[i]->bus.write(addr[i], v[i]);
+        }
+    }
+
+    void store(Lanes addr, Lanes v) const {
+        this->store(addr, v, this->m);
+    }
+
+    // register pairs BC DE HL SP
+    Lanes get16(int p) const {
+        return p == 3 ? this->b.sp : this->b.r[2 * p] << 8 | this->b.r[2 * p + 1];
+    }
+
+    void set16(int p, Lanes v) {
+        if (p == 3) {
+            this->set(this->b.sp, v);
+        } else {
+            this->set(this->b.r[2 * p], v >> 8);
+            this->set(this->b.r[2 * p + 1], v & 0xff);
+        }
+    }
+
+    // conditions NZ Z NC C
+    Lanes condition(int cc) const {
+        const Lanes flag = ne(this->b.f & splat<Lanes>(cc < 2 ? 0x80 : 0x10), Lanes{});
+        return cc & 1 ? flag : ~flag;
+    }
+
+    static Lanes zero(Lanes v) {
+        return eq(v, Lanes{}) & 0x80;
+    }
+
+    void add(Lanes v, bool with_carry) {
+        const Lanes c    = with_carry ? (this->b.f >> 4) & 1 : Lanes{};
+        const Lanes a    = this->b.r[7];
+        const Lanes res5 = (a & 0xf) + (v & 0xf) + c;
+        const Lanes res9 = a + v + c;
+        this->set(this->b.f, zero(res9 & 0xff) | (res5 & 0x10) << 1 | (res9 & 0x100) >> 4);
+        this->set(this->b.r[7], res9 & 0xff);
+    }
+
+    Lanes sub(Lanes v, bool with_carry) {
+        const Lanes c    = with_carry ? (this->b.f >> 4) & 1 : Lanes{};
+        const Lanes a    = this->b.r[7];
+        const Lanes res5 = (a & 0xf) - (v & 0xf) - c;
+        const Lanes res9 = a - v - c;
+        this->set(this->b.f, zero(res9 & 0xff) | 0x40 | (res5 & 0x10) << 1 | (res9 & 0x100) >> 4);
+        return res9 & 0xff;
+    }
+
+    // ADD ADC SUB SBC AND XOR OR CP
+    void alu(int op, Lanes v) {
+        Lanes &a = this->b.r[7];
+        switch (op) {
+            case 0:
+            case 1:
+                this->add(v, op == 1);
+                break;
+            case 2:
+            case 3:
+                this->set(a, this->sub(v, op == 3));
+                break;
+            case 4:
+                this->set(a, a & v);
+                this->set(this->b.f, zero(a) | 0x20);
+                break;
+            case 5:
+                this->set(a, a ^ v);
+                this->set(this->b.f, zero(a));
+                break;
+            case 6:
+                this->set(a, a | v);
+                this->set(this->b.f, zero(a));
+                break;
+            default:
+                this->sub(v, false);
+                break;
+        }
+    }
+
+    Lanes inc(Lanes v) {
+        const Lanes res = (v + 1) & 0xff;
+        this->set(this->b.f, (this->b.f & 0x10) | zero(res) | (((v & 0xf) + 1) & 0x10) << 1);
+        return res;
+    }
+
+    Lanes dec(Lanes v) {
+        const Lanes res = (v - 1) & 0xff;
+        this->set(this->b.f, (this->b.f & 0x10) | zero(res) | 0x40 | (((v & 0xf) - 1) & 0x10) << 1);
+        return res;
+    }
+
+    Lanes add16(Lanes r1, Lanes r2) {
+        const Lanes res13 = (r1 & 0x0fff) + (r2 & 0x0fff);
+        const Lanes res   = r1 + r2;
+        this->set(this->b.f, (this->b.f & 0x80) | (res13 & 0x1000) >> 7 | (lt(res, r1) & 0x10));
+        return res;
+    }
+
+    Lanes add_sp(uint8_t s8) {
+        const uint16_t u16  = static_cast<uint16_t>(static_cast<int8_t>(s8));
+        const Lanes    sp   = this->b.sp;
+        const Lanes    res5 = (sp & 0x000f) + (u16 & 0x000f);
+        const Lanes    res9 = (sp & 0x00ff) + (u16 & 0x00ff);
+        this->set(this->b.f, (res5 & 0x10) << 1 | (res9 & 0x100) >> 4);
+        return sp + u16;
+    }
+
+    // RLC RRC RL RR SLA SRA SWAP SRL, the accumulator rotates clear Z
+    Lanes shift(int op, Lanes v, bool with_z_flag) {
+        const Lanes carry_in = (this->b.f >> 4) & 1;
+        Lanes       res, carry;
+        switch (op) {
+            case 0:
+                carry = v >> 7;
+                res   = (v << 1 | carry) & 0xff;
+                break;
+            case 1:
+                carry = v & 1;
+                res   = v >> 1 | carry << 7;
+                break;
+            case 2:
+                carry = v >> 7;
+                res   = (v << 1 | carry_in) & 0xff;
+                break;
+            case 3:
+                carry = v & 1;
+                res   = v >> 1 | carry_in << 7;
+                break;
+            case 4:
+                carry = v >> 7;
+                res   = (v << 1) & 0xff;
+                break;
+            case 5:
+                carry = v & 1;
+                res   = (v & 0x80) | v >> 1;
+                break;
+            case 6:
+                carry = Lanes{};
+                res   = (v & 0xf) << 4 | v >> 4;
+                break;
+            default:
+                carry = v & 1;
+                res   = v >> 1;
+                break;
+        }
+        this->set(this->b.f, (with_z_flag ? zero(res) : Lanes{}) | carry << 4);
+        return res;
+    }
+
+    void push(Lanes value, Lanes mask) {
+        const Lanes sp = this->b.sp;
+        this->store(sp - 1, value >> 8, mask);
+        this->store(sp - 2, value & 0xff, mask);
+        this->set(this->b.sp, select(mask, sp - 2, sp));
+    }
+
+    // the fetch finishes the instruction, the lanes sit out its other M-cycles
+    void retire(uint8_t opcode, Lanes n) {
+        this->set(this->b.busy, n - 1);
+        this->set(this->b.opcode, splat<Lanes>(opcode));
+        this->set(this->b.n_instructions, this->b.n_instructions + 1);
+        this->b.n_simd_instructions += std::popcount(this->bits());
+    }
+
+    void retire(uint8_t opcode, uint16_t n) {
+        this->retire(opcode, splat<Lanes>(n));
+    }
+
+    void execute(uint8_t op, uint8_t d1, uint8_t d2);
+    void execute_cb(uint8_t cb);
+};
+
+// Mirrors Cpu::do_tick, see there for the cycle by cycle version. Only the effects of the instructions are
+// applied, including what they leave in tmp1 and tmp2.
+void LockstepBatch::Group::execute(uint8_t op, uint8_t d1, uint8_t d2) {
+    Block         &b     = this->b;
+    Lanes         &a     = b.r[7];
+    const Lanes    pc    = b.pc;
+    const uint16_t a16   = static_cast<uint16_t>(d2) << 8 | d1;
+    const uint16_t rel8  = static_cast<uint16_t>(static_cast<int8_t>(d1));
+    const int      reg   = (op >> 3) & 0x7;
+    const int      pair  = (op >> 4) & 0x3;
+    const Lanes    taken = this->condition((op >> 3) & 0x3);
+
+    if (op >= 0x40 && op < 0x80 && op != 0x76) { // LD r, r'
+        const int src = op & 0x7;
+        if (src == 6) {
+            if (!this->fits(2) || !this->keep(readable(this->get16(2)))) {
+                return;
+            }
+            this->set(b.r[reg], this->load(this->get16(2)));
+            this->retire(op, 2);
+        } else if (reg == 6) {
+            if (!this->fits(2) || !this->keep(this->writable(this->get16(2), 2))) {
+                return;
+            }
+            this->store(this->get16(2), b.r[src]);
+            this->retire(op, 2);
+        } else {
+            if (!this->fits(1)) {
+                return;
+            }
+            this->set(b.r[reg], b.r[src]);
+            this->retire(op, 1);
+        }
+        this->set(b.pc, pc + 1);
+        return;
+    }
+
+    if (op >= 0x80 && op < 0xc0) { // ALU A, r
+        const int src = op & 0x7;
+        if (src == 6) {
+            if (!this->fits(2) || !this->keep(readable(this->get16(2)))) {
+                return;
+            }
+            this->alu(reg, this->load(this->get16(2)));
+            this->retire(op, 2);
+        } else {
+            if (!this->fits(1)) {
+                return;
+            }
+            this->alu(reg, b.r[src]);
+            this->retire(op, 1);
+        }
+        this->set(b.pc, pc + 1);
+        return;
+    }
+
+    switch (op) {
+        case 0x00: // NOP
+            if (!this->fits(1)) {
+                return;
+            }
+            this->set(b.pc, pc + 1);
+            this->retire(op, 1);
+            break;
+
+        case 0x76: // HALT
+            if (!this->fits(1)) {
+                return;
+            }
+            this->set(b.halted, ~Lanes{});
+            this->set(b.pc, pc + 1);
+            this->retire(op, 1);
+            break;
+
+        case 0x27: { // DAA
+            if (!this->fits(1)) {
+                return;
+            }
+            const Lanes n = ne(b.f & 0x40, Lanes{});
+            const Lanes h = ne(b.f & 0x20, Lanes{});
+            const Lanes c = ne(b.f & 0x10, Lanes{});
+
+            Lanes sub_a = select(c, a - 0x60, a);
+            sub_a       = select(h, sub_a - 0x06, sub_a) & 0xff;
+
+            const Lanes adjust = lt(splat<Lanes>(0x99), a);
+            const Lanes carry  = select(n, c, c | adjust);
+            Lanes       add_a  = select(adjust | c, a + 0x60, a) & 0xff;
+            add_a              = select(lt(splat<Lanes>(9), add_a & 0xf) | h, add_a + 6, add_a) & 0xff;
+
+            const Lanes res = select(n, sub_a, add_a);
+            this->set(b.f, zero(res) | (b.f & 0x40) | (carry & 0x10));
+            this->set(a, res);
+            this->set(b.pc, pc + 1);
+            this->retire(op, 1);
+        } break;
+
+        case 0x2F: // CPL
+            if (!this->fits(1)) {
+                return;
+            }
+            this->set(a, ~a & 0xff);
+            this->set(b.f, b.f | 0x60);
+            this->set(b.pc, pc + 1);
+            this->retire(op, 1);
+            break;
+
+        case 0x37: // SCF
+        case 0x3F: // CCF
+            if (!this->fits(1)) {
+                return;
+            }
+            this->set(b.f, (b.f & 0x80) | (op == 0x37 ? splat<Lanes>(0x10) : ~b.f & 0x10));
+            this->set(b.pc, pc + 1);
+            this->retire(op, 1);
+            break;
+
+        case 0x06: // LD r, d8
+        case 0x0E:
+        case 0x16:
+        case 0x1E:
+        case 0x26:
+        case 0x2E:
+        case 0x3E:
+            if (!this->fits(2)) {
+                return;
+            }
+            this->set(b.r[reg], splat<Lanes>(d1));
+            this->set(b.pc, pc + 2);
+            this->retire(op, 2);
+            break;
+
+        case 0x36: // LD (HL), d8
+            if (!this->fits(3) || !this->keep(this->writable(this->get16(2), 3))) {
+                return;
+            }
+            this->store(this->get16(2), splat<Lanes>(d1));
+            this->set(b.tmp1, splat<Lanes>(d1));
+            this->set(b.pc, pc + 2);
+            this->retire(op, 3);
+            break;
+
+        case 0x0A: // LD A, (BC)
+        case 0x1A: // LD A, (DE)
+        case 0x2A: // LD A, (HL+)
+        case 0x3A: // LD A, (HL-)
+        case 0x02: // LD (BC), A
+        case 0x12: // LD (DE), A
+        case 0x22: // LD (HL+), A
+        case 0x32: // LD (HL-), A
+        {
+            const Lanes addr  = this->get16(std::min(pair, 2));
+            const bool  write = (op & 0x08) == 0;
+            if (!this->fits(2) || !this->keep(write ? this->writable(addr, 2) : readable(addr))) {
+                return;
+            }
+            if (write) {
+                this->store(addr, a);
+            } else {
+                this->set(a, this->load(addr));
+            }
+            if (pair >= 2) {
+                this->set16(2, pair == 2 ? addr + 1 : addr - 1);
+            }
+            this->set(b.pc, pc + 1);
+            this->retire(op, 2);
+        } break;
+
+        case 0x01: // LD rr, d16
+        case 0x11:
+        case 0x21:
+        case 0x31:
+            if (!this->fits(3)) {
+                return;
+            }
+            this->set16(pair, splat<Lanes>(a16));
+            this->set(b.tmp1, splat<Lanes>(d1));
+            this->set(b.pc, pc + 3);
+            this->retire(op, 3);
+            break;
+
+        case 0xF9: // LD SP, HL
+            if (!this->fits(2)) {
+                return;
+            }
+            this->set(b.sp, this->get16(2));
+            this->set(b.pc, pc + 1);
+            this->retire(op, 2);
+            break;
+
+        case 0xEA: // LD (a16), A
+        case 0xFA: // LD A, (a16)
+        {
+            const Lanes addr = splat<Lanes>(a16);
+            if (!this->fits(4) || !this->keep(op == 0xEA ? this->writable(addr, 4) : readable(addr))) {
+                return;
+            }
+            if (op == 0xEA) {
+                this->store(addr, a);
+            } else {
+                this->set(a, this->load(addr));
+            }
+            this->set(b.tmp1, splat<Lanes>(d1));
+            this->set(b.tmp2, splat<Lanes>(d2));
+            this->set(b.pc, pc + 3);
+            this->retire(op, 4);
+        } break;
+
+        case 0xE0: // LD (a8), A
+        case 0xE2: // LD (C), A
+        {
+            const uint16_t n    = op == 0xE0 ? 3 : 2;
+            const Lanes    addr = 0xff00 | (op == 0xE0 ? splat<Lanes>(d1) : b.r[1]);
+            if (!this->fits(n) || !this->keep(this->writable(addr, n))) {
+                return;
+            }
+            this->store(addr, a);
+            if (op == 0xE0) {
+                this->set(b.tmp1, splat<Lanes>(d1));
+            }
+            this->set(b.pc, pc + n - 1);
+            this->retire(op, n);
+        } break;
+
+        case 0xF0: // LD A, (a8)
+        case 0xF2: // LD A, (C)
+        {
+            // HRAM is read right away, IO registers in the last M-cycle
+            const uint16_t n    = op == 0xF0 ? 3 : 2;
+            const Lanes    addr = 0xff00 | (op == 0xF0 ? splat<Lanes>(d1) : b.r[1]);
+            const Lanes    hram = readable(addr);
+            Lanes          io{};
+            for (uint32_t bits = to_bits(this->m & ~hram); bits != 0; bits &= bits - 1) {
+                const int i = std::countr_zero(bits);
+                io[i]       = is_simd_readable_io(addr[i] & 0xff) ? 0xffff : 0;
+            }
+            if (!this->fits(n) || !this->keep(hram | io)) {
+                return;
+            }
+            this->set(a, select(hram, this->load(addr), a));
+            this->set(b.pending, select(io, addr, b.pending));
+            if (op == 0xF0) {
+                this->set(b.tmp1, splat<Lanes>(d1));
+            }
+            this->set(b.pc, pc + n - 1);
+            this->retire(op, n);
+        } break;
+
+        case 0xF8: // LD HL, SP+s8
+            if (!this->fits(3)) {
+                return;
+            }
+            this->set16(2, this->add_sp(d1));
+            this->set(b.tmp1, splat<Lanes>(d1));
+            this->set(b.pc, pc + 2);
+            this->retire(op, 3);
+            break;
+
+        case 0x08: { // LD (a16), SP
+            const Lanes addr = splat<Lanes>(a16);
+            if (!this->fits(5) || !this->keep(this->writable(addr, 5) & this->writable(addr + 1, 5))) {
+                return;
+            }
+            this->store(addr, b.sp & 0xff);
+            this->store(addr + 1, b.sp >> 8);
+            this->set(b.tmp1, splat<Lanes>(d1));
+            this->set(b.tmp2, splat<Lanes>(d2));
+            this->set(b.pc, pc + 3);
+            this->retire(op, 5);
+        } break;
+
+        case 0xC1: // POP
+        case 0xD1:
+        case 0xE1:
+        case 0xF1: {
+            const Lanes sp = b.sp;
+            if (!this->fits(3) || !this->keep(readable(sp) & readable(sp + 1))) {
+                return;
+            }
+            const Lanes lsb = this->load(sp);
+            const Lanes msb = this->load(sp + 1);
+            if (pair == 3) {
+                this->set(a, msb);
+                this->set(b.f, lsb & 0xf0);
+            } else {
+                this->set16(pair, msb << 8 | lsb);
+            }
+            this->set(b.sp, sp + 2);
+            this->set(b.tmp1, lsb);
+            this->set(b.tmp2, msb);
+            this->set(b.pc, pc + 1);
+            this->retire(op, 3);
+        } break;
+
+        case 0xC5: // PUSH
+        case 0xD5:
+        case 0xE5:
+        case 0xF5: {
+            const Lanes sp = b.sp;
+            if (!this->fits(4) || !this->keep(this->writable(sp - 1, 4) & this->writable(sp - 2, 4))) {
+                return;
+            }
+            this->push(pair == 3 ? a << 8 | b.f : this->get16(pair), this->m);
+            this->set(b.pc, pc + 1);
+            this->retire(op, 4);
+        } break;
+
+        case 0x07: // RLCA
+        case 0x0F: // RRCA
+        case 0x17: // RLA
+        case 0x1F: // RRA
+            if (!this->fits(1)) {
+                return;
+            }
+            this->set(a, this->shift(reg, a, false));
+            this->set(b.pc, pc + 1);
+            this->retire(op, 1);
+            break;
+
+        case 0xC6: // ALU A, d8
+        case 0xCE:
+        case 0xD6:
+        case 0xDE:
+        case 0xE6:
+        case 0xEE:
+        case 0xF6:
+        case 0xFE:
+            if (!this->fits(2)) {
+                return;
+            }
+            this->alu(reg, splat<Lanes>(d1));
+            this->set(b.pc, pc + 2);
+            this->retire(op, 2);
+            break;
+
+        case 0x04: // INC r
+        case 0x0C:
+        case 0x14:
+        case 0x1C:
+        case 0x24:
+        case 0x2C:
+        case 0x3C:
+        case 0x05: // DEC r
+        case 0x0D:
+        case 0x15:
+        case 0x1D:
+        case 0x25:
+        case 0x2D:
+        case 0x3D:
+            if (!this->fits(1)) {
+                return;
+            }
+            this->set(b.r[reg], op & 1 ? this->dec(b.r[reg]) : this->inc(b.r[reg]));
+            this->set(b.pc, pc + 1);
+            this->retire(op, 1);
+            break;
+
+        case 0x34: // INC (HL)
+        case 0x35: // DEC (HL)
+        {
+            const Lanes hl = this->get16(2);
+            if (!this->fits(3) || !this->keep(this->writable(hl, 3))) {
+                return;
+            }
+            const Lanes old = this->load(hl);
+            this->store(hl, op & 1 ? this->dec(old) : this->inc(old));
+            this->set(b.tmp1, old);
+            this->set(b.pc, pc + 1);
+            this->retire(op, 3);
+        } break;
+
+        case 0x03: // INC rr
+        case 0x13:
+        case 0x23:
+        case 0x33:
+        case 0x0B: // DEC rr
+        case 0x1B:
+        case 0x2B:
+        case 0x3B:
+            if (!this->fits(2)) {
+                return;
+            }
+            this->set16(pair, op & 0x08 ? this->get16(pair) - 1 : this->get16(pair) + 1);
+            this->set(b.pc, pc + 1);
+            this->retire(op, 2);
+            break;
+
+        case 0x09: // ADD HL, rr
+        case 0x19:
+        case 0x29:
+        case 0x39:
+            if (!this->fits(2)) {
+                return;
+            }
+            this->set16(2, this->add16(this->get16(2), this->get16(pair)));
+            this->set(b.pc, pc + 1);
+            this->retire(op, 2);
+            break;
+
+        case 0xE8: // ADD SP, s8
+            if (!this->fits(4)) {
+                return;
+            }
+            this->set(b.sp, this->add_sp(d1));
+            this->set(b.tmp1, splat<Lanes>(d1));
+            this->set(b.pc, pc + 2);
+            this->retire(op, 4);
+            break;
+
+        case 0x18: // JR s8
+            if (!this->fits(3)) {
+                return;
+            }
+            this->set(b.tmp1, splat<Lanes>(d1));
+            this->set(b.pc, pc + 2 + rel8);
+            this->retire(op, 3);
+            break;
+
+        case 0x20: // JR cc, s8
+        case 0x28:
+        case 0x30:
+        case 0x38: {
+            const Lanes n = select(taken, splat<Lanes>(3), splat<Lanes>(2));
+            if (!this->fits(n)) {
+                return;
+            }
+            this->set(b.tmp1, select(taken, splat<Lanes>(d1), b.tmp1));
+            this->set(b.pc, pc + 2 + (taken & rel8));
+            this->retire(op, n);
+        } break;
+
+        case 0xE9: // JP HL
+            if (!this->fits(1)) {
+                return;
+            }
+            this->set(b.pc, this->get16(2));
+            this->retire(op, 1);
+            break;
+
+        case 0xC3: // JP a16
+        case 0xC2: // JP cc, a16
+        case 0xCA:
+        case 0xD2:
+        case 0xDA: {
+            const Lanes jump = op == 0xC3 ? ~Lanes{} : taken;
+            const Lanes n    = select(jump, splat<Lanes>(4), splat<Lanes>(3));
+            if (!this->fits(n)) {
+                return;
+            }
+            this->set(b.tmp1, splat<Lanes>(d1));
+            this->set(b.tmp2, splat<Lanes>(d2));
+            this->set(b.pc, select(jump, splat<Lanes>(a16), pc + 3));
+            this->retire(op, n);
+        } break;
+
+        case 0xCD: // CALL a16
+        case 0xC4: // CALL cc, a16
+        case 0xCC:
+        case 0xD4:
+        case 0xDC: {
+            const Lanes call = op == 0xCD ? ~Lanes{} : taken;
+            const Lanes n    = select(call, splat<Lanes>(6), splat<Lanes>(3));
+            if (!this->fits(n) ||
+                !this->keep(~call | (this->writable(b.sp - 1, 6) & this->writable(b.sp - 2, 6)))) {
+                return;
+            }
+            this->push(pc + 3, call);
+            this->set(b.tmp1, splat<Lanes>(d1));
+            this->set(b.tmp2, splat<Lanes>(d2));
+            this->set(b.pc, select(call, splat<Lanes>(a16), pc + 3));
+            this->retire(op, n);
+        } break;
+
+        case 0xC7: // RST n
+        case 0xCF:
+        case 0xD7:
+        case 0xDF:
+        case 0xE7:
+        case 0xEF:
+        case 0xF7:
+        case 0xFF:
+            if (!this->fits(4) || !this->keep(this->writable(b.sp - 1, 4) & this->writable(b.sp - 2, 4))) {
+                return;
+            }
+            this->push(pc + 1, this->m);
+            this->set(b.tmp1, splat<Lanes>(reg));
+            this->set(b.pc, splat<Lanes>(8 * reg));
+            this->retire(op, 4);
+            break;
+
+        case 0xC9: // RET
+        case 0xD9: // RETI
+        case 0xC0: // RET cc
+        case 0xC8:
+        case 0xD0:
+        case 0xD8: {
+            const bool  always = op & 0x01;
+            const Lanes ret    = always ? ~Lanes{} : taken;
+            const Lanes n      = select(ret, splat<Lanes>(always ? 4 : 5), splat<Lanes>(2));
+            const Lanes sp     = b.sp;
+            if (!this->fits(n) || !this->keep(~ret | (readable(sp) & readable(sp + 1)))) {
+                return;
+            }
+            const Lanes saved = this->m;
+            this->m &= ret;
+            const Lanes lsb = this->load(sp);
+            const Lanes msb = this->load(sp + 1);
+            this->set(b.tmp1, lsb);
+            this->set(b.tmp2, msb);
+            this->set(b.sp, sp + 2);
+            this->m = saved;
+            this->set(b.pc, select(ret, msb << 8 | lsb, pc + 1));
+            if (op == 0xD9) {
+                this->set(b.ime, ~Lanes{});
+            }
+            this->retire(op, n);
+        } break;
+
+        case 0xF3: // DI
+        case 0xFB: // EI
+            if (!this->fits(1)) {
+                return;
+            }
+            this->set(b.ime, op == 0xFB ? ~Lanes{} : Lanes{});
+            this->set(b.pc, pc + 1);
+            this->retire(op, 1);
+            break;
+
+        case 0xCB:
+            this->execute_cb(d1);
+            break;
+
+        default: // STOP and the unused opcodes, which stop the emulation
+            this->keep(Lanes{});
+            break;
+    }
+}
+
+void LockstepBatch::Group::execute_cb(uint8_t cb) {
+    Block         &b        = this->b;
+    const int      op       = cb >> 6;
+    const int      reg      = cb & 0x7;
+    const uint16_t bit_mask = 1 << ((cb >> 3) & 0x7);
+    const Lanes    hl       = this->get16(2);
+
+    // BIT b, (HL) only reads
+    const uint16_t n = reg != 6 ? 2 : op == 1 ? 3 : 4;
+    if (!this->fits(n) || (reg == 6 && !this->keep(op == 1 ? readable(hl) : this->writable(hl, n)))) {
+        return;
+    }
+
+    const Lanes v = reg == 6 ? this->load(hl) : b.r[reg];
+    Lanes       res;
+    switch (op) {
+        case 0:
+            res = this->shift((cb >> 3) & 0x7, v, true);
+            break;
+        case 1:
+            this->set(b.f, (b.f & 0x10) | 0x20 | zero(v & bit_mask));
+            res = v;
+            break;
+        case 2:
+            res = v & static_cast<uint16_t>(~bit_mask & 0xff);
+            break;
+        default:
+            res = v | bit_mask;
+            break;
+    }
+
+    if (reg != 6) {
+        this->set(b.r[reg], res);
+    } else if (op != 1) {
+        this->store(hl, res);
+        this->set(b.tmp2, v);
+    }
+    this->set(b.tmp1, splat<Lanes>(cb));
+    this->set(b.pc, b.pc + 2);
+    this->retire(0xCB, n);
+}
+
+LockstepBatch::LockstepBatch(RomHandle rom, int n_lanes, int n_threads)
+    : pristine(std::move(rom)),
+      pool(n_threads) {
+
+    this->pristine.reset();
+
+    for (int lane = 0; lane < n_lanes; lane++) {
+        this->machines.push_back(this->pristine.clone());
+    }
+    this->blocks.resize((n_lanes + LANE_WIDTH - 1) / LANE_WIDTH);
+    for (size_t k = 0; k < this->blocks.size(); k++) {
+        Block &b  = this->blocks[k];
+        b.n_lanes = std::min(LANE_WIDTH, n_lanes - static_cast<int>(k) * LANE_WIDTH);
+        for (int i = 0; i < b.n_lanes; i++) {
+            b.lanes[i] = this->machines[k * LANE_WIDTH + i].get();
+        }
+    }
+}
+
+void LockstepBatch::reset_lane(int lane) {
+    Gameboy      &gb      = *this->machines[lane];
+    const uint8_t buttons = gb.get_button_mask();
+    gb                    = this->pristine;
+    gb.set_button_mask(buttons);
+}
+
+uint64_t LockstepBatch::get_simd_instruction_count() const {
+    uint64_t n = 0;
+    for (const Block &b : this->blocks) {
+        n += b.n_simd_instructions;
+    }
+    return n;
+}
+
+void LockstepBatch::run_frame() {
+    this->pool.run(this->blocks.size(), [this](size_t job, int) { this->run_block(this->blocks[job]); });
+}
+
+// a lane can join the SIMD lanes between instructions, at the start of an M-cycle and while no OAM DMA runs
+bool LockstepBatch::at_simd_boundary(const Gameboy &gb) {
+    return gb.get_clock() % 4 == 0 && gb.get_cpu_registers().pc < 0x8000 - 2 && gb.cpu.at_instruction_boundary() &&
+           !gb.ppu.dma_is_active();
+}
+
+void LockstepBatch::run_block(Block &b) {
+    b.simd           = Lanes{};
+    b.scalar         = 0;
+    b.next_sequencer = M_CYCLES_PER_FRAME;
+    for (int i = 0; i < b.n_lanes; i++) {
+        b.start_clock[i] = b.lanes[i]->clock;
+        if (at_simd_boundary(*b.lanes[i])) {
+            this->load_lane(b, i);
+        } else {
+            b.scalar |= 1u << i;
+        }
+    }
+
+    for (uint32_t m = 0; m < M_CYCLES_PER_FRAME; m++) {
+        if (to_bits(b.simd) != 0) {
+            // the timer counts after the first dot, a HALT ends before each of the other dots
+            this->step_cpu(b, m);
+            this->tick_lcd(b);
+            this->tick_timer(b);
+            for (int dot = 1; dot < 4; dot++) {
+                b.halted &= eq(b.if_reg & b.ie_reg, Lanes{});
+                this->tick_lcd(b);
+            }
+            if (m >= b.next_sequencer) {
+                this->step_frame_sequencers(b, m);
+            }
+        }
+        b.clock += 4;
+
+        for (uint32_t bits = b.scalar; bits != 0; bits &= bits - 1) {
+            const int i  = std::countr_zero(bits);
+            Gameboy  &gb = *b.lanes[i];
+            for (int clock = 0; clock < 4; clock++) {
+                gb.do_tick();
+            }
+            if (m + 1 < M_CYCLES_PER_FRAME && at_simd_boundary(gb)) {
+                this->load_lane(b, i);
+            }
+        }
+    }
+
+    for (uint32_t bits = to_bits(b.simd); bits != 0; bits &= bits - 1) {
+        this->store_lane(b, std::countr_zero(bits), M_CYCLES_PER_FRAME);
+    }
+}
+
+void LockstepBatch::step_cpu(Block &b, uint32_t m) {
+    // any pending interrupt ends a HALT, enabled or not
+    const Lanes interrupts = ne(b.if_reg & b.ie_reg, Lanes{});
+    b.halted &= ~interrupts;
+
+    const Lanes running = b.simd & ne(b.busy, Lanes{});
+    for (uint32_t bits = to_bits(running & eq(b.busy, splat<Lanes>(1)) & ne(b.pending, Lanes{})); bits != 0;
+         bits &= bits - 1) {
+        const int i  = std::countr_zero(bits);
+        b.r[7][i]    = this->read_io(b, i, b.pending[i]);
+        b.pending[i] = 0;
+    }
+    b.busy -= running & 1;
+
+    // the Cpu of the lane dispatches interrupts
+    const Lanes ready    = b.simd & ~b.halted & ~running;
+    const Lanes dispatch = ready & b.ime & interrupts;
+    uint32_t    kicked   = to_bits(dispatch);
+
+    // Lanes fetching from the same PC and ROM bank form a group, which is executed under its lane mask. A
+    // group only takes lanes that have not fetched yet, a jump can land a lane on the PC of a later group.
+    Lanes todo = ready & ~dispatch;
+    while (to_bits(todo) != 0) {
+        const int      leader = std::countr_zero(to_bits(todo));
+        const uint16_t pc     = b.pc[leader];
+        Lanes          lanes  = todo & eq(b.pc, splat<Lanes>(pc));
+        if (pc < 0x4000) {
+            lanes &= eq(b.bank0, splat<Lanes>(b.bank0[leader]));
+        }
+        if (pc >= 0x4000 - 2) {
+            lanes &= eq(b.bank, splat<Lanes>(b.bank[leader]));
+        }
+        todo &= ~lanes;
+
+        // code in RAM differs between the lanes
+        if (pc >= 0x8000 - 2) {
+            kicked |= to_bits(lanes);
+            continue;
+        }
+        const Gameboy &gb = *b.lanes[leader];
+        Group          group{b, lanes, M_CYCLES_PER_FRAME - m};
+        group.execute(gb.peek(pc), gb.peek(pc + 1), gb.peek(pc + 2));
+        kicked |= group.kicked;
+    }
+
+    for (; kicked != 0; kicked &= kicked - 1) {
+        const int i = std::countr_zero(kicked);
+        this->store_lane(b, i, m);
+        b.scalar |= 1u << i;
+    }
+}
+
+// Ppu::do_tick without the drawing, which is left to the Ppu of the lane
+void LockstepBatch::tick_lcd(Block &b) {
+    const Lanes on = b.simd & ne(b.lcdc & 0x80, Lanes{});
+
+    b.lx                 = select(on, b.lx + 1, b.lx);
+    b.lx                 = select(eq(b.lx, splat<Lanes>(456)), Lanes{}, b.lx);
+    const Lanes new_line = on & eq(b.lx, Lanes{});
+    b.ly                 = select(new_line, b.ly + 1, b.ly);
+    b.ly                 = select(eq(b.ly, splat<Lanes>(154)), Lanes{}, b.ly);
+
+    const Lanes visible = lt(b.ly, splat<Lanes>(LCD_HEIGHT));
+    const Lanes vblank  = new_line & eq(b.ly, splat<Lanes>(LCD_HEIGHT));
+    b.mode              = select(new_line & visible, splat<Lanes>(2), b.mode);
+    b.mode              = select(on & visible & eq(b.lx, splat<Lanes>(80)), splat<Lanes>(3), b.mode);
+    b.mode              = select(vblank, splat<Lanes>(1), b.mode);
+    b.if_reg |= vblank & 0x01;
+
+    const Lanes lyc_ly = eq(b.ly, b.lyc);
+    const Lanes line   = (eq(b.mode, splat<Lanes>(0)) & ne(b.stat & 0x08, Lanes{})) |
+                       (eq(b.mode, splat<Lanes>(1)) & ne(b.stat & 0x10, Lanes{})) |
+                       (eq(b.mode, splat<Lanes>(2)) & ne(b.stat & 0x20, Lanes{})) |
+                       (lyc_ly & ne(b.stat & 0x40, Lanes{}));
+    b.if_reg |= on & line & ~b.stat_line & 0x02;
+    b.stat_line = select(on, line, b.stat_line);
+    b.stat      = select(on, (b.stat & 0xf8) | (lyc_ly & 0x04) | b.mode, b.stat);
+
+    const Lanes drawing = on & eq(b.mode, splat<Lanes>(3));
+    for (uint32_t bits = to_bits(drawing & eq(b.lx, splat<Lanes>(90))); bits != 0; bits &= bits - 1) {
+        const int i  = std::countr_zero(bits);
+        Gameboy  &gb = *b.lanes[i];
+        gb.ppu.ly    = b.ly[i];
+        gb.ppu.lx    = 90;
+        gb.ppu.render_line(gb.pixel_buffer, gb.bus);
+    }
+    b.mode = select(drawing & eq(b.lx, splat<Lanes>(250)), Lanes{}, b.mode);
+}
+
+// DivTimer::do_tick for the first clock of an M-cycle, the only one of the four that can count
+void LockstepBatch::tick_timer(Block &b) {
+    b.div              = (b.div + (eq(b.clock & 0xff, Lanes{}) & 1)) & 0xff;
+    const Lanes count  = b.timer_on & eq(b.clock & b.timer_mask, Lanes{});
+    b.tima += count & 1;
+    const Lanes overflow = count & eq(b.tima, splat<Lanes>(0x100));
+    b.tima               = select(overflow, b.tma, b.tima);
+    b.if_reg |= overflow & 0x04;
+}
+
+void LockstepBatch::step_frame_sequencers(Block &b, uint32_t m) {
+    b.next_sequencer = M_CYCLES_PER_FRAME;
+    for (uint32_t bits = to_bits(b.simd); bits != 0; bits &= bits - 1) {
+        const int i  = std::countr_zero(bits);
+        Gameboy  &gb = *b.lanes[i];
+        if (gb.next_frame_sequencer_clock == b.start_clock[i] + 4 * m) {
+            gb.sound.step_frame_sequencer();
+            gb.next_frame_sequencer_clock += gb_sound::FRAME_SEQUENCER_PERIOD;
+        }
+        b.next_sequencer =
+            std::min<uint64_t>(b.next_sequencer, (gb.next_frame_sequencer_clock - b.start_clock[i]) / 4);
+    }
+}
+
+// the counters held in SIMD lanes, and the other registers from the components of the lane
+uint8_t LockstepBatch::read_io(const Block &b, int i, uint16_t addr) const {
+    const Gameboy &gb = *b.lanes[i];
+    switch (addr & 0xff) {
+        case 0x04:
+            return b.div[i];
+        case 0x05:
+            return b.tima[i];
+        case 0x0f:
+            return b.if_reg[i];
+        case 0x41:
+            return b.stat[i];
+        case 0x44:
+            return b.ly[i];
+        default:
+            return gb.peek(addr);
+    }
+}
+
+void LockstepBatch::load_lane(Block &b, int i) {
+    const Gameboy &gb  = *b.lanes[i];
+    const Cpu     &cpu = gb.cpu;
+
+    b.r[0][i]           = cpu.bc.r8.hi;
+    b.r[1][i]           = cpu.bc.r8.lo;
+    b.r[2][i]           = cpu.de.r8.hi;
+    b.r[3][i]           = cpu.de.r8.lo;
+    b.r[4][i]           = cpu.hl.r8.hi;
+    b.r[5][i]           = cpu.hl.r8.lo;
+    b.r[7][i]           = cpu.a;
+    b.f[i]              = cpu.f();
+    b.sp[i]             = cpu.sp;
+    b.pc[i]             = cpu.pc;
+    b.ime[i]            = cpu.ime ? 0xffff : 0;
+    b.halted[i]         = cpu.halted ? 0xffff : 0;
+    b.busy[i]           = 0;
+    b.pending[i]        = 0;
+    b.opcode[i]         = cpu.opcode;
+    b.tmp1[i]           = cpu.tmp1;
+    b.tmp2[i]           = cpu.tmp2;
+    b.n_instructions[i] = 0;
+
+    b.div[i]        = gb.div_timer.div;
+    b.tima[i]       = gb.div_timer.timer;
+    b.tma[i]        = gb.div_timer.timer_modulo;
+    b.timer_on[i]   = gb.div_timer.timer_enable ? 0xffff : 0;
+    b.timer_mask[i] = DivTimer::DIVISORS[gb.div_timer.clock_select] - 1;
+    b.if_reg[i]     = gb.interrupt_state.if_reg;
+    b.ie_reg[i]     = gb.interrupt_state.ie_reg;
+
+    // lx starts out at ~0u, which is kept as 0xffff and wraps to 0 at the first dot as well
+    b.lcdc[i]      = gb.ppu.lcdc;
+    b.stat[i]      = gb.ppu.stat;
+    b.ly[i]        = gb.ppu.ly;
+    b.lyc[i]       = gb.ppu.lyc;
+    b.lx[i]        = gb.ppu.lx;
+    b.mode[i]      = gb.ppu.mode;
+    b.stat_line[i] = gb.ppu.prev_stat_interrupt_line ? 0xffff : 0;
+
+    b.clock[i] = gb.clock;
+    b.bank0[i] = gb.bus.get_rom_bank(0x0000);
+    b.bank[i]  = gb.bus.get_rom_bank(0x4000);
+    b.simd[i]  = 0xffff;
+    b.scalar &= ~(1u << i);
+    b.next_sequencer =
+        std::min<uint64_t>(b.next_sequencer, (gb.next_frame_sequencer_clock - b.start_clock[i]) / 4);
+}
+
+void LockstepBatch::store_lane(Block &b, int i, uint32_t m) {
+    Gameboy &gb  = *b.lanes[i];
+    Cpu     &cpu = gb.cpu;
+
+    cpu.bc.r8.hi = b.r[0][i];
+    cpu.bc.r8.lo = b.r[1][i];
+    cpu.de.r8.hi = b.r[2][i];
+    cpu.de.r8.lo = b.r[3][i];
+    cpu.hl.r8.hi = b.r[4][i];
+    cpu.hl.r8.lo = b.r[5][i];
+    cpu.a        = b.r[7][i];
+    cpu.set_f(b.f[i]);
+    cpu.sp     = b.sp[i];
+    cpu.pc     = b.pc[i];
+    cpu.ime    = b.ime[i];
+    cpu.halted = b.halted[i];
+    cpu.opcode = b.opcode[i];
+    cpu.tmp1   = b.tmp1[i];
+    cpu.tmp2   = b.tmp2[i];
+    cpu.n_instructions += b.n_instructions[i];
+
+    gb.div_timer.div                = b.div[i];
+    gb.div_timer.timer              = b.tima[i];
+    gb.interrupt_state.if_reg       = b.if_reg[i];
+    gb.ppu.stat                     = b.stat[i];
+    gb.ppu.ly                       = b.ly[i];
+    gb.ppu.lx                       = b.lx[i] == 0xffff ? ~0u : b.lx[i];
+    gb.ppu.mode                     = b.mode[i];
+    gb.ppu.prev_stat_interrupt_line = b.stat_line[i];
+
+    gb.clock  = b.start_clock[i] + 4 * m;
+    b.simd[i] = 0;
+}
@@ -0,0 +1,113 @@
+#ifndef LOCKSTEP_BATCH_H
+#define LOCKSTEP_BATCH_H
+
+#include "gameboy.h"
+#include "work_pool.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Runs many copies ("lanes") of the same game frame by frame in lockstep, each lane with its own inputs.
+//
+// Lanes are grouped into blocks of LANE_WIDTH. A block holds the CPU registers and flags, the timer, the
+// interrupt flags and the LCD counters of its lanes in structure-of-arrays layout, one SIMD register per
+// field with one element per lane. The block advances all its lanes one M-cycle at a time: lanes that fetch
+// at the same PC (in the same ROM bank) execute the instruction together under a lane mask, and the timer
+// and the LCD counters of all lanes are ticked together. Each lane still owns a Gameboy, which holds the
+// memories, the mapper and the sound, draws the LCD lines and serves as the scalar fallback.
+//
+// An instruction runs in SIMD lanes in the M-cycle of its fetch, its register and memory effects all at
+// once, and the lanes then wait out its remaining M-cycles. Only what cannot be observed early qualifies:
+// code in ROM, memory accesses to ROM, WRAM and HRAM, to VRAM and OAM while the line the writes could show
+// up in is not drawn, and LDH reads of IO registers, which are delayed to the M-cycle of the read. A lane
+// is handed to its Gameboy for everything else (IO writes, OAM DMA, interrupt dispatch, cartridge RAM,
+// instructions that would end after the frame), and taken back at the next instruction boundary.
+//
+// Between frames the Gameboys hold the complete state, and every lane is bit for bit the machine it would
+// be if it had been run on its own.
+class LockstepBatch {
+public:
+    // lanes per block, eight 16 bit fields fill one 128 bit register of the baseline x86-64 and ARM targets
+    static constexpr int LANE_WIDTH = 8;
+
+    LockstepBatch(RomHandle rom, int n_lanes, int n_threads = 1);
+
+    int get_n_lanes() const {
+        return static_cast<int>(this->machines.size());
+    }
+
+    // input used by `lane` from the next frame on, see Gameboy::set_button_mask
+    void set_button_mask(int lane, uint8_t mask) {
+        this->machines[lane]->set_button_mask(mask);
+    }
+
+    // puts `lane` back into the state right after power on, keeping its buttons
+    void reset_lane(int lane);
+
+    // advances every lane by one LCD frame
+    void run_frame();
+
+    const Gameboy &get_machine(int lane) const {
+        return *this->machines[lane];
+    }
+
+    const PixelBuffer &get_pixel_buffer(int lane) const {
+        return this->machines[lane]->get_pixel_buffer();
+    }
+
+    // instructions executed in SIMD lanes so far, the others ran on the Cpu of their lane
+    uint64_t get_simd_instruction_count() const;
+
+private:
+    // one field of LANE_WIDTH lanes, 8 bit fields are zero extended, masks are 0 or 0xffff
+    typedef uint16_t Lanes __attribute__((vector_size(2 * LANE_WIDTH)));
+
+    struct Block {
+        // B C D E H L (HL) A in the order of the opcode encoding, (HL) holds the memory operand
+        Lanes r[8];
+        Lanes f, sp, pc;
+        Lanes ime, halted;
+        Lanes busy;    // M-cycles left of the instruction, which has already been executed
+        Lanes pending; // IO register read in the last of these M-cycles, 0 for none
+        Lanes opcode, tmp1, tmp2;
+        Lanes n_instructions;
+
+        Lanes div, tima, tma, timer_on, timer_mask;
+        Lanes if_reg, ie_reg;
+        Lanes lcdc, stat, ly, lyc, lx, mode, stat_line;
+
+        Lanes clock; // low bits of the clock, all timer periods divide 2^16
+        Lanes bank0; // ROM bank mapped at $0000
+        Lanes bank;  // ROM bank mapped at $4000
+        Lanes simd;  // lanes run in this block, the others run on their Gameboy or do not exist
+
+        Gameboy *lanes[LANE_WIDTH];
+        uint64_t start_clock[LANE_WIDTH]; // clock of each lane at the start of the frame
+        int      n_lanes{0};
+        uint32_t scalar{0};          // lanes running on their Gameboy
+        uint32_t next_sequencer{0};  // M-cycle of the next frame sequencer step of a SIMD lane
+        uint64_t n_simd_instructions{0};
+    };
+
+    struct Group;
+
+    void run_block(Block &b);
+    void step_cpu(Block &b, uint32_t m);
+    void tick_lcd(Block &b);
+    void tick_timer(Block &b);
+    void step_frame_sequencers(Block &b, uint32_t m);
+
+    static bool at_simd_boundary(const Gameboy &gb);
+
+    void    load_lane(Block &b, int i);
+    void    store_lane(Block &b, int i, uint32_t m);
+    uint8_t read_io(const Block &b, int i, uint16_t addr) const;
+
+    Gameboy                               pristine;
+    std::vector<std::unique_ptr<Gameboy>> machines;
+    std::vector<Block>                    blocks;
+    WorkPool                              pool;
+};
+
+#endif /* LOCKSTEP_BATCH_H */
@@ -0,0 +1,177 @@
+#include "mbc.h"
+
+#include "logging.h"
+
+#include <ctime>
+
+constexpr uint64_t CYCLES_PER_SECOND = 1 << 22;
+constexpr uint64_t SECONDS_PER_DAY   = 24 * 60 * 60;
+
+BankMapping NullMbc::write_mbc(uint16_t addr, uint8_t data, uint64_t /* clock */) {
+    logging::warning("Invalid write to NullMc of ${:02X} at ${:04X}", data, addr);
+    return this->mapping();
+}
+
+BankMapping NullMbc::mapping() const {
+    return this->map_banks(1, -1);
+}
+
+BankMapping Mbc1::write_mbc(uint16_t addr, uint8_t data, uint64_t /* clock */) {
+    if (addr < 0x2000) {
+        this->ram_enabled = this->has_ram() && (data & 0x0f) == 0x0a;
+    } else if (addr < 0x4000) {
+        const uint8_t val       = data & 0x1f;
+        const uint8_t bank_5lsb = (val == 0) ? 1 : val;
+        this->rom_bank          = (this->rom_bank & (~0x1f)) | bank_5lsb;
+    } else if (addr < 0x6000) {
+        if (this->bank_mode == BankMode::RAM_BANKING) {
+            this->ram_bank = 0x3 & data;
+        } else {
+            this->rom_bank = ((0x3 & data) << 5) | (this->rom_bank & 0x1f);
+        }
+    } else if (addr < 0x8000) {
+        this->bank_mode = static_cast<BankMode>(0x01 & data);
+    }
+
+    return this->mapping();
+}
+
+BankMapping Mbc1::mapping() const {
+    // TODO: in ROM banking mode, does the RAM still get banked??
+    const int mapped_ram_bank = this->bank_mode == BankMode::RAM_BANKING ? this->ram_bank : 0;
+    return this->map_banks(this->rom_bank, this->ram_enabled ? mapped_ram_bank : -1);
+}
+
+BankMapping Mbc3::write_mbc(uint16_t addr, uint8_t data, uint64_t clock) {
+    if (addr < 0x2000) {
+        // enables both RAM and the RTC registers
+        this->ram_enabled = (this->has_ram() || this->has_rtc) && (data & 0x0f) == 0x0a;
+    } else if (addr < 0x4000) {
+        const uint8_t val = data & 0x7f;
+        this->rom_bank    = (val == 0) ? 1 : val;
+    } else if (addr < 0x6000) {
+        // 0x0-0x3 select a RAM bank, 0x8-0xC an RTC register
+        this->ram_bank = 0xf & data;
+    } else if (addr < 0x8000) {
+        // writing 0x00 and then 0x01 latches the current time into the RTC registers
+        if (this->has_rtc && this->rtc_latch_prev == 0x00 && data == 0x01) {
+            this->get_rtc_regs(this->rtc_latched, clock);
+        }
+        this->rtc_latch_prev = data;
+    }
+
+    return this->mapping();
+}
+
+BankMapping Mbc3::mapping() const {
+    if (this->ram_enabled && this->has_rtc && this->ram_bank >= 0x8 && this->ram_bank <= 0xc) {
+        BankMapping mapping = this->map_banks(this->rom_bank, -1);
+        mapping.ram_offset  = BankMapping::RTC_MAPPED;
+        return mapping;
+    }
+    const bool ram_mapped = this->ram_enabled && this->ram_bank < 0x4;
+    return this->map_banks(this->rom_bank, ram_mapped ? this->ram_bank : -1);
+}
+
+uint8_t Mbc3::read_rtc() const {
+    return this->rtc_latched[this->ram_bank - 0x8];
+}
+
+void Mbc3::write_rtc(uint8_t data, uint64_t clock) {
+    uint8_t regs[N_RTC_REGS];
+    this->get_rtc_regs(regs, clock);
+    regs[this->ram_bank - 0x8] = data;
+    this->set_rtc_regs(regs, clock);
+
+    // the written value reads back without latching again
+    this->rtc_latched[this->ram_bank - 0x8] = data;
+}
+
+void Mbc3::get_rtc_regs(uint8_t *regs, uint64_t clock) const {
+    uint64_t seconds = this->rtc_base_seconds;
+    if (!this->rtc_halted) {
+        seconds += (clock - this->rtc_base_clock) / CYCLES_PER_SECOND;
+    }
+
+    const uint64_t days = seconds / SECONDS_PER_DAY;
+    const bool     carry = this->rtc_day_carry || days >= 512;
+
+    regs[RTC_S]  = seconds % 60;
+    regs[RTC_M]  = (seconds / 60) % 60;
+    regs[RTC_H]  = (seconds / 3600) % 24;
+    regs[RTC_DL] = days & 0xff;
+    regs[RTC_DH] = ((days >> 8) & 0x01) | (this->rtc_halted ? 0x40 : 0x00) | (carry ? 0x80 : 0x00);
+}
+
+void Mbc3::set_rtc_regs(const uint8_t *regs, uint64_t clock) {
+    const uint64_t days = regs[RTC_DL] | ((regs[RTC_DH] & 0x01) << 8);
+
+    this->rtc_base_seconds = days * SECONDS_PER_DAY + (regs[RTC_H] & 0x1f) * 3600 + (regs[RTC_M] & 0x3f) * 60 +
+                             (regs[RTC_S] & 0x3f);
+    this->rtc_base_clock   = clock;
+    this->rtc_halted       = (regs[RTC_DH] & 0x40) != 0;
+    this->rtc_day_carry    = (regs[RTC_DH] & 0x80) != 0;
+}
+
+static void put_u32(uint8_t *out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (v >> (8 * i)) & 0xff;
+    }
+}
+
+static uint64_t get_u64(const uint8_t *in) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | in[i];
+    }
+    return v;
+}
+
+void Mbc3::save_rtc(uint8_t *out, uint64_t clock) const {
+    // 5 current and 5 latched registers as 32 bit values, followed by the 64 bit host time of the save
+    uint8_t regs[N_RTC_REGS];
+    this->get_rtc_regs(regs, clock);
+    for (int i = 0; i < N_RTC_REGS; i++) {
+        put_u32(out + 4 * i, regs[i]);
+        put_u32(out + 4 * (N_RTC_REGS + i), this->rtc_latched[i]);
+    }
+
+    const uint64_t now = std::time(nullptr);
+    put_u32(out + 40, now & 0xffffffff);
+    put_u32(out + 44, now >> 32);
+}
+
+void Mbc3::load_rtc(const uint8_t *in, uint64_t clock) {
+    uint8_t regs[N_RTC_REGS];
+    for (int i = 0; i < N_RTC_REGS; i++) {
+        regs[i]              = in[4 * i];
+        this->rtc_latched[i] = in[4 * (N_RTC_REGS + i)];
+    }
+    this->set_rtc_regs(regs, clock);
+
+    // the clock kept running while the emulator was not
+    const uint64_t saved_at = get_u64(in + 40);
+    const uint64_t now      = std::time(nullptr);
+    if (!this->rtc_halted && saved_at != 0 && now > saved_at) {
+        this->rtc_base_seconds += now - saved_at;
+    }
+}
+
+BankMapping Mbc5::write_mbc(uint16_t addr, uint8_t data, uint64_t /* clock */) {
+    if (addr < 0x2000) {
+        this->ram_enabled = this->has_ram() && (data & 0x0f) == 0x0a;
+    } else if (addr < 0x3000) {
+        // lower 8 bits of the 9 bit ROM bank, bank 0 is selectable on MBC5
+        this->rom_bank = (this->rom_bank & 0x100) | data;
+    } else if (addr < 0x4000) {
+        this->rom_bank = (static_cast<int>(data & 0x1) << 8) | (this->rom_bank & 0xff);
+    } else if (addr < 0x6000) {
+        this->ram_bank = 0xf & data;
+    }
+
+    return this->mapping();
+}
+
+BankMapping Mbc5::mapping() const {
+    return this->map_banks(this->rom_bank, this->ram_enabled ? this->ram_bank : -1);
+}
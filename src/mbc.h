@@ -0,0 +1,149 @@
+#ifndef MBC_H
+#define MBC_H
+
+#include <cstdint>
+#include <variant>
+
+// Offsets into the cartridge ROM and RAM of the banks currently mapped at $0000-$3FFF, $4000-$7FFF and
+// $A000-$BFFF. A negative RAM offset means cartridge RAM is disabled, or that an MBC register is mapped.
+struct BankMapping {
+    static constexpr int32_t RAM_DISABLED = -1;
+    static constexpr int32_t RTC_MAPPED   = -2;
+
+    uint32_t rom_offset[2]{0x0000, 0x4000};
+    int32_t  ram_offset{RAM_DISABLED};
+};
+
+// The mappers only hold plain register state, they never point into the cartridge. Every register write
+// returns the resulting bank mapping, which the cartridge caches for its reads. The bank counts are
+// derived from the ROM header and are not part of the save state, so mapping() recomputes in-bounds offsets
+// for whatever register values a loaded state holds.
+class MbcBase {
+public:
+    MbcBase() = default;
+    MbcBase(int n_rom_banks, int n_ram_banks)
+        : n_rom_banks(n_rom_banks > 0 ? n_rom_banks : 1),
+          n_ram_banks(n_ram_banks) {
+    }
+
+protected:
+    // map ROM bank `rom_bank` at $4000-$7FFF and RAM bank `ram_bank` at $A000-$BFFF (disabled if negative)
+    BankMapping map_banks(int rom_bank, int ram_bank) const {
+        BankMapping mapping;
+        mapping.rom_offset[1] = 0x4000 * (static_cast<unsigned>(rom_bank) % this->n_rom_banks);
+        if (ram_bank >= 0 && this->n_ram_banks > 0) {
+            mapping.ram_offset = 0x2000 * (ram_bank % this->n_ram_banks);
+        }
+        return mapping;
+    }
+
+    bool has_ram() const {
+        return this->n_ram_banks > 0;
+    }
+
+    int n_rom_banks{1};
+    int n_ram_banks{0};
+};
+
+class NullMbc : public MbcBase {
+public:
+    using MbcBase::MbcBase;
+
+    BankMapping write_mbc(uint16_t addr, uint8_t data, uint64_t clock);
+    BankMapping mapping() const;
+
+    template <typename Self, typename Stream>
+    static void transfer_state(Self &, Stream &) {
+    }
+};
+
+class Mbc1 : public MbcBase {
+    enum class BankMode : uint8_t { LARGE_ROM_BANKING = 0, RAM_BANKING = 1 };
+
+public:
+    using MbcBase::MbcBase;
+
+    BankMapping write_mbc(uint16_t addr, uint8_t data, uint64_t clock);
+    BankMapping mapping() const;
+
+    template <typename Self, typename Stream>
+    static void transfer_state(Self &self, Stream &s) {
+        s(self.ram_enabled, self.bank_mode, self.rom_bank, self.ram_bank);
+    }
+
+private:
+    bool     ram_enabled{false};
+    BankMode bank_mode{BankMode::LARGE_ROM_BANKING};
+    int      rom_bank{1};
+    int      ram_bank{0};
+};
+
+class Mbc3 : public MbcBase {
+public:
+    static constexpr int RTC_SAVE_SIZE = 48;
+
+    Mbc3() = default;
+    Mbc3(int n_rom_banks, int n_ram_banks, bool has_rtc) : MbcBase(n_rom_banks, n_ram_banks), has_rtc(has_rtc) {
+    }
+
+    BankMapping write_mbc(uint16_t addr, uint8_t data, uint64_t clock);
+    BankMapping mapping() const;
+
+    // access to the selected RTC register, while the bank mapping is RTC_MAPPED
+    uint8_t read_rtc() const;
+    void    write_rtc(uint8_t data, uint64_t clock);
+
+    // RTC state in the 48 byte layout that is commonly appended to .sav files
+    void save_rtc(uint8_t *out, uint64_t clock) const;
+    void load_rtc(const uint8_t *in, uint64_t clock);
+
+    template <typename Self, typename Stream>
+    static void transfer_state(Self &self, Stream &s) {
+        s(self.ram_enabled, self.rom_bank, self.ram_bank, self.rtc_base_clock, self.rtc_base_seconds, self.rtc_halted,
+          self.rtc_day_carry, self.rtc_latch_prev, self.rtc_latched);
+    }
+
+private:
+    enum RtcReg { RTC_S, RTC_M, RTC_H, RTC_DL, RTC_DH, N_RTC_REGS };
+
+    void get_rtc_regs(uint8_t *regs, uint64_t clock) const;
+    void set_rtc_regs(const uint8_t *regs, uint64_t clock);
+
+    bool ram_enabled{false};
+    bool has_rtc{false};
+    int  rom_bank{1};
+    int  ram_bank{0};
+
+    // The RTC is never ticked. Its registers are derived from the emulated clock when they are latched or
+    // written, so a running clock costs nothing.
+    uint64_t rtc_base_clock{0};   // emulated clock at which the RTC counted rtc_base_seconds
+    uint64_t rtc_base_seconds{0}; // seconds since day 0, not wrapped at 512 days
+    bool     rtc_halted{false};
+    bool     rtc_day_carry{false};
+    uint8_t  rtc_latch_prev{0xff};
+    uint8_t  rtc_latched[N_RTC_REGS]{};
+};
+
+class Mbc5 : public MbcBase {
+public:
+    using MbcBase::MbcBase;
+
+    BankMapping write_mbc(uint16_t addr, uint8_t data, uint64_t clock);
+    BankMapping mapping() const;
+
+    template <typename Self, typename Stream>
+    static void transfer_state(Self &self, Stream &s) {
+        s(self.ram_enabled, self.rom_bank, self.ram_bank);
+    }
+
+private:
+    bool ram_enabled{false};
+    int  rom_bank{1};
+    int  ram_bank{0};
+};
+
+// The set of supported mappers is closed, so they are stored inline in the cartridge rather than behind a
+// pointer. This keeps the mapper state trivially copyable together with the rest of the machine.
+using Mbc = std::variant<NullMbc, Mbc1, Mbc3, Mbc5>;
+
+#endif /* MBC_H */
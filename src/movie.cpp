@@ -0,0 +1,110 @@
+#include "movie.h"
+
+#include "gameboy.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <stdexcept>
+
+constexpr char     MOVIE_MAGIC[4] = {'G', 'B', 'M', 'V'};
+constexpr uint32_t MOVIE_VERSION  = 1;
+constexpr int      HEADER_SIZE    = 11;
+
+static void make_header(const RomImage &rom, char *header) {
+    std::copy(MOVIE_MAGIC, MOVIE_MAGIC + 4, header);
+    for (int i = 0; i < 4; i++) {
+        header[4 + i] = (MOVIE_VERSION >> (8 * i)) & 0xff;
+    }
+    // identify the ROM by its header and global checksums
+    header[8]  = rom[0x14d];
+    header[9]  = rom[0x14f];
+    header[10] = rom[0x14e];
+}
+
+MovieWriter::MovieWriter(const std::filesystem::path &path, const RomImage &rom)
+    : fs(path, std::ios_base::binary) {
+    if (!this->fs) {
+        throw std::runtime_error(fmt::format("Failed to open \"{}\" for writing", path.string()));
+    }
+
+    char header[HEADER_SIZE];
+    make_header(rom, header);
+    this->fs.write(header, HEADER_SIZE);
+}
+
+void MovieWriter::record(uint64_t clock, uint8_t buttons) {
+    if (buttons == this->last_buttons) {
+        return;
+    }
+    this->last_buttons = buttons;
+
+    char record[9];
+    for (int i = 0; i < 8; i++) {
+        record[i] = (clock >> (8 * i)) & 0xff;
+    }
+    record[8] = buttons;
+    this->fs.write(record, sizeof(record));
+}
+
+void MovieWriter::close() {
+    this->fs.close();
+}
+
+MovieReader::MovieReader(const std::filesystem::path &path, const RomImage &rom)
+    : fs(path, std::ios_base::binary) {
+    if (!this->fs) {
+        throw std::runtime_error(fmt::format("Failed to open movie \"{}\"", path.string()));
+    }
+
+    char header[HEADER_SIZE];
+    char expected[HEADER_SIZE];
+    make_header(rom, expected);
+    if (!this->fs.read(header, HEADER_SIZE) || !std::equal(header, header + 8, expected)) {
+        throw std::runtime_error(fmt::format("\"{}\" is not a supported movie file", path.string()));
+    }
+    if (!std::equal(header + 8, header + HEADER_SIZE, expected + 8)) {
+        throw std::runtime_error(fmt::format("Movie \"{}\" was recorded with a different ROM", path.string()));
+    }
+}
+
+const MovieRecord *MovieReader::peek() {
+    if (this->next == this->n_records) {
+        this->fill();
+    }
+    return this->next < this->n_records ? &this->records[this->next] : nullptr;
+}
+
+void MovieReader::pop() {
+    if (this->peek() != nullptr) {
+        this->next++;
+    }
+}
+
+void MovieReader::fill() {
+    this->fs.read(this->raw.data(), this->raw.size());
+    this->n_records = this->fs.gcount() / RECORD_SIZE;
+    this->next      = 0;
+
+    for (int i = 0; i < this->n_records; i++) {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(this->raw.data() + i * RECORD_SIZE);
+
+        uint64_t clock = 0;
+        for (int b = 7; b >= 0; b--) {
+            clock = (clock << 8) | bytes[b];
+        }
+        this->records[i] = {clock, bytes[8]};
+    }
+}
+
+void MovieReader::replay_until(Gameboy &gb, uint64_t clock) {
+    for (const MovieRecord *r = this->peek(); r != nullptr && r->clock < clock; r = this->peek()) {
+        gb.run_until(r->clock);
+        if (gb.get_clock() < r->clock) {
+            // stopped early by the debugger, the input is applied when the replay resumes
+            return;
+        }
+        gb.set_button_mask(r->buttons);
+        this->pop();
+    }
+    gb.run_until(clock);
+}
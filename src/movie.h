@@ -0,0 +1,67 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include "rom_image.h"
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+
+class Gameboy;
+
+// Input recordings ("movies"). A movie is a list of (emulated clock, button mask) records, one for each
+// change of the pressed buttons, starting from a freshly reset machine. Replaying applies each mask at
+// exactly the recorded clock, so a replay reproduces the recorded run cycle for cycle.
+//
+// File layout, all little endian: "GBMV", u32 version, u8 header checksum and u16 global checksum of the
+// ROM, followed by records of u64 clock and u8 button mask.
+
+struct MovieRecord {
+    uint64_t clock;
+    uint8_t  buttons;
+};
+
+class MovieWriter {
+public:
+    MovieWriter(const std::filesystem::path &path, const RomImage &rom);
+
+    // records the button mask if it differs from the previous one
+    void record(uint64_t clock, uint8_t buttons);
+    void close();
+
+private:
+    std::ofstream fs;
+    uint8_t       last_buttons{0};
+};
+
+// Reads a movie in chunks, so recordings of any length can be replayed without loading them into memory.
+class MovieReader {
+public:
+    MovieReader(const std::filesystem::path &path, const RomImage &rom);
+
+    // the next record, or nullptr when the movie has ended
+    const MovieRecord *peek();
+    void               pop();
+
+    // runs `gb` up to `clock`, applying the recorded inputs on the way; stops where run_until returns early
+    void replay_until(Gameboy &gb, uint64_t clock);
+
+    bool at_end() {
+        return this->peek() == nullptr;
+    }
+
+private:
+    static constexpr int CHUNK_RECORDS = 4096;
+    static constexpr int RECORD_SIZE   = 9;
+
+    void fill();
+
+    std::ifstream                                 fs;
+    std::array<MovieRecord, CHUNK_RECORDS>        records;
+    std::array<char, CHUNK_RECORDS * RECORD_SIZE> raw;
+    int                                           n_records{0};
+    int                                           next{0};
+};
+
+#endif /* MOVIE_H */
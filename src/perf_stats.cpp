@@ -0,0 +1,148 @@
+#include "perf_stats.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+uint64_t host_ticks_overhead() {
+    constexpr int N = 10000;
+    uint64_t      total = 0;
+    for (int i = 0; i < N; i++) {
+        const uint64_t t0 = host_ticks();
+        total += host_ticks() - t0;
+    }
+    return total / N;
+}
+
+double host_ticks_per_ns() {
+    static const double ticks_per_ns = [] {
+        const auto     t0 = std::chrono::steady_clock::now();
+        const uint64_t c0 = host_ticks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        const uint64_t c1 = host_ticks();
+        const auto     t1 = std::chrono::steady_clock::now();
+        return (c1 - c0) / std::max(1.0, std::chrono::duration<double, std::nano>(t1 - t0).count());
+    }();
+    return ticks_per_ns;
+}
+
+const char *PerfStats::get_section_name(Section section) {
+    switch (section) {
+        case CPU:
+            return "cpu";
+        case PPU:
+            return "ppu";
+        case DMA:
+            return "dma";
+        case TIMER:
+            return "timer";
+        case SOUND:
+            return "sound";
+        case BUS_READ:
+            return "bus_read";
+        case BUS_WRITE:
+            return "bus_write";
+        case FRONTEND:
+            return "frontend";
+        default:
+            return "?";
+    }
+}
+
+void PerfStats::Histogram::add(double ns) {
+    const int bucket = ns < 1.0 ? 0 : std::min(N_BUCKETS - 1, static_cast<int>(4 * std::log2(ns)));
+    this->buckets[bucket]++;
+    this->n_frames++;
+    this->total_ns += ns;
+    this->max_ns = std::max(this->max_ns, ns);
+}
+
+double PerfStats::Histogram::get_percentile(double p) const {
+    const uint64_t rank  = static_cast<uint64_t>(std::ceil(p * this->n_frames));
+    uint64_t       count = 0;
+    for (int i = 0; i < N_BUCKETS; i++) {
+        count += this->buckets[i];
+        if (count >= rank && count > 0) {
+            return std::min(this->max_ns, std::exp2((i + 1) / 4.0));
+        }
+    }
+    return 0.0;
+}
+
+PerfStats::PerfStats() : ns_per_tick(1.0 / host_ticks_per_ns()), tick_overhead(host_ticks_overhead()) {
+}
+
+void PerfStats::end_frame() {
+    // host time the frame would have taken without the samples, split up in proportion to the samples
+    double emulation_ns = 0.0;
+    if (this->untimed_clocks > 0) {
+        emulation_ns = this->untimed_ticks * this->ns_per_tick * (this->untimed_clocks + this->n_samples) /
+                       this->untimed_clocks;
+    }
+
+    int64_t sampled_total = 0;
+    for (int64_t ticks : this->sampled_ticks) {
+        sampled_total += std::max<int64_t>(0, ticks);
+    }
+
+    for (int s = 0; s < N_SECTIONS; s++) {
+        const uint64_t exact = this->exact_ticks[s].exchange(0, std::memory_order_relaxed);
+        double         ns    = exact * this->ns_per_tick;
+        if (sampled_total > 0) {
+            ns += emulation_ns * std::max<int64_t>(0, this->sampled_ticks[s]) / sampled_total;
+        }
+        this->histograms[s].add(ns);
+    }
+
+    this->sampled_ticks.fill(0);
+    this->untimed_ticks  = 0;
+    this->untimed_clocks = 0;
+    this->n_samples      = 0;
+}
+
+PerfStats::Summary PerfStats::get_summary(Section section) const {
+    const Histogram &h = this->histograms[section];
+    Summary          summary;
+    if (h.n_frames == 0) {
+        return summary;
+    }
+
+    double total_ns = 0.0;
+    for (const Histogram &other : this->histograms) {
+        total_ns += other.total_ns;
+    }
+
+    summary.mean_us = h.total_ns / h.n_frames / 1e3;
+    summary.p50_us  = h.get_percentile(0.5) / 1e3;
+    summary.p99_us  = h.get_percentile(0.99) / 1e3;
+    summary.max_us  = h.max_ns / 1e3;
+    summary.share   = total_ns > 0.0 ? h.total_ns / total_ns : 0.0;
+    return summary;
+}
+
+std::string PerfStats::format_summary() const {
+    std::string out = fmt::format("{} frames, per frame in us:\n", this->get_n_frames());
+    for (int s = 0; s < N_SECTIONS; s++) {
+        const Summary summary = this->get_summary(static_cast<Section>(s));
+        out += fmt::format("  {:<10} mean {:8.1f}  p50 {:8.1f}  p99 {:8.1f}  max {:8.1f}  {:5.1f}%\n",
+                           get_section_name(static_cast<Section>(s)),
+                           summary.mean_us,
+                           summary.p50_us,
+                           summary.p99_us,
+                           summary.max_us,
+                           100 * summary.share);
+    }
+    return out;
+}
+
+void PerfStats::clear() {
+    for (int s = 0; s < N_SECTIONS; s++) {
+        this->exact_ticks[s].store(0, std::memory_order_relaxed);
+        this->histograms[s] = Histogram{};
+    }
+    this->sampled_ticks.fill(0);
+    this->untimed_ticks  = 0;
+    this->untimed_clocks = 0;
+    this->n_samples      = 0;
+}
@@ -0,0 +1,166 @@
+#ifndef PERF_STATS_H
+#define PERF_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Host time stamp counter, the TSC where available and nanoseconds otherwise.
+inline uint64_t host_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// average difference between two consecutive reads of the tick counter
+uint64_t host_ticks_overhead();
+
+// host ticks per nanosecond, calibrated on first use
+double host_ticks_per_ns();
+
+// Breakdown of the host time spent per frame in each part of the emulator.
+//
+// Timing every tick would cost more than the emulation itself, so Gameboy::run_until only times the
+// components in one tick out of SAMPLE_PERIOD (see Gameboy::set_perf_stats), and the stretches of untimed
+// ticks in between as a whole. The period is prime so the samples do not lock onto the CPU's M-cycles or the
+// PPU's lines. Bus accesses made during a sampled tick are timed separately and not counted towards the
+// component making them.
+//
+// A few reads of the tick counter around work that takes nanoseconds are too coarse to give absolute
+// times, but the samples do show how the time is split. The emulation time of a frame is therefore taken
+// from the untimed stretches and split up in the proportions of the samples. Audio rendering and the
+// frontend are timed in full with ScopedTimer.
+//
+// The per-frame totals go into one histogram per section. With a few dozen samples per frame the split of
+// a single frame is noisy, the means are not. add() may be called from the audio thread, everything else
+// belongs to the emulation thread.
+class PerfStats {
+public:
+    static constexpr uint64_t SAMPLE_PERIOD = 1021;
+
+    enum Section {
+        CPU,
+        PPU,
+        DMA,
+        TIMER,
+        SOUND,
+        BUS_READ,
+        BUS_WRITE,
+        FRONTEND,
+        N_SECTIONS,
+    };
+
+    static const char *get_section_name(Section section);
+
+    // Quarter-octave histogram of per-frame times in nanoseconds, bucket i counts the frames that took
+    // [2^(i/4), 2^((i+1)/4)) ns.
+    struct Histogram {
+        static constexpr int N_BUCKETS = 128;
+
+        std::array<uint64_t, N_BUCKETS> buckets{};
+        uint64_t                        n_frames{0};
+        double                          total_ns{0.0};
+        double                          max_ns{0.0};
+
+        void   add(double ns);
+        double get_percentile(double p) const; // upper bound of the bucket holding the percentile
+    };
+
+    struct Summary {
+        double mean_us{0.0}; // per frame
+        double p50_us{0.0};
+        double p99_us{0.0};
+        double max_us{0.0};
+        double share{0.0}; // of the time of all sections
+    };
+
+    PerfStats();
+
+    // Host ticks spent in `section` during a sampled tick, see Gameboy::run_until. The cost of reading the
+    // tick counter is subtracted on average, so a single sample may be negative.
+    void add_sampled(Section section, int64_t ticks) {
+        this->sampled_ticks[section] += ticks;
+    }
+
+    // host ticks of `n_clocks` emulated clocks run untimed between two samples
+    void add_untimed(uint64_t ticks, uint64_t n_clocks) {
+        this->untimed_ticks += ticks;
+        this->untimed_clocks += n_clocks;
+    }
+
+    void end_sample() {
+        this->n_samples++;
+    }
+
+    // ticks of work that is timed in full
+    void add(Section section, uint64_t ticks) {
+        this->exact_ticks[section].fetch_add(ticks, std::memory_order_relaxed);
+    }
+
+    // closes the current frame, called by the Gameboy at every emulated frame boundary
+    void end_frame();
+
+    // cost of reading the tick counter, to be subtracted from short measurements
+    int64_t get_tick_overhead() const {
+        return this->tick_overhead;
+    }
+
+    uint64_t get_n_frames() const {
+        return this->histograms[0].n_frames;
+    }
+
+    const Histogram &get_histogram(Section section) const {
+        return this->histograms[section];
+    }
+
+    Summary get_summary(Section section) const;
+
+    // one line per section, for printing
+    std::string format_summary() const;
+
+    void clear();
+
+private:
+    std::array<int64_t, N_SECTIONS>               sampled_ticks{};
+    uint64_t                                      untimed_ticks{0};
+    uint64_t                                      untimed_clocks{0};
+    uint64_t                                      n_samples{0};
+    std::array<std::atomic<uint64_t>, N_SECTIONS> exact_ticks{};
+    std::array<Histogram, N_SECTIONS>             histograms;
+    double                                        ns_per_tick;
+    int64_t                                       tick_overhead;
+};
+
+// Adds the host time spent in its scope to a section of `stats`, does nothing if `stats` is nullptr.
+class ScopedTimer {
+public:
+    ScopedTimer(PerfStats *stats, PerfStats::Section section)
+        : stats(stats),
+          section(section),
+          start(stats != nullptr ? host_ticks() : 0) {
+    }
+
+    ~ScopedTimer() {
+        if (this->stats != nullptr) {
+            this->stats->add(this->section, host_ticks() - this->start);
+        }
+    }
+
+    ScopedTimer(const ScopedTimer &)            = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    PerfStats         *stats;
+    PerfStats::Section section;
+    uint64_t           start;
+};
+
+#endif /* PERF_STATS_H */
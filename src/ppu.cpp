@@ -2,6 +2,7 @@
 
 #include "interrupt_state.h"
 #include "logging.h"
+#include "state_stream.h"
 
 #include <fmt/core.h>
 #include <stdexcept>
@@ -107,6 +108,20 @@ void Ppu::write_reg(uint8_t regid, uint8_t data) {
     }
 }
 
+template <typename Self, typename Stream>
+void Ppu::transfer_state(Self &self, Stream &s) {
+    s(self.lcdc, self.stat, self.scy, self.scx, self.ly, self.lyc, self.bgp, self.obp0, self.obp1, self.wy, self.wx,
+      self.oam, self.dma_src_base, self.dma_n_bytes_left, self.prev_stat_interrupt_line, self.lx, self.mode);
+}
+
+void Ppu::save_state(StateWriter &w) const {
+    transfer_state(*this, w);
+}
+
+void Ppu::load_state(StateReader &r) {
+    transfer_state(*this, r);
+}
+
 void Ppu::dump_regs(std::ostream &os) const {
     os << fmt::format("PPU state:\n");
     os << fmt::format("  LCDC [0xFF40] {:02X}\n", this->lcdc);
@@ -153,7 +168,7 @@ void Ppu::tick_dma(uint64_t clock, IBus &bus) {
     logging::debug("\t\t\t\t\t\t\t\t Performing DMA transfer from ${:04X} to OAM at ${:04X}\n",
                                this->dma_src_base + this->dma_n_bytes_left,
                                this->dma_n_bytes_left + 0xfe00);
-    this->oam[this->dma_n_bytes_left] = bus.read(this->dma_src_base + this->dma_n_bytes_left);
+    this->oam[this->dma_n_bytes_left] = bus.peek(this->dma_src_base + this->dma_n_bytes_left);
 }
 
 // H: 144: 154 scanlines  (coord : index LY ( FF44))
@@ -161,7 +176,7 @@ void Ppu::tick_dma(uint64_t clock, IBus &bus) {
 
 //  Mode cycle: 22 333 00  22 333 00 .. 111111
 
-void Ppu::do_tick(std::vector<uint32_t> &buf, const IBus &bus, InterruptState &int_state) {
+void Ppu::do_tick(PixelBuffer &buf, const IBus &bus, InterruptState &int_state) {
 
     if((this->lcdc & LCDC_LCD_ENABLE) == 0) {
         // lcd / ppu disabled
@@ -216,117 +231,122 @@ void Ppu::do_tick(std::vector<uint32_t> &buf, const IBus &bus, InterruptState &i
     } else if(this->mode == 3) {
 
         if(this->lx == 90) {
-            const int n_objects_max = 10;
-            int8_t object_indices[n_objects_max];
-            int8_t object_row[n_objects_max];
-            int n_object_indices=0;
-            // foreach object in oam, gather (up to) 10 relevant ones
-            const auto tile_height = this->lcdc&LCDC_OBJ_SIZE ? 16 : 8;
-            for(int i=0; i<40 && n_object_indices<n_objects_max; i++) {
-                const auto ypos = this->oam[4*i];
-
-                if(this->ly+16 >= ypos && this->ly+16 < ypos+tile_height) {
-                    object_row[n_object_indices] = this->ly+16-ypos;
-                    object_indices[n_object_indices++] = i;
-                    // save y coord in tile
-                }
-            }
+            this->render_line(buf, bus);
+        }
 
-            // background tilemap coordinate
-            // background tile index
-            const uint8_t bgy = this->scy + this->ly; // wrapping ok
-            const uint8_t bg_tm_iy = bgy / 8; // 0-31
-            const uint8_t bg_td_iy = bgy % 8; // 0-7
-            const uint16_t tile_map_area_base_idx = (this->lcdc&LCDC_BG_TMAP_AREA)?0x9c00 : 0x9800;
-
-            // do the drawing
-            for(int i=0; i<LCD_WIDTH; i++) {
-                // for this pixel, check background tiles, window tiles, and each of the potential objects/sprites.
-                // set this pixel to the value based on the above
-
-                uint8_t value = 0;
-
-                if(this->lcdc&LCDC_BG_WIN_ENABLE) { // background / window enabled
-                    // coordinate within the background tile map:
-                    uint8_t bgx = this->scx + i; // wrapping ok
-                    const uint8_t bg_tm_ix = bgx / 8; // 0-31
-                    const uint8_t bg_td_ix = bgx % 8; // 0-7
-
-                    uint8_t tile_idx = bus.read(tile_map_area_base_idx + 32 * bg_tm_iy + bg_tm_ix);
-                    uint16_t tile_data_area_base_idx = 0x8000;
-                    if((this->lcdc & LCDC_BG_WIN_TDATA_AREA) == 0) {
-                        tile_idx += 128;
-                        tile_data_area_base_idx = 0x8800;
-                    }
+        if(this->lx == 250) {
+            // at some point switch to mode 0
+            this->mode = 0;
+        }
 
-                    const uint16_t tile_address = tile_data_area_base_idx + tile_idx*16;
+    } else if(this->mode == 0) {
+        // do nothing ?
+    }
+}
 
-                    const auto tile_row_lsb = bus.read(tile_address + 2*bg_td_iy);
-                    const auto tile_row_msb = bus.read(tile_address + 2*bg_td_iy+1);
-                    const auto color_id_lsb = (tile_row_lsb >>(7-bg_td_ix))&0x1;
-                    const auto color_id_msb = (tile_row_msb >>(7-bg_td_ix))&0x1;
-                    const uint8_t color_id = (color_id_msb<<1)|color_id_lsb;
+// draws line ly, the whole line is drawn at once at dot 90 of mode 3
+void Ppu::render_line(PixelBuffer &buf, const IBus &bus) const {
+    const int n_objects_max = 10;
+    int8_t object_indices[n_objects_max];
+    int8_t object_row[n_objects_max];
+    int n_object_indices=0;
+    // foreach object in oam, gather (up to) 10 relevant ones
+    const auto tile_height = this->lcdc&LCDC_OBJ_SIZE ? 16 : 8;
+    for(int i=0; i<40 && n_object_indices<n_objects_max; i++) {
+        const auto ypos = this->oam[4*i];
+
+        if(this->ly+16 >= ypos && this->ly+16 < ypos+tile_height) {
+            object_row[n_object_indices] = this->ly+16-ypos;
+            object_indices[n_object_indices++] = i;
+            // save y coord in tile
+        }
+    }
 
-                    value = (this->bgp>>(color_id<<1))&0x3;
+    // background tilemap coordinate
+    // background tile index
+    const uint8_t bgy = this->scy + this->ly; // wrapping ok
+    const uint8_t bg_tm_iy = bgy / 8; // 0-31
+    const uint8_t bg_td_iy = bgy % 8; // 0-7
+    const uint16_t tile_map_area_base_idx = (this->lcdc&LCDC_BG_TMAP_AREA)?0x9c00 : 0x9800;
+
+    // do the drawing
+    for(int i=0; i<LCD_WIDTH; i++) {
+        // for this pixel, check background tiles, window tiles, and each of the potential objects/sprites.
+        // set this pixel to the value based on the above
+
+        uint8_t value = 0;
+
+        if(this->lcdc&LCDC_BG_WIN_ENABLE) { // background / window enabled
+            // coordinate within the background tile map:
+            uint8_t bgx = this->scx + i; // wrapping ok
+            const uint8_t bg_tm_ix = bgx / 8; // 0-31
+            const uint8_t bg_td_ix = bgx % 8; // 0-7
+
+            uint8_t tile_idx = bus.peek(tile_map_area_base_idx + 32 * bg_tm_iy + bg_tm_ix);
+            uint16_t tile_data_area_base_idx = 0x8000;
+            if((this->lcdc & LCDC_BG_WIN_TDATA_AREA) == 0) {
+                tile_idx += 128;
+                tile_data_area_base_idx = 0x8800;
+            }
 
-                    // if(this->lcdc&LCDC_WIN_ENABLE) { // window enabled
-                    // }
-                }
+            const uint16_t tile_address = tile_data_area_base_idx + tile_idx*16;
 
-                if(this->lcdc&LCDC_OBJ_ENABLE) { // object/sprite enabled
-                    // loop over objects until a non-transparent pixel value has been found,
-                    // and save the object index along the way
+            const auto tile_row_lsb = bus.peek(tile_address + 2*bg_td_iy);
+            const auto tile_row_msb = bus.peek(tile_address + 2*bg_td_iy+1);
+            const auto color_id_lsb = (tile_row_lsb >>(7-bg_td_ix))&0x1;
+            const auto color_id_msb = (tile_row_msb >>(7-bg_td_ix))&0x1;
+            const uint8_t color_id = (color_id_msb<<1)|color_id_lsb;
 
-                    // int8_t object_index = -1;
-                    for(int i=0; i<n_object_indices; i++) {
-                        const auto oi = object_indices[i];
-                        const auto xpos = this->oam[4*oi + 1];
-                        if(this->lx+8 >= xpos && this->lx < xpos) {
-                            // the sprite covers this pixel
-                            const auto tile_index = this->oam[4*oi + 2];
+            value = (this->bgp>>(color_id<<1))&0x3;
 
-                            // get coord in tile:
-                            const auto sprite_iy = object_row[i];
-                            const auto sprite_ix = this->lx+8-xpos;
+            // if(this->lcdc&LCDC_WIN_ENABLE) { // window enabled
+            // }
+        }
 
-                            // TODO: adjust for flip etc
+        if(this->lcdc&LCDC_OBJ_ENABLE) { // object/sprite enabled
+            // loop over objects until a non-transparent pixel value has been found,
+            // and save the object index along the way
 
-                            const auto sprite_row_lsb = bus.read(0x8000+tile_index*16 + 2*sprite_iy);
-                            const auto sprite_row_msb = bus.read(0x8000+tile_index*16 + 2*sprite_iy+1);
-                            const auto color_id_lsb = (sprite_row_lsb>>(7-sprite_ix))&0x1;
-                            const auto color_id_msb = (sprite_row_msb>>(7-sprite_ix))&0x1;
-                            const uint8_t color_id = (color_id_msb<<1)|color_id_lsb;
+            // int8_t object_index = -1;
+            for(int i=0; i<n_object_indices; i++) {
+                const auto oi = object_indices[i];
+                const auto xpos = this->oam[4*oi + 1];
+                if(this->lx+8 >= xpos && this->lx < xpos) {
+                    // the sprite covers this pixel
+                    const auto tile_index = this->oam[4*oi + 2];
 
-                            if(color_id == 0) { // transparent, so skip this sprite and continue
-                                continue;
-                            }
+                    // get coord in tile:
+                    const auto sprite_iy = object_row[i];
+                    const auto sprite_ix = this->lx+8-xpos;
 
-                            const auto attributes = this->oam[4*oi + 3];
+                    // TODO: adjust for flip etc
+
+                    const auto sprite_row_lsb = bus.peek(0x8000+tile_index*16 + 2*sprite_iy);
+                    const auto sprite_row_msb = bus.peek(0x8000+tile_index*16 + 2*sprite_iy+1);
+                    const auto color_id_lsb = (sprite_row_lsb>>(7-sprite_ix))&0x1;
+                    const auto color_id_msb = (sprite_row_msb>>(7-sprite_ix))&0x1;
+                    const uint8_t color_id = (color_id_msb<<1)|color_id_lsb;
+
+                    if(color_id == 0) { // transparent, so skip this sprite and continue
+                        continue;
+                    }
 
-                            // get actual color using palette
-                            // if not transparent, assign value to `value` and break the loop
-                            // TODO: check for background on top
+                    const auto attributes = this->oam[4*oi + 3];
 
-                            if((attributes & (1<<7)) != (1<<7)) {
-                                value = ((attributes&(1<<4) ? this->obp1 : this->obp0)>>color_id)&0x3;
-                            }
+                    // get actual color using palette
+                    // if not transparent, assign value to `value` and break the loop
+                    // TODO: check for background on top
 
-                            break;
-                        }
+                    if((attributes & (1<<7)) != (1<<7)) {
+                        value = ((attributes&(1<<4) ? this->obp1 : this->obp0)>>color_id)&0x3;
                     }
-                }
 
-                value = 255-(value<<6); // 0-3 -> 0-192 -> 192-0
-                buf[LCD_WIDTH*this->ly + i] = value<<24 | value<<16 | value<<8 | 0xff;
+                    break;
+                }
             }
         }
 
-        if(this->lx == 250) {
-            // at some point switch to mode 0
-            this->mode = 0;
-        }
-
-    } else if(this->mode == 0) {
-        // do nothing ?
+        value = 255-(value<<6); // 0-3 -> 0-192 -> 192-0
+        buf[LCD_WIDTH*this->ly + i] = value<<24 | value<<16 | value<<8 | 0xff;
     }
 }
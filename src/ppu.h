@@ -3,25 +3,27 @@
 
 #include "ibus.h"
 
+#include <array>
 #include <cstdint>
 #include <iosfwd>
-#include <vector>
+
+class StateReader;
+class StateWriter;
 
 #define LCD_WIDTH  160
 #define LCD_HEIGHT 144
 
 #define OAM_SIZE 160
 
+using PixelBuffer = std::array<uint32_t, LCD_WIDTH * LCD_HEIGHT>;
+
 class InterruptState;
 
 class Ppu {
 public:
-    Ppu() : oam(OAM_SIZE, 0) {
-    }
-
     void reset();
 
-    void do_tick(std::vector<uint32_t> &buf, const IBus &bus, InterruptState &int_state);
+    void do_tick(PixelBuffer &buf, const IBus &bus, InterruptState &int_state);
 
     bool dma_is_active() const;
     void tick_dma(uint64_t clock, IBus &bus);
@@ -39,7 +41,19 @@ public:
     void dump_regs(std::ostream &os) const;
     void dump_oam(std::ostream &os) const;
 
+    // binary save state, see state_stream.h
+    void save_state(StateWriter &w) const;
+    void load_state(StateReader &r);
+
 private:
+    // ticks the LCD counters in SIMD lanes and draws the lines with render_line
+    friend class LockstepBatch;
+
+    template <typename Self, typename Stream>
+    static void transfer_state(Self &self, Stream &s);
+
+    void render_line(PixelBuffer &buf, const IBus &bus) const;
+
     // register
     uint8_t lcdc{0};
     uint8_t stat{0};
@@ -55,10 +69,10 @@ private:
     uint8_t wx{0};
 
     // oam
-    std::vector<uint8_t> oam;
+    std::array<uint8_t, OAM_SIZE> oam{};
 
     // dma state
-    uint16_t dma_src_base;
+    uint16_t dma_src_base{0};
     uint8_t dma_n_bytes_left{0};
 
     // other rendering state
@@ -0,0 +1,237 @@
+#include "profiler.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+
+static uint32_t make_location(uint16_t bank, uint16_t pc) {
+    return (static_cast<uint32_t>(bank) << 16) | pc;
+}
+
+// number of bytes of CALL cc,nn / CALL nn / RST n, 0 for any other opcode
+static int call_length(uint8_t opcode) {
+    if (opcode == 0xcd || (opcode & 0xe7) == 0xc4) {
+        return 3;
+    }
+    return (opcode & 0xc7) == 0xc7 ? 1 : 0;
+}
+
+// RET, RETI and RET cc
+static bool is_return(uint8_t opcode) {
+    return opcode == 0xc9 || opcode == 0xd9 || (opcode & 0xe7) == 0xc0;
+}
+
+Profiler::Profiler() {
+    this->clear();
+}
+
+void Profiler::clear() {
+    this->nodes.clear();
+    this->nodes.push_back({ROOT, ROOT, -1});
+    this->stack.clear();
+    this->stack.push_back({0, 0});
+    this->location_costs.clear();
+    this->in_flight          = false;
+    this->total_cycles       = 0;
+    this->total_instructions = 0;
+}
+
+void Profiler::on_instruction(uint16_t bank, uint16_t pc, uint8_t opcode, uint64_t clock) {
+    this->finish_instruction(bank, pc, clock);
+
+    this->in_flight   = true;
+    this->executed    = true;
+    this->location    = make_location(bank, pc);
+    this->opcode      = opcode;
+    this->start_clock = clock;
+}
+
+void Profiler::on_interrupt(uint16_t bank, uint16_t pc, uint16_t vector, uint64_t clock) {
+    // the interrupted instruction is the one the handler returns to
+    this->finish_instruction(bank, pc, clock);
+    this->enter(make_location(bank, pc), make_location(0, vector), pc);
+
+    this->in_flight   = true;
+    this->executed    = false;
+    this->location    = make_location(0, vector);
+    this->opcode      = 0x00;
+    this->start_clock = clock;
+}
+
+void Profiler::finish_instruction(uint16_t bank, uint16_t next_pc, uint64_t clock) {
+    if (!this->in_flight) {
+        return;
+    }
+
+    const uint64_t cycles = clock - this->start_clock;
+    Node          &node   = this->nodes[this->stack.back().node];
+    node.cycles += cycles;
+    node.instructions += this->executed;
+
+    Cost &cost = this->location_costs[(static_cast<uint64_t>(node.function) << 32) | this->location];
+    cost.cycles += cycles;
+    cost.instructions += this->executed;
+
+    this->total_cycles += cycles;
+    this->total_instructions += this->executed;
+
+    // conditional calls and returns that were not taken fall through to the next instruction
+    const uint16_t pc  = this->location & 0xffff;
+    const int      len = call_length(this->opcode);
+    if (len > 0 && next_pc != static_cast<uint16_t>(pc + len)) {
+        this->enter(this->location, make_location(bank, next_pc), pc + len);
+    } else if (is_return(this->opcode) && next_pc != static_cast<uint16_t>(pc + 1)) {
+        this->leave(next_pc);
+    }
+}
+
+void Profiler::enter(uint32_t call_site, uint32_t function, uint16_t return_pc) {
+    if (this->stack.size() >= MAX_DEPTH) {
+        // the matching return will not find a frame and is ignored
+        return;
+    }
+
+    const int      parent = this->stack.back().node;
+    const uint64_t key    = (static_cast<uint64_t>(call_site) << 32) | function;
+
+    int  child;
+    auto it = this->nodes[parent].children.find(key);
+    if (it != this->nodes[parent].children.end()) {
+        child = it->second;
+    } else {
+        child = static_cast<int>(this->nodes.size());
+        this->nodes[parent].children.emplace(key, child);
+        this->nodes.push_back({function, call_site, parent});
+    }
+
+    this->nodes[child].calls++;
+    this->stack.push_back({child, return_pc});
+}
+
+void Profiler::leave(uint16_t return_pc) {
+    // unwind to the innermost frame that returns there, the root frame is never left
+    for (size_t i = this->stack.size() - 1; i > 0; i--) {
+        if (this->stack[i].return_pc == return_pc) {
+            this->stack.resize(i);
+            return;
+        }
+    }
+}
+
+void Profiler::load_symbols(const std::filesystem::path &path) {
+    std::ifstream fs(path);
+    if (!fs) {
+        throw std::runtime_error(fmt::format("Failed to open symbol file \"{}\"", path.string()));
+    }
+
+    std::string line;
+    while (std::getline(fs, line)) {
+        line = line.substr(0, line.find(';'));
+
+        unsigned int       bank, addr;
+        char               colon;
+        std::string        name;
+        std::istringstream is(line);
+        if (is >> std::hex >> bank >> colon >> addr >> name && colon == ':' && bank <= 0xffff && addr <= 0xffff) {
+            this->symbols[make_location(bank, addr)] = name;
+        }
+    }
+}
+
+std::string Profiler::function_name(uint32_t function) const {
+    if (function == ROOT) {
+        return "(root)";
+    }
+
+    // nearest label at or before the location in the same bank
+    auto it = this->symbols.upper_bound(function);
+    if (it != this->symbols.begin() && (std::prev(it)->first >> 16) == (function >> 16)) {
+        --it;
+        if (it->first == function) {
+            return it->second;
+        }
+        return fmt::format("{}+{}", it->second, function - it->first);
+    }
+    return fmt::format("{:02x}:{:04x}", function >> 16, function & 0xffff);
+}
+
+void Profiler::write_callgrind(std::ostream &os) const {
+    // inclusive costs, children are always created after their parent
+    std::vector<Cost> inclusive(this->nodes.size());
+    for (size_t i = this->nodes.size(); i-- > 0;) {
+        inclusive[i].cycles += this->nodes[i].cycles;
+        inclusive[i].instructions += this->nodes[i].instructions;
+        if (this->nodes[i].parent >= 0) {
+            inclusive[this->nodes[i].parent].cycles += inclusive[i].cycles;
+            inclusive[this->nodes[i].parent].instructions += inclusive[i].instructions;
+        }
+    }
+
+    // callgrind has no call stacks, costs and calls are summed up per function
+    struct Call {
+        uint64_t calls{0};
+        Cost     cost;
+    };
+    struct Function {
+        std::map<uint32_t, Cost>                         self; // per location
+        std::map<std::tuple<uint32_t, uint32_t>, Call> calls;  // per call site and callee
+    };
+    std::map<uint32_t, Function> functions;
+    for (const auto &[key, cost] : this->location_costs) {
+        functions[key >> 32].self[key & 0xffffffff] = cost;
+    }
+    for (size_t i = 1; i < this->nodes.size(); i++) {
+        const Node &node = this->nodes[i];
+        Call       &call = functions[this->nodes[node.parent].function].calls[{node.call_site, node.function}];
+        call.calls += node.calls;
+        call.cost.cycles += inclusive[i].cycles;
+        call.cost.instructions += inclusive[i].instructions;
+    }
+
+    os << "# callgrind format\n";
+    os << "version: 1\n";
+    os << "creator: gbemu\n";
+    os << "positions: instr\n";
+    os << "events: Cycles Instructions\n";
+    os << fmt::format("summary: {} {}\n\n", this->total_cycles, this->total_instructions);
+    os << "fl=rom\n";
+
+    // functions are written as "(id) name" the first time and as "(id)" after that
+    std::map<uint32_t, int> ids;
+    auto                    name = [this, &ids](uint32_t function) {
+        auto [it, inserted] = ids.emplace(function, static_cast<int>(ids.size()) + 1);
+        if (inserted) {
+            return fmt::format("({}) {}", it->second, this->function_name(function));
+        }
+        return fmt::format("({})", it->second);
+    };
+
+    for (const auto &[function, f] : functions) {
+        os << fmt::format("\nfn={}\n", name(function));
+        for (const auto &[location, cost] : f.self) {
+            os << fmt::format("0x{:x} {} {}\n", location, cost.cycles, cost.instructions);
+        }
+        for (const auto &[key, call] : f.calls) {
+            const auto [call_site, callee] = key;
+            os << fmt::format("cfn={}\n", name(callee));
+            os << fmt::format("calls={} 0x{:x}\n", call.calls, callee);
+            os << fmt::format("0x{:x} {} {}\n", call_site, call.cost.cycles, call.cost.instructions);
+        }
+    }
+}
+
+void Profiler::write_folded(std::ostream &os) const {
+    std::vector<std::string> paths(this->nodes.size());
+    for (size_t i = 0; i < this->nodes.size(); i++) {
+        const Node &node = this->nodes[i];
+        paths[i] = node.parent >= 0 ? paths[node.parent] + ";" + this->function_name(node.function)
+                                    : this->function_name(node.function);
+        if (node.cycles > 0) {
+            os << fmt::format("{} {}\n", paths[i], node.cycles);
+        }
+    }
+}
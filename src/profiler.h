@@ -0,0 +1,100 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Profile of the emulated program, fed by the Cpu while attached to it (see Gameboy::set_profiler).
+//
+// Every instruction is charged the T-cycles from its opcode fetch to the next fetch or interrupt dispatch,
+// so time spent in HALT shows up at the HALT instruction. Costs are kept per code location, i.e. per ROM
+// bank and address, and per call stack. The call stack is followed through taken CALL, RST and RET
+// instructions and interrupt dispatches. Returns are matched against the return addresses on the shadow
+// stack, so code that drops its return address (e.g. RST jump tables) or uses RET as a jump does not
+// unbalance it.
+//
+// The profile can be written in the callgrind format (for KCachegrind or callgrind_annotate, with the code
+// location as instruction address) or as folded stacks (for flamegraph.pl and similar tools).
+class Profiler {
+public:
+    Profiler();
+
+    // Called by the Cpu when it fetches an opcode and when it starts dispatching an interrupt. `bank` is the
+    // ROM bank mapped at `pc`, see IBus::get_rom_bank.
+    void on_instruction(uint16_t bank, uint16_t pc, uint8_t opcode, uint64_t clock);
+    void on_interrupt(uint16_t bank, uint16_t pc, uint16_t vector, uint64_t clock);
+
+    // names functions after the labels of an RGBDS/BGB symbol file ("bank:address name" per line)
+    void load_symbols(const std::filesystem::path &path);
+
+    // discards the profile, the symbols are kept
+    void clear();
+
+    uint64_t get_total_cycles() const {
+        return this->total_cycles;
+    }
+
+    uint64_t get_total_instructions() const {
+        return this->total_instructions;
+    }
+
+    void write_callgrind(std::ostream &os) const;
+    void write_folded(std::ostream &os) const;
+
+private:
+    // code locations are bank << 16 | address
+    static constexpr uint32_t ROOT      = 0xffffffff;
+    static constexpr size_t   MAX_DEPTH = 256;
+
+    // a call stack, the tree of them is rooted at node 0
+    struct Node {
+        uint32_t                function;  // location the call went to
+        uint32_t                call_site; // location of the CALL or the interrupted instruction
+        int                     parent;
+        uint64_t                calls{0};
+        uint64_t                cycles{0}; // self cost
+        uint64_t                instructions{0};
+        std::map<uint64_t, int> children; // call_site << 32 | function -> node
+    };
+
+    struct Frame {
+        int      node;
+        uint16_t return_pc;
+    };
+
+    struct Cost {
+        uint64_t cycles{0};
+        uint64_t instructions{0};
+    };
+
+    void finish_instruction(uint16_t bank, uint16_t next_pc, uint64_t clock);
+    void enter(uint32_t call_site, uint32_t function, uint16_t return_pc);
+    void leave(uint16_t return_pc);
+
+    std::string function_name(uint32_t function) const;
+
+    std::vector<Node>  nodes;
+    std::vector<Frame> stack;
+
+    // self cost per function << 32 | location
+    std::unordered_map<uint64_t, Cost> location_costs;
+
+    // instruction in flight, charged at the next fetch or dispatch
+    bool     in_flight{false};
+    bool     executed{false}; // false for the interrupt dispatch, which is charged to the handler
+    uint32_t location{0};
+    uint8_t  opcode{0};
+    uint64_t start_clock{0};
+
+    uint64_t total_cycles{0};
+    uint64_t total_instructions{0};
+
+    std::map<uint32_t, std::string> symbols;
+};
+
+#endif /* PROFILER_H */
@@ -0,0 +1,155 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace gb_sound {
+
+    // dot product of n int16 values (n a multiple of 8) in Q14, accumulated in 32 bits
+    static int32_t fir_dot(const int16_t *x, const int16_t *h, int n) {
+#ifdef __SSE2__
+        __m128i acc = _mm_setzero_si128();
+        for (int i = 0; i < n; i += 8) {
+            const __m128i xv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i));
+            const __m128i hv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i));
+            acc              = _mm_add_epi32(acc, _mm_madd_epi16(xv, hv));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(acc);
+#else
+        int32_t acc = 0;
+        for (int i = 0; i < n; i++) {
+            acc += static_cast<int32_t>(x[i]) * h[i];
+        }
+        return acc;
+#endif
+    }
+
+    static int16_t saturate_q14(int32_t v) {
+        return std::clamp<int32_t>(v >> 14, INT16_MIN, INT16_MAX);
+    }
+
+    void Resampler::configure(double input_rate, int output_rate, ResamplerQuality quality) {
+        this->n_taps     = quality == ResamplerQuality::HIGH ? MAX_TAPS : 8;
+        this->decimation = std::max(1, static_cast<int>(input_rate / (2.0 * output_rate)));
+
+        const double intermediate_rate = input_rate / this->decimation;
+        this->step                     = static_cast<uint64_t>(intermediate_rate / output_rate * 4294967296.0);
+
+        // cutoff just below the output nyquist frequency, relative to the intermediate rate
+        const double cutoff = 0.45 * std::min(1.0, output_rate / intermediate_rate);
+        const int    half   = this->n_taps / 2;
+
+        for (int p = 0; p < N_PHASES; p++) {
+            const double frac = static_cast<double>(p) / N_PHASES;
+
+            double h[MAX_TAPS];
+            double sum = 0.0;
+            for (int k = 0; k < this->n_taps; k++) {
+                const double d      = k - (half - 1) - frac;
+                const double sinc   = d == 0.0 ? 2.0 * cutoff : std::sin(2.0 * std::numbers::pi * cutoff * d) /
+                                                                  (std::numbers::pi * d);
+                const double x      = d / half;
+                const double window = 0.42 + 0.5 * std::cos(std::numbers::pi * x) +
+                                      0.08 * std::cos(2.0 * std::numbers::pi * x); // Blackman
+                h[k] = sinc * window;
+                sum += h[k];
+            }
+
+            // normalize each phase to unity gain
+            for (int k = 0; k < this->n_taps; k++) {
+                this->coeffs[p * this->n_taps + k] = static_cast<int16_t>(std::lround(h[k] / sum * (1 << 14)));
+            }
+        }
+
+        this->reset();
+    }
+
+    void Resampler::reset() {
+        this->box_acc[0]  = 0;
+        this->box_acc[1]  = 0;
+        this->box_count   = 0;
+        this->history_len = 0;
+        this->position    = 0;
+        this->history_l.fill(0);
+        this->history_r.fill(0);
+    }
+
+    int Resampler::input_frames_needed(int n_out) const {
+        if (n_out <= 0) {
+            return 0;
+        }
+
+        const uint64_t last   = this->position + static_cast<uint64_t>(n_out - 1) * this->step;
+        const int64_t  needed = static_cast<int64_t>(last >> 32) + this->n_taps - this->history_len;
+        if (needed <= 0) {
+            return 0;
+        }
+        return needed * this->decimation - this->box_count;
+    }
+
+    int Resampler::process(const int16_t *in, int n_in, int16_t *out, int max_out) {
+        int n_out = 0;
+        int i     = 0;
+
+        while (true) {
+            // produce as many output frames as the history allows
+            while (n_out < max_out) {
+                const int first = this->position >> 32;
+                if (first + this->n_taps > this->history_len) {
+                    break;
+                }
+                const int      phase = (this->position >> (32 - PHASE_BITS)) & (N_PHASES - 1);
+                const int16_t *h     = &this->coeffs[phase * this->n_taps];
+
+                out[2 * n_out + 0] = saturate_q14(fir_dot(&this->history_l[first], h, this->n_taps));
+                out[2 * n_out + 1] = saturate_q14(fir_dot(&this->history_r[first], h, this->n_taps));
+                n_out++;
+                this->position += this->step;
+            }
+
+            // drop history that no future output refers to
+            const int drop = std::min<int>(this->position >> 32, this->history_len);
+            if (drop > 0) {
+                std::copy(this->history_l.begin() + drop,
+                          this->history_l.begin() + this->history_len,
+                          this->history_l.begin());
+                std::copy(this->history_r.begin() + drop,
+                          this->history_r.begin() + this->history_len,
+                          this->history_r.begin());
+                this->history_len -= drop;
+                this->position -= static_cast<uint64_t>(drop) << 32;
+            }
+
+            // stop when all input is consumed, or when the output is full and no more input fits
+            if (i == n_in || this->history_len == HISTORY_SIZE) {
+                break;
+            }
+
+            // feed input through the boxcar stage
+            while (i < n_in && this->history_len < HISTORY_SIZE) {
+                this->box_acc[0] += in[2 * i + 0];
+                this->box_acc[1] += in[2 * i + 1];
+                i++;
+
+                if (++this->box_count == this->decimation) {
+                    this->history_l[this->history_len] = this->box_acc[0] / this->decimation;
+                    this->history_r[this->history_len] = this->box_acc[1] / this->decimation;
+                    this->history_len++;
+                    this->box_acc[0] = 0;
+                    this->box_acc[1] = 0;
+                    this->box_count  = 0;
+                }
+            }
+        }
+
+        return n_out;
+    }
+
+} // namespace gb_sound
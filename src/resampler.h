@@ -0,0 +1,55 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <array>
+#include <cstdint>
+
+namespace gb_sound {
+
+    enum class ResamplerQuality {
+        FAST,
+        HIGH,
+    };
+
+    // Stereo (interleaved int16) downsampler from an arbitrary input rate to a lower output rate.
+    //
+    // The input is first reduced by an integer factor with a boxcar average, such that the
+    // intermediate rate is at least twice the output rate, and then fed through a polyphase
+    // windowed-sinc FIR. All storage is fixed-size, so the object can be copied freely.
+    class Resampler {
+    public:
+        static constexpr int MAX_TAPS   = 48;
+        static constexpr int PHASE_BITS = 6;
+        static constexpr int N_PHASES   = 1 << PHASE_BITS;
+
+        void configure(double input_rate, int output_rate, ResamplerQuality quality);
+        void reset();
+
+        // number of input frames that must be passed to process() to get exactly n_out output frames
+        int input_frames_needed(int n_out) const;
+
+        // consumes n_in input frames and writes at most max_out output frames, returns number of frames written
+        int process(const int16_t *in, int n_in, int16_t *out, int max_out);
+
+    private:
+        static constexpr int HISTORY_SIZE = 256 + MAX_TAPS;
+
+        int      n_taps{MAX_TAPS};
+        int      decimation{1};
+        uint64_t step{uint64_t(1) << 32}; // intermediate samples per output sample, 32.32 fixed point
+
+        // boxcar stage state
+        int32_t box_acc[2]{0, 0};
+        int     box_count{0};
+
+        // FIR stage state
+        std::array<int16_t, HISTORY_SIZE>        history_l{};
+        std::array<int16_t, HISTORY_SIZE>        history_r{};
+        int                                      history_len{0};
+        uint64_t                                 position{0}; // first tap of next output, 32.32 fixed point
+        std::array<int16_t, N_PHASES * MAX_TAPS> coeffs{};
+    };
+
+} // namespace gb_sound
+
+#endif /* RESAMPLER_H */
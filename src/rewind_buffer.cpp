@@ -0,0 +1,148 @@
+#include "rewind_buffer.h"
+
+#include "gameboy.h"
+
+#include <algorithm>
+#include <cstring>
+
+// worst case of the encoding: one zero run and one literal header per state, plus the literals
+static size_t max_encoded_size(size_t state_size) {
+    return state_size + 2 * 10;
+}
+
+static uint8_t *put_varint(uint8_t *out, size_t v) {
+    while (v >= 0x80) {
+        *out++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *out++ = v;
+    return out;
+}
+
+static const uint8_t *get_varint(const uint8_t *in, size_t &v) {
+    v         = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        v |= static_cast<size_t>(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    v |= static_cast<size_t>(*in++) << shift;
+    return in;
+}
+
+RewindBuffer::RewindBuffer(size_t state_size, size_t max_bytes)
+    : state_size(state_size),
+      head(state_size),
+      next(state_size),
+      scratch(max_encoded_size(state_size)),
+      ring(std::max(max_bytes, 2 * max_encoded_size(state_size))) {
+}
+
+void RewindBuffer::push(const Gameboy &gb) {
+    gb.save_state(this->next.data(), this->state_size);
+
+    if (this->has_head) {
+        const size_t length = this->encode_delta(this->head.data(), this->next.data(), this->scratch.data());
+        this->store(this->scratch.data(), length);
+    }
+
+    std::swap(this->head, this->next);
+    this->has_head = true;
+}
+
+bool RewindBuffer::rewind(Gameboy &gb) {
+    if (!this->has_head) {
+        return false;
+    }
+
+    gb.load_state(this->head.data(), this->state_size);
+
+    if (this->entries.empty()) {
+        this->has_head = false;
+    } else {
+        const Entry &e = this->entries.back();
+        this->apply_delta(this->ring.data() + e.offset, e.length, this->head.data());
+        this->entries.pop_back();
+    }
+    return true;
+}
+
+void RewindBuffer::clear() {
+    this->entries.clear();
+    this->has_head = false;
+}
+
+// The delta of two states is encoded as a sequence of (zero run length, literal length, literal bytes)
+// with varint lengths, the literals being the XOR of the differing bytes.
+size_t RewindBuffer::encode_delta(const uint8_t *a, const uint8_t *b, uint8_t *out) const {
+    uint8_t *const start = out;
+
+    size_t i = 0;
+    while (i < this->state_size) {
+        size_t zeros = 0;
+        while (i + zeros < this->state_size && a[i + zeros] == b[i + zeros]) {
+            zeros++;
+        }
+        i += zeros;
+
+        // end a literal only at a zero run of a few bytes, shorter ones are cheaper to keep inline
+        size_t literal = 0;
+        size_t equal   = 0;
+        while (i + literal < this->state_size && equal < 4) {
+            equal = (a[i + literal] == b[i + literal]) ? equal + 1 : 0;
+            literal++;
+        }
+        literal -= equal;
+
+        out = put_varint(out, zeros);
+        out = put_varint(out, literal);
+        for (size_t j = 0; j < literal; j++) {
+            *out++ = a[i + j] ^ b[i + j];
+        }
+        i += literal;
+    }
+
+    return out - start;
+}
+
+void RewindBuffer::apply_delta(const uint8_t *delta, size_t length, uint8_t *state) const {
+    const uint8_t *end = delta + length;
+    size_t         i   = 0;
+    while (delta < end) {
+        size_t zeros, literal;
+        delta = get_varint(delta, zeros);
+        delta = get_varint(delta, literal);
+        i += zeros;
+        for (size_t j = 0; j < literal; j++) {
+            state[i + j] ^= delta[j];
+        }
+        delta += literal;
+        i += literal;
+    }
+}
+
+void RewindBuffer::store(const uint8_t *data, size_t length) {
+    // append after the newest entry, wrapping to the start of the ring if it does not fit
+    size_t append_at = 0;
+    if (!this->entries.empty()) {
+        append_at = this->entries.back().offset + this->entries.back().length;
+    }
+    const bool   wrap   = append_at + length > this->ring.size();
+    const size_t offset = wrap ? 0 : append_at;
+    const size_t end    = offset + length;
+
+    // Drop the oldest entries that would be overwritten. After wrapping, the entries between the old
+    // append position and the end of the ring are older than the overwritten ones, so they go as well.
+    while (!this->entries.empty()) {
+        const Entry &oldest   = this->entries.front();
+        const bool   overlaps = oldest.offset < end && offset < oldest.offset + oldest.length;
+        const bool   stranded = wrap && oldest.offset >= append_at;
+        if (!overlaps && !stranded) {
+            break;
+        }
+        this->entries.pop_front();
+    }
+
+    std::memcpy(this->ring.data() + offset, data, length);
+    this->entries.push_back({offset, length});
+}
@@ -0,0 +1,52 @@
+#ifndef REWIND_BUFFER_H
+#define REWIND_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class Gameboy;
+
+// History of save states in bounded memory. Only the newest state is kept verbatim, every older one is
+// stored as the XOR with its successor, run-length encoded. Successive states differ in few bytes, so
+// these deltas are tiny, and stepping back one snapshot is a single decode pass over the state.
+// When the memory budget is exhausted the oldest snapshots are dropped.
+class RewindBuffer {
+public:
+    RewindBuffer(size_t state_size, size_t max_bytes);
+
+    void push(const Gameboy &gb);
+
+    // loads the newest snapshot into `gb` and removes it, returns false if the history is empty
+    bool rewind(Gameboy &gb);
+
+    void clear();
+
+    // number of snapshots held
+    size_t size() const {
+        return this->has_head ? this->entries.size() + 1 : 0;
+    }
+
+private:
+    struct Entry {
+        size_t offset;
+        size_t length;
+    };
+
+    size_t encode_delta(const uint8_t *a, const uint8_t *b, uint8_t *out) const;
+    void   apply_delta(const uint8_t *delta, size_t length, uint8_t *state) const;
+    void   store(const uint8_t *data, size_t length);
+
+    size_t               state_size;
+    std::vector<uint8_t> head;
+    std::vector<uint8_t> next;
+    std::vector<uint8_t> scratch;
+    bool                 has_head{false};
+
+    // ring of encoded deltas, oldest first
+    std::vector<uint8_t> ring;
+    std::deque<Entry>    entries;
+};
+
+#endif /* REWIND_BUFFER_H */
@@ -0,0 +1,70 @@
+#include "rom_image.h"
+
+#include <fmt/core.h>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+RomHandle RomImage::load(const std::filesystem::path &path) {
+    static std::mutex                                                     cache_mutex;
+    static std::map<std::filesystem::path, std::weak_ptr<const RomImage>> cache;
+
+    const auto key = std::filesystem::weakly_canonical(path);
+
+    std::lock_guard lock(cache_mutex);
+
+    // drop the images nobody holds anymore, loads are rare and the cache is small
+    std::erase_if(cache, [](const auto &entry) { return entry.second.expired(); });
+    if (const auto it = cache.find(key); it != cache.end()) {
+        // the last holder may have let go since the sweep
+        if (auto existing = it->second.lock()) {
+            return existing;
+        }
+    }
+
+    const int fd = open(key.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format("Failed to open ROM \"{}\": {}", path.string(), strerror(errno)));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error(fmt::format("Failed to read ROM \"{}\": empty or unreadable", path.string()));
+    }
+
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error(fmt::format("Failed to map ROM \"{}\": {}", path.string(), strerror(errno)));
+    }
+
+    std::shared_ptr<RomImage> image(new RomImage());
+    image->mapping = mapping;
+    image->bytes   = static_cast<const uint8_t *>(mapping);
+    image->n_bytes = st.st_size;
+
+    cache[key] = image;
+    return image;
+}
+
+RomHandle RomImage::from_bytes(std::vector<uint8_t> bytes) {
+    std::shared_ptr<RomImage> image(new RomImage());
+    image->storage = std::move(bytes);
+    image->bytes   = image->storage.data();
+    image->n_bytes = image->storage.size();
+    return image;
+}
+
+RomImage::~RomImage() {
+    if (this->mapping != nullptr) {
+        munmap(this->mapping, this->n_bytes);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef ROM_IMAGE_H
+#define ROM_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+class RomImage;
+
+// Shared, immutable cartridge ROM. Any number of Gameboy instances can hold the same handle.
+using RomHandle = std::shared_ptr<const RomImage>;
+
+class RomImage {
+public:
+    // Maps the file read-only. Loading a path that is already loaded returns the existing image.
+    static RomHandle load(const std::filesystem::path &path);
+
+    // Wraps ROM contents that are already in memory, e.g. generated ones.
+    static RomHandle from_bytes(std::vector<uint8_t> bytes);
+
+    RomImage(const RomImage &)            = delete;
+    RomImage &operator=(const RomImage &) = delete;
+    ~RomImage();
+
+    const uint8_t *data() const {
+        return this->bytes;
+    }
+
+    size_t size() const {
+        return this->n_bytes;
+    }
+
+    uint8_t operator[](size_t i) const {
+        return this->bytes[i];
+    }
+
+private:
+    RomImage() = default;
+
+    const uint8_t       *bytes{nullptr};
+    size_t               n_bytes{0};
+    void                *mapping{nullptr};
+    std::vector<uint8_t> storage;
+};
+
+#endif /* ROM_IMAGE_H */
@@ -0,0 +1,169 @@
+#include "save_ram.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr size_t PAGE_SIZE = size_t(1) << SaveRam::PAGE_BITS;
+
+SaveRam::SaveRam(size_t size, size_t footer_size) : storage(size + footer_size, 0xff) {
+    this->bytes          = this->storage.data();
+    this->n_bytes        = size;
+    this->n_footer_bytes = footer_size;
+}
+
+SaveRam::SaveRam(const SaveRam &other)
+    : storage(other.bytes, other.bytes + other.n_bytes + other.n_footer_bytes) {
+    this->bytes          = this->storage.data();
+    this->n_bytes        = other.n_bytes;
+    this->n_footer_bytes = other.n_footer_bytes;
+}
+
+SaveRam &SaveRam::operator=(const SaveRam &other) {
+    if (this != &other) {
+        if (other.n_bytes != this->n_bytes || other.n_footer_bytes != this->n_footer_bytes) {
+            throw std::runtime_error("Cannot assign cartridge RAM of a different size");
+        }
+        this->assign(other.bytes);
+    }
+    return *this;
+}
+
+SaveRam::~SaveRam() {
+    this->detach_file();
+}
+
+SaveRam::Attached SaveRam::attach_file(const std::filesystem::path &path) {
+    const size_t file_size = this->n_bytes + this->n_footer_bytes;
+    if (file_size == 0) {
+        return Attached::CREATED;
+    }
+    this->detach_file();
+
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format("Failed to open save file \"{}\": {}", path.string(), strerror(errno)));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error(fmt::format("Failed to read save file \"{}\": {}", path.string(), strerror(errno)));
+    }
+
+    const size_t old_size = st.st_size;
+    if (old_size != 0 && old_size != this->n_bytes && old_size != file_size) {
+        ::close(fd);
+        throw std::runtime_error(fmt::format("Save file \"{}\" has size {}, expected {} or {}",
+                                             path.string(),
+                                             old_size,
+                                             this->n_bytes,
+                                             file_size));
+    }
+
+    if (old_size != file_size && ftruncate(fd, file_size) != 0) {
+        ::close(fd);
+        throw std::runtime_error(fmt::format("Failed to resize save file \"{}\": {}", path.string(), strerror(errno)));
+    }
+
+    void *map = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error(fmt::format("Failed to map save file \"{}\": {}", path.string(), strerror(errno)));
+    }
+
+    // fill in what the file did not hold from the current contents
+    uint8_t *mapped = static_cast<uint8_t *>(map);
+    std::copy(this->storage.begin() + old_size, this->storage.end(), mapped + old_size);
+
+    this->mapping = map;
+    this->bytes   = mapped;
+    this->storage.clear();
+    this->storage.shrink_to_fit();
+
+    if (old_size == 0) {
+        this->dirty_pages = ~uint64_t(0);
+        return Attached::CREATED;
+    }
+    if (old_size != file_size) {
+        this->mark_dirty(this->n_bytes, this->n_footer_bytes);
+        return Attached::LOADED_RAM;
+    }
+    return Attached::LOADED;
+}
+
+void SaveRam::assign(const uint8_t *data) {
+    std::copy(data, data + this->n_bytes, this->bytes);
+    this->mark_dirty(0, this->n_bytes);
+}
+
+void SaveRam::write_footer(const uint8_t *data) {
+    if (this->n_footer_bytes == 0) {
+        return;
+    }
+
+    std::copy(data, data + this->n_footer_bytes, this->bytes + this->n_bytes);
+    this->mark_dirty(this->n_bytes, this->n_footer_bytes);
+}
+
+void SaveRam::mark_dirty(size_t offset, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    for (size_t page = offset >> PAGE_BITS; page <= (offset + n - 1) >> PAGE_BITS; page++) {
+        this->dirty_pages |= uint64_t(1) << page;
+    }
+}
+
+void SaveRam::flush() {
+    if (this->mapping == nullptr || this->dirty_pages == 0) {
+        return;
+    }
+
+    // msync wants addresses aligned to the host page size, which may be larger than our dirty pages
+    const uintptr_t host_page = sysconf(_SC_PAGESIZE);
+    const uintptr_t base      = reinterpret_cast<uintptr_t>(this->bytes);
+    const size_t    file_size = this->n_bytes + this->n_footer_bytes;
+
+    uint64_t pages = this->dirty_pages;
+    while (pages != 0) {
+        const int first = __builtin_ctzll(pages);
+        int       last  = first;
+        while (last + 1 < 64 && (pages & (uint64_t(1) << (last + 1))) != 0) {
+            last++;
+        }
+        pages &= (last == 63) ? 0 : ~((uint64_t(1) << (last + 1)) - 1);
+
+        const size_t begin_offset = first * PAGE_SIZE;
+        if (begin_offset >= file_size) {
+            break;
+        }
+        const uintptr_t begin = (base + begin_offset) & ~(host_page - 1);
+        const uintptr_t end   = base + std::min((last + 1) * PAGE_SIZE, file_size);
+        msync(reinterpret_cast<void *>(begin), end - begin, MS_ASYNC);
+    }
+    this->dirty_pages = 0;
+}
+
+void SaveRam::detach_file() {
+    if (this->mapping == nullptr) {
+        return;
+    }
+
+    // keep the contents in memory, and make sure everything has reached the file before unmapping
+    const size_t file_size = this->n_bytes + this->n_footer_bytes;
+    this->storage.assign(this->bytes, this->bytes + file_size);
+    msync(this->mapping, file_size, MS_SYNC);
+    munmap(this->mapping, file_size);
+
+    this->mapping     = nullptr;
+    this->bytes       = this->storage.data();
+    this->dirty_pages = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef SAVE_RAM_H
+#define SAVE_RAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Cartridge RAM. Initially held in memory; battery backed cartridges can attach a .sav file, after which
+// the RAM is a shared mapping of that file. Writes mark 4 KiB pages dirty, and flush() only hands those
+// pages to the kernel for asynchronous write-back, so it is cheap enough to call every few frames.
+// A small footer after the RAM holds additional cartridge state, e.g. the MBC3 real-time clock.
+class SaveRam {
+public:
+    static constexpr int PAGE_BITS = 12;
+
+    explicit SaveRam(size_t size, size_t footer_size = 0);
+    ~SaveRam();
+
+    // A copy holds the contents in memory and is not attached to the save file. Assignment copies the
+    // contents, which must be of the same size, and keeps the target's backing store.
+    SaveRam(const SaveRam &other);
+    SaveRam &operator=(const SaveRam &other);
+
+    enum class Attached {
+        CREATED,    // the file did not exist and was created from the current contents
+        LOADED,     // the RAM and the footer were loaded from the file
+        LOADED_RAM, // the file only held the RAM, as written by emulators without a footer, and was extended
+                    // with the current footer
+    };
+
+    // maps `path` as backing store, loading its contents if it exists or creating it from the current contents
+    Attached attach_file(const std::filesystem::path &path);
+
+    // start write-back of the pages written since the last flush, does not wait for completion
+    void flush();
+
+    size_t size() const {
+        return this->n_bytes;
+    }
+
+    bool empty() const {
+        return this->n_bytes == 0;
+    }
+
+    const uint8_t *data() const {
+        return this->bytes;
+    }
+
+    uint8_t operator[](size_t i) const {
+        return this->bytes[i];
+    }
+
+    void write(size_t i, uint8_t data) {
+        this->bytes[i] = data;
+        this->dirty_pages |= uint64_t(1) << (i >> PAGE_BITS);
+    }
+
+    // replace the whole RAM contents, e.g. when loading a save state
+    void assign(const uint8_t *data);
+
+    const uint8_t *footer() const {
+        return this->bytes + this->n_bytes;
+    }
+
+    void write_footer(const uint8_t *data);
+
+private:
+    void detach_file();
+    void mark_dirty(size_t offset, size_t n);
+
+    uint8_t             *bytes;
+    size_t               n_bytes;
+    size_t               n_footer_bytes;
+    void                *mapping{nullptr};
+    uint64_t             dirty_pages{0}; // one bit per page, cartridge RAM is at most 128 KiB
+    std::vector<uint8_t> storage;
+};
+
+#endif /* SAVE_RAM_H */
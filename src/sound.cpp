@@ -1,7 +1,10 @@
 #include "sound.h"
+#include "state_stream.h"
 
 #include <fmt/core.h>
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 
 #define REG_NR10 0x10
 #define REG_NR11 0x11
@@ -28,13 +31,20 @@
 #define COUNTER_WIDTH_7BITS  true
 #define COUNTER_WIDTH_15BITS false
 
-constexpr uint64_t CLK_DIV_64HZ  = (1 << 22) / (1 << 6);
-constexpr uint64_t CLK_DIV_128HZ = (1 << 22) / (1 << 7);
-constexpr uint64_t CLK_DIV_256HZ = (1 << 22) / (1 << 8);
-
 namespace gb_sound {
 
+    Sound::Sound() {
+        this->set_resampler_quality(ResamplerQuality::HIGH);
+    }
+
+    void Sound::set_resampler_quality(ResamplerQuality quality) {
+        this->synth_rate = quality == ResamplerQuality::HIGH ? SYNTH_RATE_HIGH : SYNTH_RATE_FAST;
+        this->resampler.configure(this->synth_rate, SAMPLE_RATE, quality);
+    }
+
     void Sound::reset() {
+        this->frame_sequencer_step = 0;
+
         this->write_reg(REG_NR10, 0x80);
         this->write_reg(REG_NR11, 0xBF);
         this->write_reg(REG_NR12, 0xF3);
@@ -55,106 +65,339 @@ namespace gb_sound {
         this->write_reg(REG_NR52, 0xF1); //($F0-SGB)
     }
 
-    void Sound::do_tick(uint64_t clock) {
+    void Sound::step_frame_sequencer() {
         if (!this->master_on) {
             return;
         }
 
-        // length ctr - 256 Hz
-        if ((clock & (CLK_DIV_256HZ - 1)) == 0) {
+        // Step   Length Ctr  Vol Env     Sweep
+        // ---------------------------------------
+        // 0      Clock       -           -
+        // 1      -           -           -
+        // 2      Clock       -           Clock
+        // 3      -           -           -
+        // 4      Clock       -           -
+        // 5      -           -           -
+        // 6      Clock       -           Clock
+        // 7      -           Clock       -
+        switch (this->frame_sequencer_step) {
+            case 0:
+            case 4:
+                this->clock_lengths();
+                break;
+            case 2:
+            case 6:
+                this->clock_lengths();
+                this->clock_sweep();
+                break;
+            case 7:
+                this->clock_envelopes();
+                break;
+            default:
+                break;
+        }
+
+        this->frame_sequencer_step = (this->frame_sequencer_step + 1) & 0x7;
+    }
+
+    void Sound::clock_lengths() {
+        // decrement len counter
+        // if reaches 0, disable channel
+        if (this->ch1_counter_consecutive && this->ch1_length > 0 && --this->ch1_length == 0) {
+            this->ch1_active = false;
+        }
+        if (this->ch2_counter_consecutive && this->ch2_length > 0 && --this->ch2_length == 0) {
+            this->ch2_active = false;
+        }
+        if (this->ch3_counter_consecutive && this->ch3_length > 0 && --this->ch3_length == 0) {
+            this->ch3_active = false;
+        }
+        if (this->ch4_counter_consecutive && this->ch4_length > 0 && --this->ch4_length == 0) {
+            this->ch4_active = false;
+        }
+    }
+
+    uint16_t Sound::ch1_sweep_next_freq() {
+        const uint16_t delta = this->ch1_sweep_shadow_freq >> this->ch1_sweep_n_steps;
+        const uint16_t freq  = this->ch1_sweep_dir_decrease ? this->ch1_sweep_shadow_freq - delta
+                                                            : this->ch1_sweep_shadow_freq + delta;
+        if (freq > 2047) {
+            this->ch1_active = false;
+        }
+        return freq;
+    }
+
+    void Sound::clock_sweep() {
+        if (this->ch1_sweep_timer > 0) {
+            this->ch1_sweep_timer--;
+        }
+        if (this->ch1_sweep_timer != 0) {
+            return;
+        }
 
-            // decrement len counter
-            // if reaches 0, disable channel
+        // a sweep time of 0 is treated as 8
+        this->ch1_sweep_timer = this->ch1_sweep_time ? this->ch1_sweep_time : 8;
 
-            // channel 1
-            if (this->ch1_counter_consecutive && this->ch1_length > 0) {
-                this->ch1_length--;
+        if (this->ch1_sweep_enabled && this->ch1_sweep_time > 0) {
+            const uint16_t freq = this->ch1_sweep_next_freq();
+            if (freq <= 2047 && this->ch1_sweep_n_steps > 0) {
+                this->ch1_sweep_shadow_freq = freq;
+                this->ch1_freq              = freq;
+                // overflow check once more with the new frequency
+                this->ch1_sweep_next_freq();
             }
+        }
+    }
 
-            // channel 2
-            if (this->ch2_counter_consecutive && this->ch2_length > 0) {
-                this->ch2_length--;
+    static void clock_envelope(uint8_t &volume, uint8_t &timer, uint8_t n_steps, bool increase) {
+        if (n_steps == 0 || timer == 0) {
+            return;
+        }
+        if (--timer == 0) {
+            timer = n_steps;
+            if (increase && volume < 15) {
+                volume++;
+            } else if (!increase && volume > 0) {
+                volume--;
             }
         }
+    }
 
-        // sweep - 128 Hz
-        if ((clock & (CLK_DIV_128HZ - 1)) == 0) {
+    void Sound::clock_envelopes() {
+        clock_envelope(this->ch1_volume, this->ch1_env_timer, this->ch1_env_n_steps, this->ch1_env_dir_increase);
+        clock_envelope(this->ch2_volume, this->ch2_env_timer, this->ch2_env_n_steps, this->ch2_env_dir_increase);
+        clock_envelope(this->ch4_volume, this->ch4_env_timer, this->ch4_env_n_steps, this->ch4_env_dir_increase);
+    }
+
+    // the DAC of channels with envelopes is off when the upper 5 bits of NRx2 are zero
+    static bool dac_enabled(uint8_t initial_vol, bool dir_increase) {
+        return initial_vol != 0 || dir_increase;
+    }
+
+    void Sound::trigger_ch1() {
+        this->ch1_active = dac_enabled(this->ch1_env_initial_vol, this->ch1_env_dir_increase);
+        if (this->ch1_length == 0) {
+            this->ch1_length = 64;
+        }
+        this->ch1_volume    = this->ch1_env_initial_vol;
+        this->ch1_env_timer = this->ch1_env_n_steps;
+
+        this->ch1_sweep_shadow_freq = this->ch1_freq;
+        this->ch1_sweep_timer       = this->ch1_sweep_time ? this->ch1_sweep_time : 8;
+        this->ch1_sweep_enabled     = this->ch1_sweep_time > 0 || this->ch1_sweep_n_steps > 0;
+        if (this->ch1_sweep_n_steps > 0) {
+            this->ch1_sweep_next_freq();
+        }
+    }
+
+    void Sound::trigger_ch2() {
+        this->ch2_active = dac_enabled(this->ch2_env_initial_vol, this->ch2_env_dir_increase);
+        if (this->ch2_length == 0) {
+            this->ch2_length = 64;
         }
+        this->ch2_volume    = this->ch2_env_initial_vol;
+        this->ch2_env_timer = this->ch2_env_n_steps;
+    }
 
-        // vol env - 64 Hz
-        if ((clock & (CLK_DIV_64HZ - 1)) == 0) {
+    void Sound::trigger_ch3() {
+        this->ch3_active = this->ch3_on;
+        this->ch3_phase  = 0;
+        if (this->ch3_length == 0) {
+            this->ch3_length = 256;
         }
     }
 
+    void Sound::trigger_ch4() {
+        this->ch4_active = dac_enabled(this->ch4_env_initial_vol, this->ch4_env_dir_increase);
+        if (this->ch4_length == 0) {
+            this->ch4_length = 64;
+        }
+        this->ch4_volume    = this->ch4_env_initial_vol;
+        this->ch4_env_timer = this->ch4_env_n_steps;
+        this->ch4_lfsr      = 0x7fff;
+        this->ch4_phase     = 0;
+    }
+
     void Sound::render(int16_t *buffer, int n_frames) {
+        static_assert(N_CHANNELS == 2, "Resampler expects interleaved stereo");
+
+        while (n_frames > 0) {
+            const int n_out = std::min(n_frames, BLOCK_SIZE);
+
+            // synthesize exactly as much as the resampler needs for this block
+            int n_in     = this->resampler.input_frames_needed(n_out);
+            int produced = 0;
+            while (n_in > 0) {
+                const int chunk = std::min(n_in, SYNTH_BLOCK_SIZE);
+                this->synthesize(this->synth_buffer.data(), chunk);
+                produced += this->resampler.process(this->synth_buffer.data(),
+                                                    chunk,
+                                                    buffer + N_CHANNELS * produced,
+                                                    n_out - produced);
+                n_in -= chunk;
+            }
 
-        if (!this->master_on) {
-            memset(buffer, 0, n_frames * N_CHANNELS * sizeof(int16_t));
+            if (produced < n_out) {
+                memset(buffer + N_CHANNELS * produced, 0, (n_out - produced) * N_CHANNELS * sizeof(int16_t));
+            }
+
+            buffer += N_CHANNELS * n_out;
+            n_frames -= n_out;
+        }
+    }
+
+    // Per-channel amplitude step. At most 4 channels of volume 15 -> 4080, and a master volume multiplier of
+    // at most 8 keeps the mixed output within int16.
+    constexpr int16_t AMPLITUDE_STEP = 68;
+
+    // square wave duty cycles, as thresholds on a 32 bit phase
+    constexpr uint32_t DUTY_THRESHOLDS[4] = {0x20000000U, 0x40000000U, 0x80000000U, 0xC0000000U};
+
+    static void render_square(int16_t  *out,
+                              int       n,
+                              bool      active,
+                              uint8_t   volume,
+                              uint8_t   duty,
+                              uint16_t  freq,
+                              uint32_t &phase,
+                              int       synth_rate) {
+        if (!active) {
+            std::fill(out, out + n, 0);
             return;
         }
 
-        // channel 1
-        const float    ch1_frequency = float(131072) / (2048 - this->ch1_freq);
-        const uint32_t ch1_dphase    = ch1_frequency / SAMPLE_RATE * static_cast<float>(UINT32_MAX);
+        const float    frequency = float(131072) / (2048 - freq);
+        const uint32_t dphase    = frequency / synth_rate * static_cast<float>(UINT32_MAX);
+        const uint32_t threshold = DUTY_THRESHOLDS[duty & 0x3];
+        const int16_t  amplitude = volume * AMPLITUDE_STEP;
 
-        // channel 2
-        const float    ch2_frequency = float(131072) / (2048 - this->ch2_freq);
-        const uint32_t ch2_dphase    = ch2_frequency / SAMPLE_RATE * static_cast<float>(UINT32_MAX);
+        for (int i = 0; i < n; i++) {
+            out[i] = (phase < threshold) ? amplitude : -amplitude;
+            phase += dphase;
+        }
+    }
 
-        const int8_t ch1_vol = ch1_env_initial_vol;
-        const int8_t ch2_vol = ch2_env_initial_vol;
+    // Advances the noise LFSR by k steps at once. Within a batch every feedback bit only depends on bits of
+    // the initial state, so the whole batch is a shift and an xor. Valid for k <= 14 in 15 bit mode and
+    // k <= 6 in 7 bit mode, where the feedback is also written to bit 6.
+    static uint16_t lfsr_advance(uint16_t lfsr, int k, bool width_7bits) {
+        const uint16_t mask     = (1 << k) - 1;
+        const uint16_t feedback = (lfsr ^ (lfsr >> 1)) & mask;
 
-        for (int i = 0; i < n_frames; i++) {
+        uint16_t res = (lfsr >> k) | (feedback << (15 - k));
+        if (width_7bits) {
+            res = (res & ~(mask << (7 - k))) | (feedback << (7 - k));
+        }
+        return res;
+    }
 
-            int16_t ch1val = 0;
-            if (this->ch1_length > 0) {
-                const int16_t amplitude = ch1_vol * 136; // [0.033211235,0.4981685]  in Q12
-                                                         // [0.06640625, 0.99609375] in Q11
-                ch1val = (this->ch1_phase < 0x80000000U) ? amplitude : -amplitude;
-                this->ch1_phase += ch1_dphase;
-            }
+    void Sound::render_wave(int16_t *out, int n) {
+        // level: 0 -> mute, 1 -> 100%, 2 -> 50%, 3 -> 25%
+        if (!this->ch3_active || this->ch3_level == 0) {
+            std::fill(out, out + n, 0);
+            return;
+        }
 
-            int16_t ch2val = 0;
-            if (this->ch2_length > 0) {
-                const int16_t amplitude = ch2_vol * 136; // [0.033211235,0.4981685]  in Q12
-                                                         // [0.06640625, 0.99609375] in Q11
-                ch2val = (this->ch2_phase < 0x80000000U) ? amplitude : -amplitude;
-                this->ch2_phase += ch2_dphase;
-            }
+        // 32 4-bit samples, high nibble first, centered and scaled like the other channels
+        const int shift = this->ch3_level - 1;
+        int16_t   samples[32];
+        for (int i = 0; i < 16; i++) {
+            const int hi       = (this->wave_ram[i] >> 4) >> shift;
+            const int lo       = (this->wave_ram[i] & 0xf) >> shift;
+            samples[2 * i + 0] = (2 * hi - 15) * AMPLITUDE_STEP;
+            samples[2 * i + 1] = (2 * lo - 15) * AMPLITUDE_STEP;
+        }
 
-            // left output
+        const float    frequency = float(65536) / (2048 - this->ch3_freq); // full waveform
+        const uint32_t dphase    = frequency / this->synth_rate * static_cast<float>(UINT32_MAX);
 
-            // At most 2x individual channel values ->
-            // [0, 0.99609375] in Q12
-            int16_t leftval = 0;
+        for (int i = 0; i < n; i++) {
+            out[i] = samples[this->ch3_phase >> 27];
+            this->ch3_phase += dphase;
+        }
+    }
 
-            if (this->channel_matrix & 0x1) {
-                leftval += ch1val;
-            }
-            if (this->channel_matrix & 0x2) {
-                leftval += ch2val;
-            }
+    void Sound::render_noise(int16_t *out, int n) {
+        // shift clock frequencies 14 and 15 stop the LFSR
+        if (!this->ch4_active || this->ch4_shift_clock >= 14) {
+            std::fill(out, out + n, 0);
+            return;
+        }
 
-            // so1_vol ~ 0-7 , mult by (so1_vol+1) ->
-            // [0, 0.99609375] in Q15
+        const double divisor = this->ch4_div_ratio == 0 ? 0.5 : this->ch4_div_ratio;
+        const double rate    = 524288.0 / divisor / (2 << this->ch4_shift_clock);
+        const auto   dstep   = static_cast<uint64_t>(rate / this->synth_rate * 4294967296.0);
 
-            // From https://gbdev.gg8.se/wiki/articles/Gameboy_sound_hardware
-            // The mixed left/right signals go to the left/right master volume controls. These multiply the signal by
-            // (volume+1). The volume step relative to the channel DAC is such that a single channel enabled via NR51
-            // playing at volume of 2 with a master volume of 7 is about as loud as that channel playing at volume 15
-            // with a master volume of 0.
+        const bool    width_7bits = this->ch4_counter_width == COUNTER_WIDTH_7BITS;
+        const int     max_batch   = width_7bits ? 6 : 14;
+        const int16_t amplitude   = this->ch4_volume * AMPLITUDE_STEP;
 
-            buffer[N_CHANNELS * i + 0] = (this->so1_vol + 1) * leftval;
+        for (int i = 0; i < n; i++) {
+            this->ch4_phase += dstep;
+            int n_steps = this->ch4_phase >> 32;
+            this->ch4_phase &= 0xffffffff;
 
-            // right output
-            int16_t rightval = 0;
-            if (this->channel_matrix & 0x10) {
-                rightval += ch1val;
+            while (n_steps > 0) {
+                const int k = std::min(n_steps, max_batch);
+                this->ch4_lfsr = lfsr_advance(this->ch4_lfsr, k, width_7bits);
+                n_steps -= k;
             }
-            if (this->channel_matrix & 0x20) {
-                rightval += ch2val;
+
+            // output is the inverted bit 0
+            out[i] = (this->ch4_lfsr & 0x1) ? -amplitude : amplitude;
+        }
+    }
+
+    void Sound::synthesize(int16_t *buffer, int n_frames) {
+
+        if (!this->master_on) {
+            memset(buffer, 0, n_frames * N_CHANNELS * sizeof(int16_t));
+            return;
+        }
+
+        // From https://gbdev.gg8.se/wiki/articles/Gameboy_sound_hardware
+        // The mixed left/right signals go to the left/right master volume controls. These multiply the signal by
+        // (volume+1). The volume step relative to the channel DAC is such that a single channel enabled via NR51
+        // playing at volume of 2 with a master volume of 7 is about as loud as that channel playing at volume 15
+        // with a master volume of 0.
+        int16_t so1_gain[4];
+        int16_t so2_gain[4];
+        for (int c = 0; c < 4; c++) {
+            so1_gain[c] = (this->channel_matrix & (0x01 << c)) ? this->so1_vol + 1 : 0;
+            so2_gain[c] = (this->channel_matrix & (0x10 << c)) ? this->so2_vol + 1 : 0;
+        }
+
+        int16_t ch_out[4][MIX_BLOCK_SIZE];
+
+        for (int offset = 0; offset < n_frames; offset += MIX_BLOCK_SIZE) {
+            const int n = std::min(MIX_BLOCK_SIZE, n_frames - offset);
+
+            render_square(ch_out[0],
+                          n,
+                          this->ch1_active,
+                          this->ch1_volume,
+                          this->ch1_duty,
+                          this->ch1_freq,
+                          this->ch1_phase,
+                          this->synth_rate);
+            render_square(ch_out[1],
+                          n,
+                          this->ch2_active,
+                          this->ch2_volume,
+                          this->ch2_duty,
+                          this->ch2_freq,
+                          this->ch2_phase,
+                          this->synth_rate);
+            this->render_wave(ch_out[2], n);
+            this->render_noise(ch_out[3], n);
+
+            int16_t *out = buffer + N_CHANNELS * offset;
+            for (int i = 0; i < n; i++) {
+                out[N_CHANNELS * i + 0] = so1_gain[0] * ch_out[0][i] + so1_gain[1] * ch_out[1][i] +
+                                          so1_gain[2] * ch_out[2][i] + so1_gain[3] * ch_out[3][i];
+                out[N_CHANNELS * i + 1] = so2_gain[0] * ch_out[0][i] + so2_gain[1] * ch_out[1][i] +
+                                          so2_gain[2] * ch_out[2][i] + so2_gain[3] * ch_out[3][i];
             }
-            buffer[N_CHANNELS * i + 1] = (this->so2_vol + 1) * rightval;
         }
     }
 
@@ -210,8 +453,9 @@ namespace gb_sound {
             case REG_NR51:
                 return this->channel_matrix;
             case REG_NR52:
-                fmt::print("Read from Sound Controller Register ${:02X}\n", regid);
-                return 0xff; //(static_cast<uint8_t>(this->master_on)<<7)|(this->)|()|()|()|0x70;
+                return (static_cast<uint8_t>(this->master_on) << 7) | 0x70 |
+                       (static_cast<uint8_t>(this->ch4_active) << 3) | (static_cast<uint8_t>(this->ch3_active) << 2) |
+                       (static_cast<uint8_t>(this->ch2_active) << 1) | static_cast<uint8_t>(this->ch1_active);
 
             // wave pattern ram
             case 0x30:
@@ -230,8 +474,7 @@ namespace gb_sound {
             case 0x3d:
             case 0x3e:
             case 0x3f:
-                fmt::print("Read from Sound Controller Wave Pattern RAM: ${:02X}\n", regid);
-                return 0xff;
+                return this->wave_ram[regid - 0x30];
             default:
                 throw std::runtime_error(fmt::format("Invalid regid passed to Sound: {}", regid));
         }
@@ -252,6 +495,9 @@ namespace gb_sound {
                 this->ch1_env_n_steps      = data & 0x7;
                 this->ch1_env_dir_increase = data & (1 << 3);
                 this->ch1_env_initial_vol  = (data >> 4) & 0xf;
+                if (!dac_enabled(this->ch1_env_initial_vol, this->ch1_env_dir_increase)) {
+                    this->ch1_active = false;
+                }
                 break;
             case REG_NR13:
                 this->ch1_freq = (this->ch1_freq & 0x700) | data;
@@ -260,7 +506,7 @@ namespace gb_sound {
                 this->ch1_freq                = (static_cast<uint16_t>(data & 0x7) << 8) | (this->ch1_freq & 0xff);
                 this->ch1_counter_consecutive = data & (1 << 6);
                 if (data & (1 << 7)) {
-                    this->ch1_initial = true;
+                    this->trigger_ch1();
                 }
                 break;
 
@@ -272,6 +518,9 @@ namespace gb_sound {
                 this->ch2_env_n_steps      = data & 0x7;
                 this->ch2_env_dir_increase = data & (1 << 3);
                 this->ch2_env_initial_vol  = (data >> 4) & 0xf;
+                if (!dac_enabled(this->ch2_env_initial_vol, this->ch2_env_dir_increase)) {
+                    this->ch2_active = false;
+                }
                 break;
             case REG_NR23:
                 this->ch2_freq = (this->ch2_freq & 0x700) | data;
@@ -280,12 +529,15 @@ namespace gb_sound {
                 this->ch2_freq                = (static_cast<uint16_t>(data & 0x7) << 8) | (this->ch2_freq & 0xff);
                 this->ch2_counter_consecutive = data & (1 << 6);
                 if (data & (1 << 7)) {
-                    this->ch2_initial = true;
+                    this->trigger_ch2();
                 }
                 break;
 
             case REG_NR30:
                 this->ch3_on = data & 0x80;
+                if (!this->ch3_on) {
+                    this->ch3_active = false;
+                }
                 break;
             case REG_NR31:
                 this->ch3_length = 256 - data;
@@ -300,7 +552,7 @@ namespace gb_sound {
                 this->ch3_freq                = (static_cast<uint16_t>(data & 0x7) << 8) | (this->ch3_freq & 0xff);
                 this->ch3_counter_consecutive = data & (1 << 6);
                 if (data & (1 << 7)) {
-                    this->ch3_initial = true;
+                    this->trigger_ch3();
                 }
                 break;
 
@@ -311,6 +563,9 @@ namespace gb_sound {
                 this->ch4_env_n_steps      = data & 0x7;
                 this->ch4_env_dir_increase = data & (1 << 3);
                 this->ch4_env_initial_vol  = (data >> 4) & 0xf;
+                if (!dac_enabled(this->ch4_env_initial_vol, this->ch4_env_dir_increase)) {
+                    this->ch4_active = false;
+                }
                 break;
             case REG_NR43:
                 this->ch4_div_ratio     = data & 0x7;
@@ -320,7 +575,7 @@ namespace gb_sound {
             case REG_NR44:
                 this->ch4_counter_consecutive = data & (1 << 6);
                 if (data & (1 << 7)) {
-                    this->ch4_initial = true;
+                    this->trigger_ch4();
                 }
                 break;
 
@@ -332,7 +587,16 @@ namespace gb_sound {
                 this->channel_matrix = data;
                 break;
             case REG_NR52:
+                if ((data & 0x80) && !this->master_on) {
+                    this->frame_sequencer_step = 0;
+                }
                 this->master_on = data & 0x80;
+                if (!this->master_on) {
+                    this->ch1_active = false;
+                    this->ch2_active = false;
+                    this->ch3_active = false;
+                    this->ch4_active = false;
+                }
                 break;
 
             // wave pattern ram
@@ -352,14 +616,38 @@ namespace gb_sound {
             case 0x3d:
             case 0x3e:
             case 0x3f:
+                this->wave_ram[regid - 0x30] = data;
                 break;
 
-                // break;
             default:
                 throw std::runtime_error(fmt::format("Invalid regid passed to Sound: {}", regid));
         }
     }
 
+    template <typename Self, typename Stream>
+    void Sound::transfer_state(Self &self, Stream &s) {
+        // the output stage (synthesis rate, resampler) is host configuration and not part of the state
+        s(self.ch1_sweep_n_steps, self.ch1_sweep_dir_decrease, self.ch1_sweep_time, self.ch1_duty, self.ch1_length,
+          self.ch1_env_n_steps, self.ch1_env_dir_increase, self.ch1_env_initial_vol, self.ch1_freq,
+          self.ch1_counter_consecutive, self.ch1_phase, self.ch1_active, self.ch1_volume, self.ch1_env_timer,
+          self.ch1_sweep_timer, self.ch1_sweep_shadow_freq, self.ch1_sweep_enabled, self.ch2_duty, self.ch2_length,
+          self.ch2_counter_consecutive, self.ch2_env_dir_increase, self.ch2_env_initial_vol, self.ch2_env_n_steps,
+          self.ch2_freq, self.ch2_phase, self.ch2_active, self.ch2_volume, self.ch2_env_timer, self.ch3_on,
+          self.ch3_length, self.ch3_counter_consecutive, self.ch3_freq, self.ch3_level, self.wave_ram, self.ch3_phase,
+          self.ch3_active, self.ch4_length, self.ch4_env_n_steps, self.ch4_env_dir_increase, self.ch4_env_initial_vol,
+          self.ch4_div_ratio, self.ch4_counter_width, self.ch4_shift_clock, self.ch4_counter_consecutive,
+          self.ch4_active, self.ch4_volume, self.ch4_env_timer, self.ch4_lfsr, self.ch4_phase, self.master_on,
+          self.so1_vol, self.so2_vol, self.channel_matrix, self.frame_sequencer_step);
+    }
+
+    void Sound::save_state(StateWriter &w) const {
+        transfer_state(*this, w);
+    }
+
+    void Sound::load_state(StateReader &r) {
+        transfer_state(*this, r);
+    }
+
     void Sound::dump(std::ostream &os) const {
         os << fmt::format("Sound not implemented...\n");
     }
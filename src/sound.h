@@ -1,19 +1,36 @@
 #ifndef SOUND_H
 #define SOUND_H
 
+#include "resampler.h"
+
+#include <array>
 #include <cstdint>
 #include <iosfwd>
 
+class StateReader;
+class StateWriter;
+
 namespace gb_sound {
     constexpr int N_CHANNELS  = 2;
     constexpr int SAMPLE_RATE = 48000;
     constexpr int BLOCK_SIZE  = 64;
 
+    // internal synthesis rates, power-of-two fractions of the 4 MiHz master clock
+    constexpr int SYNTH_RATE_FAST = 1 << 16;
+    constexpr int SYNTH_RATE_HIGH = 1 << 20;
+
+    // the frame sequencer runs at 512 Hz, clocking length counters, sweep and envelopes
+    constexpr uint64_t FRAME_SEQUENCER_PERIOD = (1 << 22) / 512;
+
     class Sound {
     public:
+        Sound();
+
         void reset();
 
-        void do_tick(uint64_t clock);
+        void set_resampler_quality(ResamplerQuality quality);
+
+        void step_frame_sequencer();
 
         void render(int16_t *buffer, int n_frames);
 
@@ -21,7 +38,27 @@ namespace gb_sound {
         void    write_reg(uint8_t regid, uint8_t data);
         void    dump(std::ostream &os) const;
 
+        // binary save state, see state_stream.h
+        void save_state(StateWriter &w) const;
+        void load_state(StateReader &r);
+
     private:
+        template <typename Self, typename Stream>
+        static void transfer_state(Self &self, Stream &s);
+
+        void synthesize(int16_t *buffer, int n_frames);
+        void render_wave(int16_t *out, int n);
+        void render_noise(int16_t *out, int n);
+
+        void     trigger_ch1();
+        void     trigger_ch2();
+        void     trigger_ch3();
+        void     trigger_ch4();
+        uint16_t ch1_sweep_next_freq();
+        void     clock_lengths();
+        void     clock_sweep();
+        void     clock_envelopes();
+
         //---------------------------------------------------------------
         // channel 1 (tone & sweep)
         //---------------------------------------------------------------
@@ -36,10 +73,14 @@ namespace gb_sound {
         uint8_t  ch1_env_initial_vol{0};
         uint16_t ch1_freq{0};
         bool     ch1_counter_consecutive{false};
-        bool     ch1_initial{false};
         // state
         uint32_t ch1_phase{0};
         bool     ch1_active{false};
+        uint8_t  ch1_volume{0};
+        uint8_t  ch1_env_timer{0};
+        uint8_t  ch1_sweep_timer{0};
+        uint16_t ch1_sweep_shadow_freq{0};
+        bool     ch1_sweep_enabled{false};
 
         //---------------------------------------------------------------
         // channel 2 (tone)
@@ -48,7 +89,6 @@ namespace gb_sound {
         uint8_t  ch2_duty{2};
         uint8_t  ch2_length{0};
         bool     ch2_counter_consecutive{false};
-        bool     ch2_initial{false};
         bool     ch2_env_dir_increase{false};
         uint8_t  ch2_env_initial_vol{0};
         uint8_t  ch2_env_n_steps{0};
@@ -56,31 +96,41 @@ namespace gb_sound {
         // state
         uint32_t ch2_phase{0};
         bool     ch2_active{false};
+        uint8_t  ch2_volume{0};
+        uint8_t  ch2_env_timer{0};
 
         //---------------------------------------------------------------
         // channel 3 (wave output)
         //---------------------------------------------------------------
         // properties
-        bool     ch3_on{false};
-        uint8_t  ch3_length{0};
-        bool     ch3_counter_consecutive{false};
-        bool     ch3_initial{false};
-        uint16_t ch3_freq{0};
-        uint8_t  ch3_level{0};
+        bool                    ch3_on{false};
+        uint16_t                ch3_length{0};
+        bool                    ch3_counter_consecutive{false};
+        uint16_t                ch3_freq{0};
+        uint8_t                 ch3_level{0};
+        // state
+        std::array<uint8_t, 16> wave_ram{};
+        uint32_t                ch3_phase{0};
+        bool                    ch3_active{false};
 
         //---------------------------------------------------------------
         // channel 4 (noise)
         //---------------------------------------------------------------
         // properties
-        uint8_t ch4_length{0};
-        uint8_t ch4_env_n_steps{0};
-        bool    ch4_env_dir_increase{false};
-        uint8_t ch4_env_initial_vol{0};
-        uint8_t ch4_div_ratio{0};
-        bool    ch4_counter_width{false};
-        uint8_t ch4_shift_clock{0};
-        bool    ch4_counter_consecutive{0};
-        bool    ch4_initial{false};
+        uint8_t  ch4_length{0};
+        uint8_t  ch4_env_n_steps{0};
+        bool     ch4_env_dir_increase{false};
+        uint8_t  ch4_env_initial_vol{0};
+        uint8_t  ch4_div_ratio{0};
+        bool     ch4_counter_width{false};
+        uint8_t  ch4_shift_clock{0};
+        bool     ch4_counter_consecutive{0};
+        // state
+        bool     ch4_active{false};
+        uint8_t  ch4_volume{0};
+        uint8_t  ch4_env_timer{0};
+        uint16_t ch4_lfsr{0x7fff};
+        uint64_t ch4_phase{0}; // LFSR clocks, 32.32 fixed point
 
         //---------------------------------------------------------------
         // master properties
@@ -89,6 +139,17 @@ namespace gb_sound {
         uint8_t so1_vol{0};
         uint8_t so2_vol{0};
         uint8_t channel_matrix{0};
+        uint8_t frame_sequencer_step{0};
+
+        //---------------------------------------------------------------
+        // output stage
+        //---------------------------------------------------------------
+        static constexpr int SYNTH_BLOCK_SIZE = 1024;
+        static constexpr int MIX_BLOCK_SIZE   = 256;
+
+        int                                                synth_rate{SYNTH_RATE_HIGH};
+        Resampler                                          resampler;
+        std::array<int16_t, N_CHANNELS * SYNTH_BLOCK_SIZE> synth_buffer{};
     };
 
 } // namespace gb_sound
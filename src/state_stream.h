@@ -0,0 +1,126 @@
+#ifndef STATE_STREAM_H
+#define STATE_STREAM_H
+
+#include <fmt/core.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Cursors for binary save states over a caller provided buffer. Values are copied as raw bytes in host
+// byte order, so states are only meant to be loaded by the same build on the same kind of machine.
+//
+// Components describe their state once with a call like `s(this->a, this->b, this->buffer)`, which
+// serializes when `s` is a StateWriter and deserializes when it is a StateReader.
+
+class StateWriter {
+public:
+    // a writer without buffer only counts the bytes that would be written
+    StateWriter() = default;
+    StateWriter(uint8_t *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {
+    }
+
+    template <typename... Ts>
+    void operator()(const Ts &...values) {
+        (this->put(values), ...);
+    }
+
+    void put_bytes(const void *data, size_t n) {
+        if (this->buffer != nullptr) {
+            if (this->pos + n > this->capacity) {
+                throw std::runtime_error(fmt::format("State buffer too small ({} bytes)", this->capacity));
+            }
+            std::memcpy(this->buffer + this->pos, data, n);
+        }
+        this->pos += n;
+    }
+
+    size_t size() const {
+        return this->pos;
+    }
+
+private:
+    template <typename T>
+    void put(const T &value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        this->put_bytes(&value, sizeof(T));
+    }
+
+    // written as flag and value, so that the bytes do not depend on the unused storage
+    template <typename T>
+    void put(const std::optional<T> &value) {
+        this->put(value.has_value());
+        this->put(value.value_or(T{}));
+    }
+
+    template <typename T>
+    void put(const std::vector<T> &values) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        this->put_bytes(values.data(), values.size() * sizeof(T));
+    }
+
+    uint8_t *buffer{nullptr};
+    size_t   capacity{0};
+    size_t   pos{0};
+};
+
+class StateReader {
+public:
+    StateReader(const uint8_t *buffer, size_t size) : buffer(buffer), n_bytes(size) {
+    }
+
+    template <typename... Ts>
+    void operator()(Ts &...values) {
+        (this->get(values), ...);
+    }
+
+    void get_bytes(void *data, size_t n) {
+        std::memcpy(data, this->view_bytes(n), n);
+    }
+
+    // consumes n bytes and returns a pointer to them in the buffer
+    const uint8_t *view_bytes(size_t n) {
+        if (this->pos + n > this->n_bytes) {
+            throw std::runtime_error("Truncated save state");
+        }
+        const uint8_t *data = this->buffer + this->pos;
+        this->pos += n;
+        return data;
+    }
+
+    size_t size() const {
+        return this->pos;
+    }
+
+private:
+    template <typename T>
+    void get(T &value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        this->get_bytes(&value, sizeof(T));
+    }
+
+    template <typename T>
+    void get(std::optional<T> &value) {
+        bool has_value;
+        T    v;
+        this->get(has_value);
+        this->get(v);
+        value = has_value ? std::optional<T>(v) : std::nullopt;
+    }
+
+    // vectors are fixed-size machine memories, their size is not part of the state
+    template <typename T>
+    void get(std::vector<T> &values) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        this->get_bytes(values.data(), values.size() * sizeof(T));
+    }
+
+    const uint8_t *buffer;
+    size_t         n_bytes;
+    size_t         pos{0};
+};
+
+#endif /* STATE_STREAM_H */
@@ -0,0 +1,363 @@
+#include "trace_log.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+constexpr char     TRACE_MAGIC[8]        = {'G', 'B', 'T', 'R', 'A', 'C', 'E', '\0'};
+constexpr uint32_t TRACE_VERSION         = 1;
+constexpr int      HEADER_SIZE           = 16; // magic, version and record size
+constexpr int      N_PREALLOCATED_CHUNKS = 8;
+constexpr size_t   READ_BUFFER_RECORDS   = 4096;
+constexpr int      GZIP_WINDOW_BITS      = 15 + 16; // a gzip wrapper, see deflateInit2
+constexpr size_t   DEFLATE_BUFFER_SIZE   = 1 << 16;
+
+std::string TraceRecord::format() const {
+    return fmt::format("A:{:02X} F:{:02X} B:{:02X} C:{:02X} D:{:02X} E:{:02X} H:{:02X} L:{:02X} SP:{:04X} PC:{:04X} "
+                       "PCMEM:{:02X},{:02X},{:02X},{:02X}",
+                       this->regs.a,
+                       this->regs.f,
+                       this->regs.b,
+                       this->regs.c,
+                       this->regs.d,
+                       this->regs.e,
+                       this->regs.h,
+                       this->regs.l,
+                       this->regs.sp,
+                       this->regs.pc,
+                       this->pcmem[0],
+                       this->pcmem[1],
+                       this->pcmem[2],
+                       this->pcmem[3]);
+}
+
+std::string TraceRecord::diff_fields(const TraceRecord &other) const {
+    const CpuRegisters &r = this->regs;
+    const CpuRegisters &o = other.regs;
+
+    const std::pair<const char *, bool> fields[] = {
+        {"A", r.a != o.a},
+        {"F", r.f != o.f},
+        {"B", r.b != o.b},
+        {"C", r.c != o.c},
+        {"D", r.d != o.d},
+        {"E", r.e != o.e},
+        {"H", r.h != o.h},
+        {"L", r.l != o.l},
+        {"SP", r.sp != o.sp},
+        {"PC", r.pc != o.pc},
+        {"PCMEM", this->pcmem != other.pcmem},
+    };
+    std::string out;
+    for (auto [name, differs] : fields) {
+        if (differs) {
+            out += out.empty() ? name : fmt::format(" {}", name);
+        }
+    }
+    return out;
+}
+
+static void decode_record(const uint8_t *p, TraceRecord &record) {
+    record.regs.a  = p[0];
+    record.regs.f  = p[1];
+    record.regs.b  = p[2];
+    record.regs.c  = p[3];
+    record.regs.d  = p[4];
+    record.regs.e  = p[5];
+    record.regs.h  = p[6];
+    record.regs.l  = p[7];
+    record.regs.sp = p[8] | p[9] << 8;
+    record.regs.pc = p[10] | p[11] << 8;
+    std::copy(p + 12, p + 16, record.pcmem.begin());
+}
+
+TraceWriter::TraceWriter(const std::filesystem::path &path)
+    : path(path),
+      fs(path, std::ios_base::binary),
+      deflated(DEFLATE_BUFFER_SIZE) {
+
+    if (!this->fs) {
+        throw std::runtime_error(fmt::format("Failed to open \"{}\" for writing", path.string()));
+    }
+    if (deflateInit2(&this->zs, Z_BEST_SPEED, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialize zlib");
+    }
+
+    uint8_t header[HEADER_SIZE] = {};
+    std::copy(std::begin(TRACE_MAGIC), std::end(TRACE_MAGIC), header);
+    header[8]  = TRACE_VERSION;
+    header[12] = RECORD_SIZE;
+    this->deflate_bytes(header, sizeof(header), Z_NO_FLUSH);
+
+    for (int i = 0; i < N_PREALLOCATED_CHUNKS; i++) {
+        this->chunks.push_back(std::make_unique<Chunk>());
+        this->chunks.back()->bytes.resize(CHUNK_RECORDS * RECORD_SIZE);
+        this->free_chunks.push_back(this->chunks.back().get());
+    }
+
+    this->thread = std::thread(&TraceWriter::writer_loop, this);
+}
+
+TraceWriter::~TraceWriter() {
+    try {
+        this->close();
+    } catch (const std::exception &) {
+        // errors are only reported by an explicit close
+    }
+}
+
+void TraceWriter::close() {
+    if (!this->thread.joinable()) {
+        return;
+    }
+
+    if (this->current != nullptr && this->current->n_records > 0) {
+        this->submit_chunk(this->current);
+    }
+    this->current = nullptr;
+
+    {
+        std::lock_guard lock(this->mutex);
+        this->closing = true;
+    }
+    this->cv.notify_one();
+    this->thread.join();
+    deflateEnd(&this->zs);
+    this->fs.close();
+
+    if (this->failed || !this->fs) {
+        throw std::runtime_error(fmt::format("Failed to write trace \"{}\"", this->path.string()));
+    }
+}
+
+TraceWriter::Chunk *TraceWriter::acquire_chunk() {
+    std::unique_lock lock(this->mutex);
+    if (this->free_chunks.empty() && this->chunks.size() < MAX_CHUNKS) {
+        // the writer thread is behind, grow the pool up to a limit before stalling the caller
+        this->chunks.push_back(std::make_unique<Chunk>());
+        this->chunks.back()->bytes.resize(CHUNK_RECORDS * RECORD_SIZE);
+        return this->chunks.back().get();
+    }
+
+    this->free_cv.wait(lock, [this] { return !this->free_chunks.empty(); });
+    Chunk *chunk = this->free_chunks.front();
+    this->free_chunks.pop_front();
+    return chunk;
+}
+
+void TraceWriter::submit_chunk(Chunk *chunk) {
+    {
+        std::lock_guard lock(this->mutex);
+        this->full_chunks.push_back(chunk);
+    }
+    this->cv.notify_one();
+}
+
+void TraceWriter::writer_loop() {
+    std::vector<uint8_t>             delta(CHUNK_RECORDS * RECORD_SIZE);
+    std::array<uint8_t, RECORD_SIZE> previous{};
+
+    while (true) {
+        Chunk *chunk = nullptr;
+        {
+            std::unique_lock lock(this->mutex);
+            this->cv.wait(lock, [this] { return this->closing || !this->full_chunks.empty(); });
+            if (this->full_chunks.empty()) {
+                break; // closing and fully drained
+            }
+            chunk = this->full_chunks.front();
+            this->full_chunks.pop_front();
+        }
+
+        // consecutive records mostly differ in a few bytes, XORing them leaves runs of zeros which deflate
+        // compresses far better than the records themselves
+        const size_t n_bytes = chunk->n_records * RECORD_SIZE;
+        for (size_t i = 0; i < n_bytes; i += RECORD_SIZE) {
+            for (size_t j = 0; j < RECORD_SIZE; j++) {
+                delta[i + j] = chunk->bytes[i + j] ^ previous[j];
+                previous[j]  = chunk->bytes[i + j];
+            }
+        }
+
+        {
+            std::lock_guard lock(this->mutex);
+            chunk->n_records = 0;
+            this->free_chunks.push_back(chunk);
+        }
+        this->free_cv.notify_one();
+
+        this->deflate_bytes(delta.data(), n_bytes, Z_NO_FLUSH);
+    }
+
+    this->deflate_bytes(nullptr, 0, Z_FINISH);
+}
+
+void TraceWriter::deflate_bytes(const uint8_t *data, size_t size, int flush) {
+    this->zs.next_in  = const_cast<uint8_t *>(data);
+    this->zs.avail_in = size;
+    do {
+        this->zs.next_out  = this->deflated.data();
+        this->zs.avail_out = this->deflated.size();
+        if (deflate(&this->zs, flush) == Z_STREAM_ERROR) {
+            this->failed = true;
+            return;
+        }
+        this->fs.write(reinterpret_cast<const char *>(this->deflated.data()),
+                       this->deflated.size() - this->zs.avail_out);
+    } while (this->zs.avail_out == 0);
+}
+
+TraceReader::TraceReader(const std::filesystem::path &path) : path(path.string()) {
+    this->file = gzopen(this->path.c_str(), "rb");
+    if (this->file == nullptr) {
+        throw std::runtime_error(fmt::format("Failed to open trace \"{}\": {}", this->path, strerror(errno)));
+    }
+    gzbuffer(this->file, 1 << 17);
+
+    uint8_t header[HEADER_SIZE];
+    if (gzread(this->file, header, sizeof(header)) == HEADER_SIZE &&
+        std::equal(std::begin(TRACE_MAGIC), std::end(TRACE_MAGIC), header)) {
+        if (header[8] != TRACE_VERSION || header[12] != TraceWriter::RECORD_SIZE) {
+            gzclose(this->file);
+            throw std::runtime_error(fmt::format("Unsupported version of trace \"{}\"", this->path));
+        }
+        this->binary = true;
+    } else {
+        gzrewind(this->file);
+        this->line.resize(256);
+    }
+}
+
+TraceReader::~TraceReader() {
+    gzclose(this->file);
+}
+
+std::optional<TraceRecord> TraceReader::read() {
+    return this->binary ? this->read_binary() : this->read_text();
+}
+
+std::optional<TraceRecord> TraceReader::read_binary() {
+    if (this->buffer_pos == this->buffer.size()) {
+        this->buffer.resize(READ_BUFFER_RECORDS * TraceWriter::RECORD_SIZE);
+        const int n = gzread(this->file, this->buffer.data(), this->buffer.size());
+        if (n < 0) {
+            int error;
+            throw std::runtime_error(
+                fmt::format("Failed to read trace \"{}\": {}", this->path, gzerror(this->file, &error)));
+        }
+        // a trace cut off in the middle of a record ends with the last complete one
+        this->buffer.resize(n - n % TraceWriter::RECORD_SIZE);
+        this->buffer_pos = 0;
+        if (this->buffer.empty()) {
+            return std::nullopt;
+        }
+    }
+
+    const uint8_t *delta = this->buffer.data() + this->buffer_pos;
+    for (size_t i = 0; i < TraceWriter::RECORD_SIZE; i++) {
+        this->previous[i] ^= delta[i];
+    }
+    this->buffer_pos += TraceWriter::RECORD_SIZE;
+
+    TraceRecord record;
+    decode_record(this->previous.data(), record);
+    return record;
+}
+
+// parses "NAME:HEX" fields separated by spaces, in any order, returns false unless all were found
+static bool parse_doctor_line(const char *s, TraceRecord &record) {
+    auto parse_hex = [](const char *&p, int max_digits, int &value) {
+        value      = 0;
+        int digits = 0;
+        for (; digits < max_digits; digits++, p++) {
+            const char c = *p;
+            if (c >= '0' && c <= '9') {
+                value = value << 4 | (c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                value = value << 4 | (c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                value = value << 4 | (c - 'A' + 10);
+            } else {
+                break;
+            }
+        }
+        return digits > 0;
+    };
+
+    // the registers in the order of CpuRegisters, then PCMEM
+    constexpr const char *NAMES[]  = {"A", "F", "B", "C", "D", "E", "H", "L", "SP", "PC"};
+    constexpr int         N_NAMES  = 10;
+    int                   values[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    int found = 0;
+    while (*s != '\0') {
+        while (*s == ' ' || *s == '\t') {
+            s++;
+        }
+        const char *colon = std::strchr(s, ':');
+        if (colon == nullptr) {
+            break;
+        }
+        const std::string_view name(s, colon - s);
+        s = colon + 1;
+
+        int value;
+        if (name == "PCMEM") {
+            for (int i = 0; i < 4; i++) {
+                if ((i > 0 && *s++ != ',') || !parse_hex(s, 2, value)) {
+                    return false;
+                }
+                record.pcmem[i] = value;
+            }
+            found |= 1 << 10;
+            continue;
+        }
+
+        const int i = std::find(NAMES, NAMES + N_NAMES, name) - NAMES;
+        if (i == N_NAMES || !parse_hex(s, i < 8 ? 2 : 4, values[i])) {
+            return false;
+        }
+        found |= 1 << i;
+    }
+    if (found != (1 << 11) - 1) {
+        return false;
+    }
+
+    CpuRegisters &r = record.regs;
+    r.a             = values[0];
+    r.f             = values[1];
+    r.b             = values[2];
+    r.c             = values[3];
+    r.d             = values[4];
+    r.e             = values[5];
+    r.h             = values[6];
+    r.l             = values[7];
+    r.sp            = values[8];
+    r.pc            = values[9];
+    return true;
+}
+
+std::optional<TraceRecord> TraceReader::read_text() {
+    while (gzgets(this->file, this->line.data(), this->line.size()) != nullptr) {
+        this->line_number++;
+
+        char *end = this->line.data() + std::strlen(this->line.data());
+        while (end > this->line.data() && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ')) {
+            *--end = '\0';
+        }
+        if (end == this->line.data()) {
+            continue;
+        }
+
+        TraceRecord record;
+        if (!parse_doctor_line(this->line.data(), record)) {
+            throw std::runtime_error(fmt::format(
+                "{}:{}: Not a gameboy-doctor log line: \"{}\"", this->path, this->line_number, this->line.data()));
+        }
+        return record;
+    }
+    return std::nullopt;
+}
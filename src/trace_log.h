@@ -0,0 +1,149 @@
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+#include "cpu.h"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+// The state before an instruction executes, as logged by gameboy-doctor: the registers and the four bytes at PC.
+struct TraceRecord {
+    CpuRegisters           regs;
+    std::array<uint8_t, 4> pcmem{};
+
+    bool operator==(const TraceRecord &) const = default;
+
+    // "A:01 F:B0 B:00 C:13 D:00 E:D8 H:01 L:4D SP:FFFE PC:0100 PCMEM:00,C3,13,02"
+    std::string format() const;
+
+    // names of the fields that differ from `other`, e.g. "F PC"
+    std::string diff_fields(const TraceRecord &other) const;
+};
+
+// Writes a trace of every instruction the Cpu executes while attached to it (see Gameboy::set_trace_writer).
+//
+// Records are 16 bytes, collected into chunks which a background thread XORs with the previous record and
+// deflates into a gzip file, so the emulation thread only copies the registers. If compression falls behind
+// by more than MAX_CHUNKS, the emulation thread waits rather than buffering without bounds. TraceReader
+// reads the file back.
+class TraceWriter {
+public:
+    static constexpr size_t RECORD_SIZE   = 16;
+    static constexpr size_t CHUNK_RECORDS = 1 << 16;
+    static constexpr size_t MAX_CHUNKS    = 64;
+
+    TraceWriter(const std::filesystem::path &path);
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter &)            = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    // called by the Cpu at every opcode fetch
+    void write(const CpuRegisters &regs, const std::array<uint8_t, 4> &pcmem) {
+        if (this->current == nullptr) {
+            this->current = this->acquire_chunk();
+        }
+        uint8_t *p = this->current->bytes.data() + this->current->n_records * RECORD_SIZE;
+        p[0]       = regs.a;
+        p[1]       = regs.f;
+        p[2]       = regs.b;
+        p[3]       = regs.c;
+        p[4]       = regs.d;
+        p[5]       = regs.e;
+        p[6]       = regs.h;
+        p[7]       = regs.l;
+        p[8]       = regs.sp & 0xff;
+        p[9]       = regs.sp >> 8;
+        p[10]      = regs.pc & 0xff;
+        p[11]      = regs.pc >> 8;
+        std::copy(pcmem.begin(), pcmem.end(), p + 12);
+
+        this->n_records++;
+        if (++this->current->n_records == CHUNK_RECORDS) {
+            this->submit_chunk(this->current);
+            this->current = nullptr;
+        }
+    }
+
+    uint64_t get_n_records() const {
+        return this->n_records;
+    }
+
+    // flushes the pending records and finishes the file, throws if writing failed
+    void close();
+
+private:
+    struct Chunk {
+        std::vector<uint8_t> bytes;
+        size_t               n_records{0};
+    };
+
+    Chunk *acquire_chunk();
+    void   submit_chunk(Chunk *chunk);
+    void   writer_loop();
+    void   deflate_bytes(const uint8_t *data, size_t size, int flush);
+
+    std::filesystem::path path;
+    std::ofstream         fs;
+    z_stream              zs{};
+    std::vector<uint8_t>  deflated; // output buffer of the writer thread
+    uint64_t              n_records{0};
+    bool                  failed{false}; // set by the writer thread
+
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    Chunk                              *current{nullptr};
+
+    std::mutex              mutex;
+    std::condition_variable cv;      // wakes the writer thread
+    std::condition_variable free_cv; // wakes the emulation thread waiting for a free chunk
+    std::deque<Chunk *>     free_chunks;
+    std::deque<Chunk *>     full_chunks;
+    bool                    closing{false};
+    std::thread             thread;
+};
+
+// Reads a trace written by TraceWriter, or a text log in gameboy-doctor format (plain or gzipped), one record
+// per instruction.
+class TraceReader {
+public:
+    TraceReader(const std::filesystem::path &path);
+    ~TraceReader();
+
+    TraceReader(const TraceReader &)            = delete;
+    TraceReader &operator=(const TraceReader &) = delete;
+
+    // the next record, nothing at the end of the trace; throws on lines that do not parse
+    std::optional<TraceRecord> read();
+
+    bool is_binary() const {
+        return this->binary;
+    }
+
+private:
+    std::optional<TraceRecord> read_binary();
+    std::optional<TraceRecord> read_text();
+
+    gzFile                  file;
+    std::string             path;
+    bool                    binary{false};
+    std::vector<uint8_t>    buffer;
+    size_t                  buffer_pos{0};
+    std::array<uint8_t, 16> previous{};
+    std::vector<char>       line;
+    uint64_t                line_number{0};
+};
+
+#endif /* TRACE_LOG_H */
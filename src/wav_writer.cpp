@@ -0,0 +1,160 @@
+#include "wav_writer.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <stdexcept>
+
+constexpr int N_PREALLOCATED_CHUNKS = 16;
+constexpr int HEADER_SIZE           = 44;
+
+static void put_u16(std::ostream &os, uint16_t v) {
+    const char bytes[2] = {static_cast<char>(v & 0xff), static_cast<char>(v >> 8)};
+    os.write(bytes, 2);
+}
+
+static void put_u32(std::ostream &os, uint32_t v) {
+    put_u16(os, v & 0xffff);
+    put_u16(os, v >> 16);
+}
+
+WavWriter::WavWriter(const std::filesystem::path &path, int sample_rate, int n_channels)
+    : fs(path, std::ios_base::binary),
+      sample_rate(sample_rate),
+      n_channels(n_channels) {
+
+    if (!this->fs) {
+        throw std::runtime_error(fmt::format("Failed to open \"{}\" for writing", path.string()));
+    }
+
+    this->write_header();
+
+    for (int i = 0; i < N_PREALLOCATED_CHUNKS; i++) {
+        this->chunks.push_back(std::make_unique<Chunk>());
+        this->chunks.back()->samples.resize(CHUNK_FRAMES * n_channels);
+        this->free_chunks.push_back(this->chunks.back().get());
+    }
+
+    this->thread = std::thread(&WavWriter::writer_loop, this);
+}
+
+WavWriter::~WavWriter() {
+    this->close();
+}
+
+void WavWriter::write(const int16_t *frames, int n_frames) {
+    size_t n_samples = static_cast<size_t>(n_frames) * this->n_channels;
+    while (n_samples > 0) {
+        if (this->current == nullptr) {
+            this->current = this->acquire_chunk();
+        }
+
+        const size_t n = std::min(n_samples, this->current->samples.size() - this->current->n_samples);
+        std::copy(frames, frames + n, this->current->samples.begin() + this->current->n_samples);
+        this->current->n_samples += n;
+        frames += n;
+        n_samples -= n;
+
+        if (this->current->n_samples == this->current->samples.size()) {
+            this->submit_chunk(this->current);
+            this->current = nullptr;
+        }
+    }
+}
+
+void WavWriter::close() {
+    if (!this->thread.joinable()) {
+        return;
+    }
+
+    if (this->current != nullptr && this->current->n_samples > 0) {
+        this->submit_chunk(this->current);
+    }
+    this->current = nullptr;
+
+    {
+        std::lock_guard lock(this->mutex);
+        this->closing = true;
+    }
+    this->cv.notify_one();
+    this->thread.join();
+    this->fs.close();
+}
+
+WavWriter::Chunk *WavWriter::acquire_chunk() {
+    std::lock_guard lock(this->mutex);
+    if (this->free_chunks.empty()) {
+        // the writer thread is behind, grow the pool rather than stall the caller
+        this->chunks.push_back(std::make_unique<Chunk>());
+        this->chunks.back()->samples.resize(CHUNK_FRAMES * this->n_channels);
+        return this->chunks.back().get();
+    }
+
+    Chunk *chunk = this->free_chunks.front();
+    this->free_chunks.pop_front();
+    return chunk;
+}
+
+void WavWriter::submit_chunk(Chunk *chunk) {
+    {
+        std::lock_guard lock(this->mutex);
+        this->full_chunks.push_back(chunk);
+    }
+    this->cv.notify_one();
+}
+
+void WavWriter::writer_loop() {
+    std::vector<char> bytes;
+
+    while (true) {
+        Chunk *chunk = nullptr;
+        {
+            std::unique_lock lock(this->mutex);
+            this->cv.wait(lock, [this] { return this->closing || !this->full_chunks.empty(); });
+            if (this->full_chunks.empty()) {
+                return; // closing and fully drained
+            }
+            chunk = this->full_chunks.front();
+            this->full_chunks.pop_front();
+        }
+
+        // WAV data is always little endian
+        bytes.resize(chunk->n_samples * sizeof(int16_t));
+        for (size_t i = 0; i < chunk->n_samples; i++) {
+            const auto v     = static_cast<uint16_t>(chunk->samples[i]);
+            bytes[2 * i + 0] = static_cast<char>(v & 0xff);
+            bytes[2 * i + 1] = static_cast<char>(v >> 8);
+        }
+        this->fs.write(bytes.data(), bytes.size());
+        this->data_bytes += chunk->n_samples * sizeof(int16_t);
+        this->write_header();
+        this->fs.seekp(0, std::ios_base::end);
+        this->fs.flush();
+
+        {
+            std::lock_guard lock(this->mutex);
+            chunk->n_samples = 0;
+            this->free_chunks.push_back(chunk);
+        }
+    }
+}
+
+void WavWriter::write_header() {
+    const uint16_t block_align = this->n_channels * sizeof(int16_t);
+
+    this->fs.seekp(0);
+    this->fs.write("RIFF", 4);
+    put_u32(this->fs, HEADER_SIZE - 8 + this->data_bytes);
+    this->fs.write("WAVE", 4);
+
+    this->fs.write("fmt ", 4);
+    put_u32(this->fs, 16); // fmt chunk size
+    put_u16(this->fs, 1);  // PCM
+    put_u16(this->fs, this->n_channels);
+    put_u32(this->fs, this->sample_rate);
+    put_u32(this->fs, this->sample_rate * block_align);
+    put_u16(this->fs, block_align);
+    put_u16(this->fs, 16); // bits per sample
+
+    this->fs.write("data", 4);
+    put_u32(this->fs, this->data_bytes);
+}
@@ -0,0 +1,54 @@
+#ifndef WAV_WRITER_H
+#define WAV_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Streams 16-bit PCM audio to a WAV file. Samples are collected into fixed-size chunks which are
+// handed to a background thread for writing, so the caller never blocks on disk I/O. The header
+// is kept up to date after every chunk, so the file is valid even if the process is killed.
+class WavWriter {
+public:
+    static constexpr int CHUNK_FRAMES = 4096;
+
+    WavWriter(const std::filesystem::path &path, int sample_rate, int n_channels);
+    ~WavWriter();
+
+    void write(const int16_t *frames, int n_frames);
+    void close();
+
+private:
+    struct Chunk {
+        std::vector<int16_t> samples;
+        size_t               n_samples{0};
+    };
+
+    Chunk *acquire_chunk();
+    void   submit_chunk(Chunk *chunk);
+    void   writer_loop();
+    void   write_header();
+
+    std::ofstream fs;
+    int           sample_rate;
+    int           n_channels;
+    uint32_t      data_bytes{0};
+
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    Chunk                              *current{nullptr};
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::deque<Chunk *>     free_chunks;
+    std::deque<Chunk *>     full_chunks;
+    bool                    closing{false};
+    std::thread             thread;
+};
+
+#endif /* WAV_WRITER_H */
@@ -0,0 +1,107 @@
+#include "work_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+WorkPool::WorkPool(int n_threads) : n_threads(std::max(1, n_threads)), queues(new Queue[this->n_threads]) {
+    for (int i = 1; i < this->n_threads; i++) {
+        this->threads.emplace_back(&WorkPool::worker_main, this, i);
+    }
+}
+
+WorkPool::~WorkPool() {
+    {
+        std::lock_guard lock(this->mutex);
+        this->stopping = true;
+    }
+    this->start.notify_all();
+    for (auto &t : this->threads) {
+        t.join();
+    }
+}
+
+void WorkPool::run_jobs(size_t n_jobs, JobFn fn, void *context) {
+    // the workers are parked, the queues are published to them by the generation change below
+    for (int i = 0; i < this->n_threads; i++) {
+        this->queues[i].begin = n_jobs * i / this->n_threads;
+        this->queues[i].end   = n_jobs * (i + 1) / this->n_threads;
+    }
+
+    {
+        std::lock_guard lock(this->mutex);
+        this->job_fn      = fn;
+        this->job_context = context;
+        this->n_running   = this->n_threads - 1;
+        this->generation++;
+    }
+    this->start.notify_all();
+
+    this->work(0);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock lock(this->mutex);
+        this->done.wait(lock, [this] { return this->n_running == 0; });
+        error = std::exchange(this->error, nullptr);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void WorkPool::worker_main(int worker) {
+    uint64_t generation = 0;
+    while (true) {
+        {
+            std::unique_lock lock(this->mutex);
+            this->start.wait(lock, [&] { return this->stopping || this->generation != generation; });
+            if (this->stopping) {
+                return;
+            }
+            generation = this->generation;
+        }
+
+        this->work(worker);
+
+        std::lock_guard lock(this->mutex);
+        if (--this->n_running == 0) {
+            this->done.notify_one();
+        }
+    }
+}
+
+void WorkPool::work(int worker) {
+    size_t job;
+    while (this->pop_own(worker, job) || this->steal(worker, job)) {
+        try {
+            this->job_fn(this->job_context, job, worker);
+        } catch (...) {
+            std::lock_guard lock(this->mutex);
+            if (!this->error) {
+                this->error = std::current_exception();
+            }
+        }
+    }
+}
+
+bool WorkPool::pop_own(int worker, size_t &job) {
+    Queue          &q = this->queues[worker];
+    std::lock_guard lock(q.mutex);
+    if (q.begin == q.end) {
+        return false;
+    }
+    job = --q.end;
+    return true;
+}
+
+bool WorkPool::steal(int worker, size_t &job) {
+    for (int i = 1; i < this->n_threads; i++) {
+        Queue          &q = this->queues[(worker + i) % this->n_threads];
+        std::lock_guard lock(q.mutex);
+        if (q.begin != q.end) {
+            job = q.begin++;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,74 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Runs a batch of independent jobs on a fixed number of threads. Every worker owns a range of job
+// indices, it takes work from the back of its own range and, once that is empty, steals from the front
+// of the others. This keeps all cores busy when job durations vary widely.
+//
+// The worker threads are started once and wait on a condition variable between runs, and a run allocates
+// nothing, so the pool can be run once per emulated frame. The calling thread works as worker 0.
+class WorkPool {
+public:
+    explicit WorkPool(int n_threads);
+    ~WorkPool();
+
+    WorkPool(const WorkPool &)            = delete;
+    WorkPool &operator=(const WorkPool &) = delete;
+
+    int get_n_threads() const {
+        return this->n_threads;
+    }
+
+    // calls fn(job, worker) for every job in [0, n_jobs) and returns once all have finished, rethrowing the
+    // first exception a job threw; runs must not overlap
+    template <typename Fn>
+    void run(size_t n_jobs, Fn &&fn) {
+        using F = std::remove_reference_t<Fn>;
+        this->run_jobs(
+            n_jobs,
+            [](void *context, size_t job, int worker) { (*static_cast<F *>(context))(job, worker); },
+            const_cast<void *>(static_cast<const void *>(std::addressof(fn))));
+    }
+
+private:
+    using JobFn = void (*)(void *context, size_t job, int worker);
+
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        size_t     begin{0};
+        size_t     end{0};
+    };
+
+    void run_jobs(size_t n_jobs, JobFn fn, void *context);
+    void worker_main(int worker);
+    void work(int worker);
+    bool pop_own(int worker, size_t &job);
+    bool steal(int worker, size_t &job);
+
+    int                      n_threads;
+    std::unique_ptr<Queue[]> queues;
+    std::vector<std::thread> threads;
+
+    // the current run, guarded by `mutex`
+    std::mutex              mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    uint64_t                generation{0};
+    int                     n_running{0};
+    bool                    stopping{false};
+    JobFn                   job_fn{nullptr};
+    void                   *job_context{nullptr};
+    std::exception_ptr      error;
+};
+
+#endif /* WORK_POOL_H */